@@ -0,0 +1,447 @@
+/**************************************************************************************************
+ * Headless benchmark for the animation classes
+ *
+ * Runs each animation class for a fixed number of cycles on an in-memory renderer, at several
+ * grid sizes, so performance can be measured on any machine without display hardware. Random
+ * numbers are seeded the same way for every run, so each run does the same work.
+ *
+ * Results are written to stdout, one line of JSON per run:
+ *   {"animator":"gol","grid":"64x32","cube":false,"cycles":500,"items":2048,
+ *    "fps":1234.5,"ns_per_item":395.6,"peak_heap_bytes":123456}
+ * where items is the number of cells, particles or balls updated each cycle.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ * 
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+
+#include "crawler.h"
+#include "crawlerSwarm.h"
+#include "frameRecorder.h"
+#include "golife.h"
+#include "gravityparticles.h"
+#include "gravitySimulation.h"
+
+// Track heap use of each run by counting bytes allocated through new and delete. Each block
+// has a header holding its size, so deletes can be subtracted.
+static size_t heapCurrent = 0;
+static size_t heapPeak = 0;
+static const size_t heapHeader = 16; // Keeps blocks aligned for any type
+
+void* operator new(size_t size)
+{
+    char* block = (char*)malloc(size + heapHeader);
+    if (block == NULL) {
+        throw std::bad_alloc();
+    }
+    *(size_t*)block = size;
+    heapCurrent += size;
+    if (heapCurrent > heapPeak) {
+        heapPeak = heapCurrent;
+    }
+    return block + heapHeader;
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr != NULL) {
+        char* block = (char*)ptr - heapHeader;
+        heapCurrent -= *(size_t*)block;
+        free(block);
+    }
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+// Renderer which just keeps pixels in memory
+class NullRenderer : public RGBMatrixRenderer {
+    public:
+        NullRenderer(uint16_t width, uint16_t height, bool cube, bool verbose_)
+            : RGBMatrixRenderer{width,height,255,cube}, verbose(verbose_)
+        {
+            pixels = new RGB_colour[width * height];
+        }
+
+        virtual ~NullRenderer()
+        {
+            delete [] pixels;
+        }
+
+        void showPixels() {
+            //Nothing to do as pixels are only kept in memory
+        }
+
+        void outputMessage(char msg[]) {
+            if (verbose) {
+                fprintf(stderr,"%s",msg);
+            }
+        }
+        
+        void msSleep(int delay_ms) {
+            //Never sleep, so only the animation time is measured
+        }
+
+    private:
+        RGB_colour* pixels;
+        bool verbose;
+
+        void setPixel(uint16_t x, uint16_t y, RGB_colour colour) 
+        {
+            pixels[y * gridWidth + x] = colour;
+        }
+
+        void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            memcpy(&pixels[y * gridWidth + x], colours, count * sizeof(RGB_colour));
+        }
+};
+
+struct GridSize {
+    uint16_t width;
+    uint16_t height;
+    bool cube;
+};
+
+// Animator to run, constructed by the run function on the renderer for each grid size
+struct Benchmark {
+    const char* name;
+    uint32_t (*run)(NullRenderer&, uint32_t, double&);
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Each run function sets up its animation, then times it running for the given number of cycles.
+// Returns the number of items updated each cycle.
+
+static uint32_t runGameOfLife(RGBMatrixRenderer& renderer, uint32_t cycles, double& seconds, bool packed)
+{
+    GameOfLife animation(renderer, 1, 0, 0);
+    animation.setBitPackedEngine(packed);
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        animation.runCycle();
+    }
+    seconds = secondsSince(start);
+    return renderer.getGridWidth() * renderer.getGridHeight();
+}
+
+static uint32_t runGol(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    return runGameOfLife(renderer, cycles, seconds, false);
+}
+
+static uint32_t runGolPacked(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    return runGameOfLife(renderer, cycles, seconds, true);
+}
+
+static uint32_t runSand(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    GravityParticles animation(renderer, 10, 1);
+
+    //Fill a quarter of the grid with grains
+    uint16_t numGrains = renderer.getGridWidth() * renderer.getGridHeight() / 4;
+    for (uint16_t i=0; i<numGrains; i++) {
+        animation.addParticle( RGB_colour{255,128,0} );
+    }
+
+    //Turn gravity round every 100 cycles, so grains keep moving
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        int16_t accel = ((i / 100) % 2) ? 50 : -50;
+        if (renderer.getGridWidth() == renderer.getGridHeight() * 3 / 2) {
+            animation.setAcceleration(accel / 2, accel, accel / 3);
+        }
+        else {
+            animation.setAcceleration(accel / 2, accel);
+        }
+        animation.runCycle();
+    }
+    seconds = secondsSince(start);
+    return animation.getParticleCount();
+}
+
+// Sand falling on its own layer over a Game of Life background, so both are combined for display
+static uint32_t runLayers(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    GameOfLife background(renderer, 1, 0, 0);
+    uint8_t sandLayer = renderer.addLayer();
+    renderer.selectLayer(sandLayer);
+    GravityParticles sand(renderer, 10, 1);
+
+    uint16_t numGrains = renderer.getGridWidth() * renderer.getGridHeight() / 8;
+    for (uint16_t i=0; i<numGrains; i++) {
+        sand.addParticle( RGB_colour{255,128,0} );
+    }
+
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        int16_t accel = ((i / 100) % 2) ? 50 : -50;
+        sand.setAcceleration(accel / 2, accel);
+        renderer.selectLayer(0);
+        background.runCycle();
+        renderer.selectLayer(sandLayer);
+        sand.runCycle();
+        //Restart the background part way through, to check it leaves the sand alone
+        if (i == cycles / 2) {
+            background.restart();
+        }
+    }
+    seconds = secondsSince(start);
+
+    //Every grain must still be drawn on the sand layer after the background has started over
+    uint32_t pixels = (uint32_t)renderer.getGridWidth() * renderer.getGridHeight();
+    uint32_t drawn = 0;
+    for (uint32_t i=0; i<pixels; i++) {
+        drawn += renderer.isOccupied(i);
+    }
+    if (drawn != sand.getParticleCount()) {
+        throw std::runtime_error("Sand layer pixels do not match the particles.");
+    }
+    return pixels;
+}
+
+//Number of pixels set on the selected layer
+static uint32_t countOccupied(NullRenderer& renderer)
+{
+    uint32_t pixels = (uint32_t)renderer.getGridWidth() * renderer.getGridHeight();
+    uint32_t count = 0;
+    for (uint32_t i=0; i<pixels; i++) {
+        count += renderer.isOccupied(i);
+    }
+    return count;
+}
+
+/* Check every ball is drawn in full at its last position. Balls which touch or overlap must not
+ * clear parts of each other as they move, so drawing them all again must not fill in any pixels.
+ */
+static void checkBalls(NullRenderer& renderer, GravitySimulation& animation)
+{
+    uint32_t drawn = countOccupied(renderer);
+    for (uint16_t i=0; i<animation.getBallCount(); i++) {
+        const GravitySimulation::Ball& ball = animation.getBall(i);
+        if (ball.drawn) {
+            renderer.drawCircle(ball.drawnX, ball.drawnY, ball.r, ball.colour);
+        }
+    }
+    if (countOccupied(renderer) != drawn) {
+        throw std::runtime_error("Balls are not drawn in full at their last positions.");
+    }
+}
+
+static uint32_t runBalls(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    uint16_t minDim = renderer.getGridWidth() < renderer.getGridHeight() ? renderer.getGridWidth() : renderer.getGridHeight();
+    GravitySimulation animation(renderer, 2 + minDim / 32);
+    animation.setMode(1);
+
+    uint16_t numBalls = renderer.getGridWidth() * renderer.getGridHeight() / 100;
+    if (numBalls < 10) {
+        numBalls = 10;
+    }
+    for (uint16_t i=0; i<numBalls; i++) {
+        animation.addBall();
+    }
+
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        animation.runCycle();
+    }
+    seconds = secondsSince(start);
+
+    checkBalls(renderer, animation);
+    return numBalls;
+}
+
+/* Game of Life played back from a recording made of it first, so only copying the stored pixels
+ * to the display is timed. The recording is looped when there are more cycles than frames in it.
+ */
+static uint32_t runReplay(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    char path[] = "/tmp/benchmarkXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create recording file.");
+    }
+    close(fd);
+
+    {
+        FrameRecorder recorder(renderer.getGridWidth(), renderer.getGridHeight());
+        recorder.setFramePeriod(1000);
+        recorder.open(path);
+        renderer.setMirror(&recorder);
+        GameOfLife animation(renderer, 1, 0, 0);
+        for (uint32_t i=0; i<cycles; i++) {
+            animation.runCycle();
+        }
+        renderer.setMirror(NULL);
+    }
+
+    FramePlayer player(renderer);
+    player.open(path);
+    unlink(path);
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        if (!player.playFrame(false)) {
+            player.rewind();
+            player.playFrame(false);
+        }
+    }
+    seconds = secondsSince(start);
+    return renderer.getGridWidth() * renderer.getGridHeight();
+}
+
+static uint32_t runCrawler(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    Crawler animation(renderer, 50, 20, true);
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        animation.runCycle();
+    }
+    seconds = secondsSince(start);
+    return 1;
+}
+
+//Many crawlers moved and drawn together by a CrawlerSwarm
+static uint32_t runSwarm(NullRenderer& renderer, uint32_t cycles, double& seconds)
+{
+    const uint16_t numCrawlers = 32;
+    CrawlerSwarm animation(renderer, numCrawlers);
+    for (uint16_t i=0; i<numCrawlers; i++) {
+        animation.addCrawler(50, 20);
+    }
+
+    Clock::time_point start = Clock::now();
+    for (uint32_t i=0; i<cycles; i++) {
+        animation.runCycle();
+    }
+    seconds = secondsSince(start);
+    return numCrawlers;
+}
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s <options>\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-n <cycles>               : Number of cycles to run each animation for (default 500).\n"
+            "\t-a <animator>             : Only run this animator (gol, gol_packed, sand, layers, balls, replay, crawler, swarm).\n"
+            "\t-s <seed>                 : Random number seed (default 1).\n"
+            "\t-v                        : Show messages from the animations on stderr.\n"
+            );
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t cycles = 500;
+    unsigned int seed = 1;
+    const char* only = NULL;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:a:s:v")) != -1) {
+        switch (opt) {
+        case 'n':
+        cycles = atoi(optarg);
+        break;
+
+        case 'a':
+        only = optarg;
+        break;
+
+        case 's':
+        seed = atoi(optarg);
+        break;
+
+        case 'v':
+        verbose = true;
+        break;
+
+        default: /* '?' */
+        return usage(argv[0]);
+        }
+    }
+
+    const GridSize sizes[] = {
+        {16, 16, false},
+        {64, 32, false},
+        {192, 128, true},
+    };
+    const Benchmark benchmarks[] = {
+        {"gol", runGol},
+        {"gol_packed", runGolPacked},
+        {"sand", runSand},
+        {"layers", runLayers},
+        {"balls", runBalls},
+        {"replay", runReplay},
+        {"crawler", runCrawler},
+        {"swarm", runSwarm},
+    };
+
+    for (const Benchmark& benchmark : benchmarks) {
+        if ( (only != NULL) && (strcmp(only, benchmark.name) != 0) ) {
+            continue;
+        }
+        for (const GridSize& size : sizes) {
+            //Count heap from the start of each run
+            size_t heapStart = heapCurrent;
+            heapPeak = heapCurrent;
+
+            double seconds = 0;
+            NullRenderer* renderer = new NullRenderer(size.width, size.height, size.cube, verbose);
+            renderer->seedRandom(seed); //Same random numbers for every run
+            uint32_t items = benchmark.run(*renderer, cycles, seconds);
+            delete renderer;
+
+            printf("{\"animator\":\"%s\",\"grid\":\"%dx%d\",\"cube\":%s,\"cycles\":%lu,\"items\":%lu,"
+                   "\"fps\":%.1f,\"ns_per_item\":%.1f,\"peak_heap_bytes\":%lu}\n",
+                   benchmark.name, size.width, size.height, size.cube ? "true" : "false",
+                   (unsigned long)cycles, (unsigned long)items,
+                   cycles / seconds, seconds * 1e9 / ((double)cycles * items),
+                   (unsigned long)(heapPeak - heapStart));
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
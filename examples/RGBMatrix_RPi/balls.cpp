@@ -22,7 +22,6 @@
 
 #include <unistd.h>
 #include <signal.h>
-#include <chrono>
 
 #include "led-matrix.h"
 #include "threaded-canvas-manipulator.h"
@@ -30,6 +29,7 @@
 #include "graphics.h"
 
 #include "gravitySimulation.h" //This is the animation class used to generate output for the display
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
@@ -38,31 +38,29 @@ static void InterruptHandler(int signo) {
     interrupt_received = true;
 }
 
-// Get time stamp in microseconds.
-uint64_t micros()
-{
-    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::
-                  now().time_since_epoch()).count();
-    return us; 
-}
-
 // RGB Matrix class which pass itself as a renderer implementation into the GOL class
 // Passing as a reference into gol class, so need to dereference 'this' which is a pointer
 // using the syntax *this
 class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
     public:
-        Animation(Canvas *m, uint16_t width, uint16_t height, uint16_t delay_ms, uint16_t numBalls_, uint8_t maxRadius_, float force_)
+        Animation(Canvas *m, uint16_t width, uint16_t height, uint16_t delay_ms, uint16_t numBalls_, uint8_t maxRadius_, float force_, uint16_t repelRadius_, bool allPairs_)
             : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, delay_ms_(delay_ms), animation(*this,maxRadius_)
         {
             numBalls = numBalls_;
             animation.forcePower = force_;
+            animation.setRepelRadius(repelRadius_);
+            animation.setSpatialGrid(!allPairs_);
+#if defined(RGB_MATRIX_PROFILE)
+            //Report where frame time goes every 100 frames (build with 'make PROFILE=1')
+            setProfileDumpInterval(100);
+#endif
         }
 
         virtual ~Animation(){}
 
         void Run() {
             uint8_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
-            uint64_t prevTime  = 0;            // Used for frames-per-second throttle
+            FrameScheduler scheduler(*this, 1000000L / MAX_FPS); // Sleeps until each frame is due
 
             animation.setMode(1);
             
@@ -73,16 +71,13 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
 
             while (running() && !interrupt_received) {
                 animation.runCycle();
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent sand
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent sand
                 // calculations are non-deterministic (don't always take the same amount
                 // of time, depending on their current states), this helps ensure that
                 // things like gravity appear constant in the simulation.
-                uint32_t t;
-                while((t = micros() - prevTime) < (1000000L / MAX_FPS)){
-                    msSleep(1);
-                };
+                scheduler.waitForFrame();
+                uint32_t t = scheduler.getFrameMicros();
                 fprintf(stderr,"Max fps: %d; Cycle time: %d; Actual fps: %0.3f\n", MAX_FPS, t, (float)1000000L / t);
-                prevTime = micros();
             }
         }
 
@@ -98,10 +93,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         uint16_t delay_ms_;
         GravitySimulation animation;
@@ -123,7 +114,9 @@ static int usage(const char *progname) {
             "\t-t <seconds>              : Run for these number of seconds, then exit.\n"
             "\t-n <number>               : Number of balls.\n"
             "\t-f <float>                : Attractive force power (set negative for repelling force).\n"
-            "\t-s <number>               : Maximum radius of balls.\n");
+            "\t-s <number>               : Maximum radius of balls.\n"
+            "\t-x <number>               : Distance beyond which balls stop repelling (0=no limit).\n"
+            "\t-a                        : Test every pair of balls for collisions (no spatial grid).\n");
 
     rgb_matrix::PrintMatrixFlags(stderr);
 
@@ -139,6 +132,8 @@ int main(int argc, char *argv[]) {
     uint16_t numBalls = 2;
     uint8_t max_rad = 20;
     float force = 12;
+    uint16_t repel_rad = 0;
+    bool all_pairs = false;
 
     srand(time(NULL));
  
@@ -157,7 +152,7 @@ int main(int argc, char *argv[]) {
     }
 
     int opt;
-    while ((opt = getopt(argc, argv, "dD:t:r:n:s:f:P:c:p:b:m:LR:")) != -1) {
+    while ((opt = getopt(argc, argv, "dD:t:r:n:s:f:x:aP:c:p:b:m:LR:")) != -1) {
         switch (opt) {
         case 't':
         runtime_seconds = atoi(optarg);
@@ -179,6 +174,14 @@ int main(int argc, char *argv[]) {
         force = atoi(optarg);
         break;
 
+        case 'x':
+        repel_rad = atoi(optarg);
+        break;
+
+        case 'a':
+        all_pairs = true;
+        break;
+
         // These used to be options we understood, but deprecated now. Accept
         // but don't mention in usage()
         case 'R':
@@ -237,7 +240,7 @@ int main(int argc, char *argv[]) {
     // The ThreadedCanvasManipulator objects are filling
     // the matrix continuously.
     ThreadedCanvasManipulator *image_gen = NULL;
-    image_gen = new Animation(canvas, canvas->width(), canvas->height(), scroll_ms, numBalls, max_rad, force);
+    image_gen = new Animation(canvas, canvas->width(), canvas->height(), scroll_ms, numBalls, max_rad, force, repel_rad, all_pairs);
 
     // Set up an interrupt handler to be able to stop animations while they go
     // on. Note, each demo tests for while (running() && !interrupt_received) {},
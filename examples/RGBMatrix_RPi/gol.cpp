@@ -29,6 +29,7 @@
 #include "graphics.h"
 
 #include "golife.h" //This is the animation class used to generate output for the display
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
@@ -42,21 +43,45 @@ static void InterruptHandler(int signo) {
 // using the syntax *this
 class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
     public:
-        Animation(Canvas *m, uint16_t width, uint16_t height, uint16_t delay_ms, uint8_t fade_steps, uint8_t start_pattern_, uint8_t patternSpacingX_, uint8_t patternSpacingY_)
-            : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, delay_ms_(delay_ms), animation(*this,fade_steps,delay_ms,start_pattern_,patternSpacingX_,patternSpacingY_)
-        {}
+        Animation(RGBMatrix *m, uint16_t width, uint16_t height, uint16_t delay_ms, uint8_t fade_steps, uint8_t start_pattern_, uint8_t patternSpacingX_, uint8_t patternSpacingY_, uint8_t threads)
+            : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, delay_ms_(delay_ms), animation(*this,fade_steps,delay_ms,start_pattern_,patternSpacingX_,patternSpacingY_),
+              scheduler(*this, (delay_ms > 0) ? delay_ms * 1000 : 1000), matrix(m)
+        {
+            //Draw each frame into a spare canvas, which is swapped onto the display on the next
+            //refresh. Frames are sent from their own thread while the next one is worked out.
+            offscreen = matrix->CreateFrameCanvas();
+            setDoubleBuffered(true);
+            //Canvas keeps pixels between updates, so only changed cells need sending
+            setIncrementalUpdate(true);
+            //Work out the rules 64 cells at a time, which is much faster on larger displays
+            animation.setBitPackedEngine(true);
+            animation.setThreadCount(threads);
+            //Sleep until each cycle is due, so time working out the rules does not add on to the delay
+            if (delay_ms > 0) {
+                animation.setFrameScheduler(&scheduler);
+            }
+#if defined(RGB_MATRIX_PROFILE)
+            //Report where frame time goes every 100 frames (build with 'make PROFILE=1')
+            setProfileDumpInterval(100);
+#endif
+        }
 
-        virtual ~Animation(){}
+        virtual ~Animation(){
+            //Stop drawing frames, then stop sending them while the canvas is still around
+            Stop();
+            WaitStopped();
+            setDoubleBuffered(false);
+        }
 
         void Run() {
             while (running() && !interrupt_received) {
                 animation.runCycle();
-                usleep(delay_ms_ * 1000); // ms
             }
         }
 
         void showPixels() {
-            //Nothing to do for RGB matrix type displays as pixel changes are shown immediately
+            //Show the frame just copied into the spare canvas, and take the old one back to draw on
+            offscreen = matrix->SwapOnVSync(offscreen);
         }
 
         void outputMessage(char msg[]) {
@@ -67,18 +92,26 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         uint16_t delay_ms_;
         GameOfLife animation;
+        FrameScheduler scheduler;
+
+        RGBMatrix *matrix;
+        FrameCanvas *offscreen;
 
         void setPixel(uint16_t x, uint16_t y, RGB_colour colour) 
         {
             canvas()->SetPixel(x, gridHeight - y - 1, colour.r, colour.g, colour.b);
         }
+
+        void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Frames are copied into the spare canvas, which is not shown until it is swapped
+            for (uint16_t i=0; i<count; i++) {
+                offscreen->SetPixel(x + i, gridHeight - y - 1, colours[i].r, colours[i].g, colours[i].b);
+            }
+        }
 };
 
 
@@ -93,6 +126,7 @@ static int usage(const char *progname) {
             "\t-s <start-pattern>        : Preset starting pattern (0=random).\n"
             "\t-h <number>               : Number of copies of pattern vertically (1..n).\n"
             "\t-w <number>               : Number of copies of pattern across width (1..n).\n"
+            "\t-T <threads>              : Number of threads to run the simulation on (default 3).\n"
             );
 
     rgb_matrix::PrintMatrixFlags(stderr);
@@ -110,6 +144,7 @@ int main(int argc, char *argv[]) {
     uint8_t start_pattern = 0;
     uint8_t patX = 1;
     uint8_t patY = 1;
+    uint8_t threads = 3;
 
     srand(time(NULL));
  
@@ -128,7 +163,7 @@ int main(int argc, char *argv[]) {
     }
 
     int opt;
-    while ((opt = getopt(argc, argv, "dD:t:r:f:s:w:h:P:c:p:b:m:LR:")) != -1) {
+    while ((opt = getopt(argc, argv, "dD:t:r:f:s:w:h:T:P:c:p:b:m:LR:")) != -1) {
         switch (opt) {
         case 't':
         runtime_seconds = atoi(optarg);
@@ -154,6 +189,10 @@ int main(int argc, char *argv[]) {
         patY = atoi(optarg);
         break;
 
+        case 'T':
+        threads = atoi(optarg);
+        break;
+
         // These used to be options we understood, but deprecated now. Accept
         // but don't mention in usage()
         case 'R':
@@ -212,7 +251,7 @@ int main(int argc, char *argv[]) {
     // The ThreadedCanvasManipulator objects are filling
     // the matrix continuously.
     ThreadedCanvasManipulator *image_gen = NULL;
-    image_gen = new Animation(canvas, canvas->width(), canvas->height(), scroll_ms, fade_steps, start_pattern, patX, patY);
+    image_gen = new Animation(matrix, canvas->width(), canvas->height(), scroll_ms, fade_steps, start_pattern, patX, patY, threads);
 
     // Set up an interrupt handler to be able to stop animations while they go
     // on. Note, each demo tests for while (running() && !interrupt_received) {},
@@ -0,0 +1,231 @@
+/**************************************************************************************************
+ * This is an example to play back animations recorded by a FrameRecorder on a display using the
+ * RGB matrix library from https://github.com/hzeller/rpi-rgb-led-matrix
+ *
+ * Recordings can be made on any machine (see the -w option of the UDPStream example). Playing
+ * them back only copies the stored pixels to the display, so looping a recorded animation uses
+ * far less CPU time than running it.
+ *
+ * Based on the public domain demo example file by Henner Zeller, and extended by
+ * Paul Fretwell - aka 'Footleg' to use the animation classes written by Footleg with the RGBMatrix
+ * library.
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <signal.h>
+
+#include "led-matrix.h"
+#include "threaded-canvas-manipulator.h"
+#include "pixel-mapper.h"
+#include "graphics.h"
+
+#include "frameRecorder.h" //This is the player which shows the recording on the display
+
+using namespace rgb_matrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+    interrupt_received = true;
+}
+
+// RGB Matrix class which pass itself as a renderer implementation into the player
+// Passing as a reference into player class, so need to dereference 'this' which is a pointer
+// using the syntax *this
+class PlaybackDisplay : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
+    public:
+        PlaybackDisplay(RGBMatrix *m, uint16_t width, uint16_t height, const char* path_, bool loop_, int16_t offsetX, int16_t offsetY)
+            : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, player(*this,offsetX,offsetY),
+              path(path_), loop(loop_), matrix(m)
+        {
+            //Draw each frame into a spare canvas, which is swapped onto the display on the next
+            //refresh, so part drawn frames are never shown
+            offscreen = matrix->CreateFrameCanvas();
+            setDoubleBuffered(true);
+        }
+
+        virtual ~PlaybackDisplay(){
+            //Stop playing frames, then stop sending them while the canvas is still around
+            Stop();
+            WaitStopped();
+            setDoubleBuffered(false);
+        }
+
+        void Run() {
+            player.open(path);
+            fprintf(stderr, "Playing %u frames\n", player.getFrameCount());
+            while (running() && !interrupt_received) {
+                if (!player.playFrame()) {
+                    if (!loop) {
+                        break;
+                    }
+                    player.rewind();
+                }
+            }
+        }
+
+        void showPixels() {
+            //Show the frame just copied into the spare canvas, and take the old one back to draw on
+            offscreen = matrix->SwapOnVSync(offscreen);
+        }
+
+        void outputMessage(char msg[]) {
+            fprintf(stderr,msg);
+        }
+
+        void msSleep(int delay_ms) {
+            usleep(delay_ms * 1000);
+        }
+
+    private:
+        FramePlayer player;
+        const char* path;
+        bool loop;
+
+        RGBMatrix *matrix;
+        FrameCanvas *offscreen;
+
+        void setPixel(uint16_t x, uint16_t y, RGB_colour colour)
+        {
+            canvas()->SetPixel(x, gridHeight - y - 1, colour.r, colour.g, colour.b);
+        }
+
+        void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Frames are copied into the spare canvas, which is not shown until it is swapped
+            for (uint16_t i=0; i<count; i++) {
+                offscreen->SetPixel(x + i, gridHeight - y - 1, colours[i].r, colours[i].g, colours[i].b);
+            }
+        }
+};
+
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s <options> <recording file>\n",
+            progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-t <seconds>   : Run for these number of seconds, then exit.\n"
+            "\t-l             : Loop the recording until stopped.\n"
+            "\t-x <pixels>    : Position across the recorded grid shown at the left of this display.\n"
+            "\t-y <pixels>    : Position up the recorded grid shown at the bottom of this display.\n");
+
+    rgb_matrix::PrintMatrixFlags(stderr);
+
+    fprintf(stderr, "Example:\n\t%s -l gol.rec\n"
+            "Plays the recording gol.rec over and over\n", progname);
+    return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    int runtime_seconds = -1;
+    bool loop = false;
+    int offsetX = 0;
+    int offsetY = 0;
+
+    RGBMatrix::Options matrix_options;
+    rgb_matrix::RuntimeOptions runtime_opt;
+
+    // These are the defaults when no command-line flags are given.
+    matrix_options.rows = 32;
+    matrix_options.chain_length = 1;
+    matrix_options.parallel = 1;
+
+    // First things first: extract the command line flags that contain
+    // relevant matrix options.
+    if (!ParseOptionsFromFlags(&argc, &argv, &matrix_options, &runtime_opt)) {
+        return usage(argv[0]);
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "dt:lx:y:b:")) != -1) {
+        switch (opt) {
+        case 't':
+        runtime_seconds = atoi(optarg);
+        break;
+
+        case 'l':
+        loop = true;
+        break;
+
+        case 'x':
+        offsetX = atoi(optarg);
+        break;
+
+        case 'y':
+        offsetY = atoi(optarg);
+        break;
+
+        case 'd':
+        runtime_opt.daemon = 1;
+        break;
+
+        case 'b':
+        matrix_options.brightness = atoi(optarg);
+        break;
+
+        default: /* '?' */
+        return usage(argv[0]);
+        }
+    }
+    if (optind >= argc) {
+        return usage(argv[0]);
+    }
+    const char* path = argv[optind];
+
+    RGBMatrix *matrix = CreateMatrixFromOptions(matrix_options, runtime_opt);
+    if (matrix == NULL)
+        return 1;
+
+    printf("Size: %dx%d. Hardware gpio mapping: %s\n",
+            matrix->width(), matrix->height(), matrix_options.hardware_mapping);
+
+    Canvas *canvas = matrix;
+
+    // The ThreadedCanvasManipulator objects are filling
+    // the matrix continuously.
+    PlaybackDisplay *image_gen = new PlaybackDisplay(matrix, canvas->width(), canvas->height(), path, loop, offsetX, offsetY);
+
+    // Set up an interrupt handler to be able to stop animations while they go
+    // on. Note, each demo tests for while (running() && !interrupt_received) {},
+    // so they exit as soon as they get a signal.
+    signal(SIGTERM, InterruptHandler);
+    signal(SIGINT, InterruptHandler);
+
+    // Image generating demo is crated. Now start the thread.
+    image_gen->Start();
+
+    // Now, the image generation runs in the background. We can do arbitrary
+    // things here in parallel. In this demo, we're essentially just
+    // waiting for one of the conditions to exit.
+    if (runtime_seconds > 0) {
+        sleep(runtime_seconds);
+    } else {
+        // The
+        printf("Press <CTRL-C> to exit and reset LEDs\n");
+        while (!interrupt_received) {
+        sleep(1); // Time doesn't really matter. The syscall will be interrupted.
+        }
+    }
+
+    // Stop image generating thread. The delete triggers
+    delete image_gen;
+    delete canvas;
+
+    printf("\%s. Exiting.\n",
+            interrupt_received ? "Received CTRL-C" : "Timeout reached");
+    return 0;
+}
@@ -21,7 +21,6 @@
  */
 
 #include <unistd.h>
-#include <chrono>
 #include <signal.h>
 
 #include "led-matrix.h"
@@ -30,11 +29,10 @@
 #include "graphics.h"
 
 #include "gravityparticles.h" //This is the animation class used to generate output for the display
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
-uint64_t prevTime  = 0;      // Used for frames-per-second throttle
-
 uint8_t backbuffer = 0;      // Index for double-buffered animation
 
 volatile bool interrupt_received = false;
@@ -42,14 +40,6 @@ static void InterruptHandler(int signo) {
     interrupt_received = true;
 }
 
-// Get time stamp in microseconds.
-uint64_t micros()
-{
-    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::
-                  now().time_since_epoch()).count();
-    return us; 
-}
-
 // RGB Matrix class which pass itself as a renderer implementation into the GOL class
 // Passing as a reference into gol class, so need to dereference 'this' which is a pointer
 // using the syntax *this
@@ -70,13 +60,21 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             else {
                 removeNum = numParticles_-1;
             }
+            removeList = new uint16_t[removeNum];
+
+            //Make room for all the rain drops up front
+            animation.reserve(numParticles);
             
         }
         
-        virtual ~Animation(){}
+        virtual ~Animation()
+        {
+            delete [] removeList;
+        }
 
         void Run() {
             uint8_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
+            FrameScheduler scheduler(*this, 100000L / MAX_FPS); // Sleeps until each frame is due
 
             //Set fixed acceleration
             animation.setAcceleration(0, -accel);
@@ -92,7 +90,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             //Set initial column configurations
             for (uint16_t x=0; x<totalCols; ++x) {
                 cols[x] = gridWidth; //Initialise to off grid
-                vels[x] = random_int16(velocity/4,velocity);
+                vels[x] = randomRange(velocity/4,velocity);
                 lengths[x] = 0;
             }
 
@@ -106,7 +104,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Green to yellow
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     red = uint16_t(brightness * i / 255);
                     green = brightness;
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -115,7 +113,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Yellow to red
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     red = brightness;
                     green = uint16_t(brightness * (255-i) / 255);
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -124,7 +122,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Red to magenta
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     red = brightness;
                     blue = uint16_t(brightness * i / 255);
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -133,7 +131,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Magenta to blue
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     red = uint16_t(brightness * (255-i) / 255);
                     blue = brightness;
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -142,7 +140,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Blue to cyan
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     green = uint16_t(brightness * i / 255);
                     blue = brightness;
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -151,7 +149,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             for (uint16_t i = 0; i <= 255; i++){
                 //Cyan to green
                 for (uint8_t j = 0; j < shadeSize; j++){
-                    brightness = random_int16(50,255);
+                    brightness = randomRange(50,255);
                     green = brightness;
                     blue = uint16_t(brightness * (255-i) / 255);
                     colID = getColourId(RGB_colour(red,green,blue));
@@ -175,7 +173,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                             uint16_t newPos = 0;
                             while (colClear == false){
                                 colClear = true;
-                                newPos = random_int16(0,gridWidth);
+                                newPos = randomRange(0,gridWidth);
                                 for (uint16_t x=0; x<totalCols; ++x) {
                                     if (newPos == cols[x]){
                                         colClear = false;
@@ -183,8 +181,8 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                                 }
                             }
                             cols[i] = newPos;
-                            lengths[i] = random_int16(8,24);
-                            vels[i] = random_int16(velocity/4,velocity);
+                            lengths[i] = randomRange(8,24);
+                            vels[i] = randomRange(velocity/4,velocity);
                         }
                         //Check position is clear on top row
                         uint8_t tries = 0;
@@ -222,30 +220,29 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                 //Remove oldest particles if > max allowed
                 
                 if (animation.getParticleCount() > removeNum) {
-                    //Remove any of the oldest particles which have reached the bottom
+                    //Remove any of the oldest particles which have reached the bottom (in one batch)
+                    uint16_t removeCount = 0;
                     for (uint16_t i = 0; i<removeNum; i++) {
-                        GravityParticles::Particle test = animation.getParticle(removeNum-1-i);
+                        GravityParticles::Particle test = animation.getParticle(i);
                         // char msg[50];
                         // sprintf(msg, "Testing particle at %d,%d.\n",test.x,test.y);
                         // outputMessage(msg);
 
                         if ( test.y == 0) {
-                            animation.deleteParticle(removeNum-1-i);
+                            removeList[removeCount++] = i;
                         }
                     }
+                    animation.deleteParticles(removeList, removeCount);
                 }
                 
                 animation.runCycle();
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent sand
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent sand
                 // calculations are non-deterministic (don't always take the same amount
                 // of time, depending on their current states), this helps ensure that
                 // things like gravity appear constant in the simulation.
-                uint32_t t;
-                
-
-                while((t = micros() - prevTime) < (100000L / MAX_FPS));
+                scheduler.waitForFrame();
+                uint32_t t = scheduler.getFrameMicros();
                 //fprintf(stderr,"Cycle time: %d\n", t );
-                prevTime = micros();
 
                 //Reset cycles before acceleration is changed based on speed of update
                 cycles = 8000000 / t;
@@ -265,10 +262,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         int delay_ms_;
         GravityParticles animation;
@@ -277,6 +270,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
         uint16_t numParticles;
         uint32_t counter, cycles;
         uint8_t removeNum;
+        uint16_t* removeList; // Indices of particles to delete each frame
 
         void setPixel(uint16_t x, uint16_t y, RGB_colour colour) 
         {
@@ -21,7 +21,6 @@
  */
 
 #include <unistd.h>
-#include <chrono>
 #include <signal.h>
 
 #include "led-matrix.h"
@@ -30,11 +29,10 @@
 #include "graphics.h"
 
 #include "gravityparticles.h" //This is the animation class used to generate output for the display
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
-uint64_t prevTime  = 0;      // Used for frames-per-second throttle
-
 uint8_t backbuffer = 0;      // Index for double-buffered animation
 
 volatile bool interrupt_received = false;
@@ -42,34 +40,42 @@ static void InterruptHandler(int signo) {
     interrupt_received = true;
 }
 
-// Get time stamp in microseconds.
-uint64_t micros()
-{
-    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::
-                  now().time_since_epoch()).count();
-    return us; 
-}
-
 // RGB Matrix class which pass itself as a renderer implementation into the GOL class
 // Passing as a reference into gol class, so need to dereference 'this' which is a pointer
 // using the syntax *this
 class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
     public:
-        Animation(Canvas *m, uint16_t width, uint16_t height, uint16_t delay_ms, int16_t accel_, uint16_t shake_, uint16_t numGrains_, uint8_t bounce_)
+        Animation(RGBMatrix *m, uint16_t width, uint16_t height, uint16_t delay_ms, int16_t accel_, uint16_t shake_, uint16_t numGrains_, uint8_t bounce_)
             : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, delay_ms_(delay_ms), animation(*this,shake_,bounce_), 
-              ax(0), ay(0)
+              ax(0), ay(0), matrix(m)
         {
+            //Draw each frame into a spare canvas, which is swapped onto the display on the next
+            //refresh. Frames are sent from their own thread while the next one is worked out.
+            offscreen = matrix->CreateFrameCanvas();
+            setDoubleBuffered(true);
             accel = accel_;
             counter = 0;
             angle = -1;
             cycles = 100000;
+#if defined(RGB_MATRIX_PROFILE)
+            //Report where frame time goes every 100 frames (build with 'make PROFILE=1')
+            setProfileDumpInterval(100);
+#endif
             numGrains = numGrains_;
         }
         
-        virtual ~Animation(){}
+        virtual ~Animation(){
+            //Stop drawing frames, then stop sending them while the canvas is still around
+            Stop();
+            WaitStopped();
+            setDoubleBuffered(false);
+        }
 
         void Run() {
             uint8_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
+            uint32_t stepPeriod = 100000L / MAX_FPS;  // Simulated time per step of the sand, in microseconds
+            FrameScheduler scheduler(*this, stepPeriod, stepPeriod); // Sleeps until each frame is due
+            uint16_t steps = 1;
 
             RGB_colour red = {255,0,0};
             RGB_colour yellow = {255,255,0};
@@ -119,9 +125,13 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             updateDisplay();
             msSleep(1000);
 
+            //Change acceleration about every 3 seconds of simulated time (twice as long for weak gravity)
+            cycles = 3000000 / stepPeriod;
+            if (accel < 5) cycles = 2*cycles;
+
             while (running() && !interrupt_received) {
                 //Update acceleration every few cycles
-                counter++;
+                counter += steps;
                 if (counter > cycles) {
                     counter = 0;
                     angle++;
@@ -170,26 +180,19 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
 
 
                 
-                animation.runCycle();
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent sand
+                animation.runCycle(steps);
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent sand
                 // calculations are non-deterministic (don't always take the same amount
-                // of time, depending on their current states), this helps ensure that
-                // things like gravity appear constant in the simulation.
-                uint32_t t;
-                
-
-                while((t = micros() - prevTime) < (100000L / MAX_FPS));
-                //fprintf(stderr,"Cycle time: %d\n", t );
-                prevTime = micros();
-
-                //Reset cycles before acceleration is changed based on speed of update
-                cycles = 3000000 / t;
-                if (accel < 5) cycles = 2*cycles;
+                // of time, depending on their current states), the scheduler runs extra steps
+                // of the simulation after slow frames so things like gravity appear constant.
+                steps = scheduler.waitForFrame();
+                //fprintf(stderr,"Cycle time: %d\n", scheduler.getFrameMicros() );
             }
         }
 
         void showPixels() {
-            //Nothing to do for RGB matrix type displays as pixel changes are shown immediately
+            //Show the frame just copied into the spare canvas, and take the old one back to draw on
+            offscreen = matrix->SwapOnVSync(offscreen);
         }
 
         void outputMessage(char msg[]) {
@@ -200,10 +203,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         int delay_ms_;
         GravityParticles animation;
@@ -211,10 +210,21 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
         uint16_t numGrains;
         uint32_t counter, cycles;
 
+        RGBMatrix *matrix;
+        FrameCanvas *offscreen;
+
         void setPixel(uint16_t x, uint16_t y, RGB_colour colour) 
         {
             canvas()->SetPixel(x, gridHeight - y - 1, colour.r, colour.g, colour.b);
         }
+
+        void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Frames are copied into the spare canvas, which is not shown until it is swapped
+            for (uint16_t i=0; i<count; i++) {
+                offscreen->SetPixel(x + i, gridHeight - y - 1, colours[i].r, colours[i].g, colours[i].b);
+            }
+        }
 };
 
 
@@ -346,7 +356,7 @@ int main(int argc, char *argv[]) {
     // The ThreadedCanvasManipulator objects are filling
     // the matrix continuously.
     ThreadedCanvasManipulator *image_gen = NULL;
-    image_gen = new Animation(canvas, canvas->width(), canvas->height(), scroll_ms, accel, shake, numGrains, bounce);
+    image_gen = new Animation(matrix, canvas->width(), canvas->height(), scroll_ms, accel, shake, numGrains, bounce);
 
     // Set up an interrupt handler to be able to stop animations while they go
     // on. Note, each demo tests for while (running() && !interrupt_received) {},
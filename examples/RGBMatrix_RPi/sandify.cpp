@@ -32,6 +32,7 @@
 #include "gravityparticles.h"
 #include "golife.h"
 #include "crawler.h"
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
@@ -70,7 +71,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
         void Run() {
             uint16_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
             counter = 0;
-            uint64_t prevTime = micros();
+            FrameScheduler scheduler(*this, 100000L / MAX_FPS); // Sleeps until each frame is due
             uint64_t prevTime2 = micros();
 
             while (running() && !interrupt_received) {
@@ -78,11 +79,11 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                 switch (mode) {
                     case 0:
                         animGol.runCycle();
-                        usleep(delay_ms_ * 1000); // ms
+                        scheduler.pause(delay_ms_); // ms
                         break;
                     case 2:
                         animCrawl.runCycle();
-                        usleep(delay_ms_ * 1000); // ms
+                        scheduler.pause(delay_ms_); // ms
                         break;
                     default:
                         animSand.runCycle();
@@ -91,7 +92,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                             prevTime2 = micros();
                             fprintf(stderr,"Change acceleration %d\n", accel);
                             if(accel != 0.0) {
-                                animSand.setAcceleration( random_int16(-accel,accel), random_int16(-accel,accel) );  
+                                animSand.setAcceleration( randomRange(-accel,accel), randomRange(-accel,accel) );  
                             }
                             else {
                                 fprintf(stderr,"Change acceleration zero,zero\n");
@@ -122,14 +123,13 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                     
                 }
 
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent particle
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent particle
                 // calculations are non-deterministic (don't always take the same amount
                 // of time, depending on their current states), this helps ensure that
                 // things like gravity appear constant in the simulation.
-                uint64_t t;
-                while((t = micros() - prevTime) < (100000L / MAX_FPS));
-                //fprintf(stderr,"Cycle time: %llu\n", t );
-                prevTime = micros();
+                scheduler.waitForFrame();
+                uint32_t t = scheduler.getFrameMicros();
+                //fprintf(stderr,"Cycle time: %u\n", t );
 
                 //Reset cycles before mode is changed based on speed of update
                 cycles = 100000 * getGridWidth() / t;
@@ -149,10 +149,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         int delay_ms_;
         GravityParticles animSand;
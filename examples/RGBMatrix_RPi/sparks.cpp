@@ -21,7 +21,6 @@
  */
 
 #include <unistd.h>
-#include <chrono>
 #include <signal.h>
 
 #include "led-matrix.h"
@@ -30,11 +29,10 @@
 #include "graphics.h"
 
 #include "gravityparticles.h" //This is the animation class used to generate output for the display
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
-uint64_t prevTime  = 0;      // Used for frames-per-second throttle
-
 uint8_t backbuffer = 0;      // Index for double-buffered animation
 
 volatile bool interrupt_received = false;
@@ -42,14 +40,6 @@ static void InterruptHandler(int signo) {
     interrupt_received = true;
 }
 
-// Get time stamp in microseconds.
-uint64_t micros()
-{
-    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::
-                  now().time_since_epoch()).count();
-    return us; 
-}
-
 // RGB Matrix class which passes itself as a renderer implementation into the Gravity Particles class
 // Passing as a reference into the animation class, so need to dereference 'this' which is a pointer
 // using the syntax *this
@@ -69,6 +59,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
 
         void Run() {
             uint8_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
+            FrameScheduler scheduler(*this, 100000L / MAX_FPS); // Sleeps until each frame is due
 
             RGB_colour yellow = {255,200,120};
 
@@ -77,8 +68,8 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             int16_t maxVel = 10000;
             for (int i=0; i<randParticles; i++) {
                 //animation.addParticle( getRandomColour() );
-                int16_t vx = random_int16(-maxVel,maxVel+1);
-                int16_t vy = random_int16(-maxVel,maxVel+1);
+                int16_t vx = randomRange(-maxVel,maxVel+1);
+                int16_t vy = randomRange(-maxVel,maxVel+1);
                 if (vx > 0) {
                     vx += maxVel/5;  
                 }
@@ -111,16 +102,11 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                 // }
                 
                 animation.runCycle();
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent sand
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent sand
                 // calculations are non-deterministic (don't always take the same amount
                 // of time, depending on their current states), this helps ensure that
                 // things like gravity appear constant in the simulation.
-                uint32_t t;
-                
-
-                while((t = micros() - prevTime) < (100000L / MAX_FPS));
-                //fprintf(stderr,"Cycle time: %d\n", t );
-                prevTime = micros();
+                scheduler.waitForFrame();
 
             }
         }
@@ -137,10 +123,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         int delay_ms_;
         GravityParticles animation;
@@ -34,6 +34,7 @@
 #include "graphics.h"
 
 #include "gravityparticles.h"
+#include "frameScheduler.h"
 
 using namespace rgb_matrix;
 
@@ -84,6 +85,11 @@ class ReadableCanvas : public Canvas {
             data[y*cwidth+x] = col;
         }
 
+        const RGB_colour* GetPixels()
+        {
+            return data;
+        }
+
         RGB_colour GetPixel(int x, int y)
         {
             RGB_colour colour = data[y*cwidth+x];
@@ -155,7 +161,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
         void Run() {
             uint16_t MAX_FPS=1000/delay_ms_;    // Maximum redraw rate, frames/second
             counter = 0;
-            uint64_t prevTime = micros();
+            FrameScheduler scheduler(*this, 100000L / MAX_FPS); // Sleeps until each frame is due
             uint64_t prevTime2 = micros();
 
             //Draw text on canvas
@@ -168,18 +174,9 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                         color, NULL,
                         textline.c_str(), 0);
 
-            //Now map canvas pixels to renderer
+            //Now turn canvas pixels into grains (canvas rows run from the top, so flip them)
             cvs->DebugContents();
-            for (uint16_t y=0; y<gridHeight; y++) {
-                for (uint16_t x=0; x<gridWidth; x++) {
-                    RGB_colour pixel = cvs->GetPixel(x,y);
-                    if (pixel.r > 0) {
-                        fprintf(stderr,"Pixel %d,%d: RGB(%d,%d,%d)\n", x,y,pixel.r,pixel.g,pixel.b);
-                    }
-                    
-                    setPixelColour(x,gridHeight-y-1,pixel);
-                }
-            }
+            animSand.imgToParticles(cvs->GetPixels(), true);
             updateDisplay();
 
             while (running() && !interrupt_received) {
@@ -187,7 +184,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                 switch (mode) {
                     case 0:
                         //animGol.runCycle();
-                        usleep(delay_ms_ * 1000); // ms
+                        scheduler.pause(delay_ms_); // ms
                         break;
 
                     default:
@@ -197,7 +194,7 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                             prevTime2 = micros();
                             fprintf(stderr,"Change acceleration %d\n", accel);
                             if(accel != 0.0) {
-                                animSand.setAcceleration( random_int16(-accel,accel), random_int16(-accel,accel) );  
+                                animSand.setAcceleration( randomRange(-accel,accel), randomRange(-accel,accel) );  
                             }
                             else {
                                 fprintf(stderr,"Change acceleration zero,zero\n");
@@ -219,20 +216,19 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
                             //animGol.restart();
                             break;
                         case 1:
-                            //Turn cells into grains
-                            animSand.imgToParticles();
+                            //Text was turned into grains when it was drawn
+                            break;
                     }
                     
                 }
 
-                // Limit the animation frame rate to MAX_FPS.  Because the subsequent particle
+                // Sleep until the next frame is due, limiting the animation frame rate to MAX_FPS.  Because the subsequent particle
                 // calculations are non-deterministic (don't always take the same amount
                 // of time, depending on their current states), this helps ensure that
                 // things like gravity appear constant in the simulation.
-                uint64_t t;
-                while((t = micros() - prevTime) < (100000L / MAX_FPS));
-                //fprintf(stderr,"Cycle time: %llu\n", t );
-                prevTime = micros();
+                scheduler.waitForFrame();
+                uint32_t t = scheduler.getFrameMicros();
+                //fprintf(stderr,"Cycle time: %u\n", t );
 
                 //Reset cycles before mode is changed based on speed of update
                 cycles = 6000 * getGridWidth() / t;
@@ -252,10 +248,6 @@ class Animation : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
             usleep(delay_ms * 1000);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return a + rand()%(b-a);
-        }
-
     private:
         int delay_ms_;
         GravityParticles animSand;
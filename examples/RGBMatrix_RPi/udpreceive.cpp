@@ -0,0 +1,236 @@
+/**************************************************************************************************
+ * This is an example to show frames streamed over the network on a display using the RGB matrix
+ * library from https://github.com/hzeller/rpi-rgb-led-matrix
+ *
+ * Frames are sent by an animation running on a UDPStreamRenderer on another machine (see the
+ * UDPStream examples). Several panels can show parts of one larger stream sent to a broadcast or
+ * multicast address, each set to its own position in the stream grid.
+ *
+ * Based on the public domain demo example file by Henner Zeller, and extended by
+ * Paul Fretwell - aka 'Footleg' to use the animation classes written by Footleg with the RGBMatrix
+ * library.
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <signal.h>
+
+#include "led-matrix.h"
+#include "threaded-canvas-manipulator.h"
+#include "pixel-mapper.h"
+#include "graphics.h"
+
+#include "udpStream.h" //This is the receiver which applies the stream to the display
+
+using namespace rgb_matrix;
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+    interrupt_received = true;
+}
+
+// RGB Matrix class which pass itself as a renderer implementation into the stream receiver
+// Passing as a reference into receiver class, so need to dereference 'this' which is a pointer
+// using the syntax *this
+class StreamDisplay : public ThreadedCanvasManipulator, public RGBMatrixRenderer {
+    public:
+        StreamDisplay(RGBMatrix *m, uint16_t width, uint16_t height, uint16_t port_, const char* group_, int16_t offsetX, int16_t offsetY)
+            : ThreadedCanvasManipulator(m), RGBMatrixRenderer{width,height}, receiver(*this,offsetX,offsetY),
+              port(port_), group(group_), matrix(m)
+        {
+            //Draw each frame into a spare canvas, which is swapped onto the display on the next
+            //refresh, so part received frames are never shown
+            offscreen = matrix->CreateFrameCanvas();
+            setDoubleBuffered(true);
+        }
+
+        virtual ~StreamDisplay(){
+            //Stop receiving frames, then stop sending them while the canvas is still around
+            Stop();
+            WaitStopped();
+            setDoubleBuffered(false);
+        }
+
+        void Run() {
+            receiver.openStream(port, group);
+            bool wasSynced = false;
+            while (running() && !interrupt_received) {
+                //Wake up now and again to check for the program being stopped
+                receiver.receive(100);
+                if (receiver.isSynced() != wasSynced) {
+                    wasSynced = receiver.isSynced();
+                    fprintf(stderr, wasSynced ? "Showing stream (%u packets lost so far)\n" : "Lost packets, waiting for next keyframe (%u lost so far)\n",
+                        receiver.getLostPackets());
+                }
+            }
+        }
+
+        void showPixels() {
+            //Show the frame just copied into the spare canvas, and take the old one back to draw on
+            offscreen = matrix->SwapOnVSync(offscreen);
+        }
+
+        void outputMessage(char msg[]) {
+            fprintf(stderr,msg);
+        }
+
+        void msSleep(int delay_ms) {
+            usleep(delay_ms * 1000);
+        }
+
+    private:
+        UDPStreamReceiver receiver;
+        uint16_t port;
+        const char* group;
+
+        RGBMatrix *matrix;
+        FrameCanvas *offscreen;
+
+        void setPixel(uint16_t x, uint16_t y, RGB_colour colour)
+        {
+            canvas()->SetPixel(x, gridHeight - y - 1, colour.r, colour.g, colour.b);
+        }
+
+        void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Frames are copied into the spare canvas, which is not shown until it is swapped
+            for (uint16_t i=0; i<count; i++) {
+                offscreen->SetPixel(x + i, gridHeight - y - 1, colours[i].r, colours[i].g, colours[i].b);
+            }
+        }
+};
+
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s <options> [optional parameter]\n",
+            progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-t <seconds>   : Run for these number of seconds, then exit.\n"
+            "\t-u <port>      : Port to listen for the stream on (default %d).\n"
+            "\t-g <group>     : Multicast group address to join, when the stream is sent to one.\n"
+            "\t-x <pixels>    : Position across the stream grid shown at the left of this display.\n"
+            "\t-y <pixels>    : Position up the stream grid shown at the bottom of this display.\n",
+            UDP_STREAM_DEFAULT_PORT);
+
+    rgb_matrix::PrintMatrixFlags(stderr);
+
+    fprintf(stderr, "Example:\n\t%s -g 239.0.0.50 -x 64\n"
+            "Shows the part of a multicast stream 64 pixels in from the left\n", progname);
+    return 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    int runtime_seconds = -1;
+    int port = UDP_STREAM_DEFAULT_PORT;
+    const char* group = NULL;
+    int offsetX = 0;
+    int offsetY = 0;
+
+    RGBMatrix::Options matrix_options;
+    rgb_matrix::RuntimeOptions runtime_opt;
+
+    // These are the defaults when no command-line flags are given.
+    matrix_options.rows = 32;
+    matrix_options.chain_length = 1;
+    matrix_options.parallel = 1;
+
+    // First things first: extract the command line flags that contain
+    // relevant matrix options.
+    if (!ParseOptionsFromFlags(&argc, &argv, &matrix_options, &runtime_opt)) {
+        return usage(argv[0]);
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "dt:u:g:x:y:b:")) != -1) {
+        switch (opt) {
+        case 't':
+        runtime_seconds = atoi(optarg);
+        break;
+
+        case 'u':
+        port = atoi(optarg);
+        break;
+
+        case 'g':
+        group = optarg;
+        break;
+
+        case 'x':
+        offsetX = atoi(optarg);
+        break;
+
+        case 'y':
+        offsetY = atoi(optarg);
+        break;
+
+        case 'd':
+        runtime_opt.daemon = 1;
+        break;
+
+        case 'b':
+        matrix_options.brightness = atoi(optarg);
+        break;
+
+        default: /* '?' */
+        return usage(argv[0]);
+        }
+    }
+
+    RGBMatrix *matrix = CreateMatrixFromOptions(matrix_options, runtime_opt);
+    if (matrix == NULL)
+        return 1;
+
+    printf("Size: %dx%d. Hardware gpio mapping: %s\n",
+            matrix->width(), matrix->height(), matrix_options.hardware_mapping);
+
+    Canvas *canvas = matrix;
+
+    // The ThreadedCanvasManipulator objects are filling
+    // the matrix continuously.
+    ThreadedCanvasManipulator *image_gen = NULL;
+    image_gen = new StreamDisplay(matrix, canvas->width(), canvas->height(), port, group, offsetX, offsetY);
+
+    // Set up an interrupt handler to be able to stop animations while they go
+    // on. Note, each demo tests for while (running() && !interrupt_received) {},
+    // so they exit as soon as they get a signal.
+    signal(SIGTERM, InterruptHandler);
+    signal(SIGINT, InterruptHandler);
+
+    // Image generating demo is crated. Now start the thread.
+    image_gen->Start();
+
+    // Now, the image generation runs in the background. We can do arbitrary
+    // things here in parallel. In this demo, we're essentially just
+    // waiting for one of the conditions to exit.
+    if (runtime_seconds > 0) {
+        sleep(runtime_seconds);
+    } else {
+        // The
+        printf("Press <CTRL-C> to exit and reset LEDs\n");
+        while (!interrupt_received) {
+        sleep(1); // Time doesn't really matter. The syscall will be interrupted.
+        }
+    }
+
+    // Stop image generating thread. The delete triggers
+    delete image_gen;
+    delete canvas;
+
+    printf("\%s. Exiting.\n",
+            interrupt_received ? "Received CTRL-C" : "Timeout reached");
+    return 0;
+}
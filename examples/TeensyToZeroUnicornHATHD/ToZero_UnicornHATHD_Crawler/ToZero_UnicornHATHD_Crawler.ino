@@ -58,10 +58,6 @@ class Animation : public RGBMatrixRenderer {
             delay(delay_ms);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return random(a,b);
-        }
-
     private:
         UnicornHD unicorn;
         Crawler animCrawler;
@@ -74,6 +70,17 @@ class Animation : public RGBMatrixRenderer {
             col.blue = colour.b;
             unicorn.Pixels()[y*getGridHeight()+x] = col;
         }
+
+        virtual void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Pixels along a row are contiguous in the unicorn buffer, so copy the span straight in
+            CRGB* row = &unicorn.Pixels()[y*getGridHeight()+x];
+            for (uint16_t i = 0; i < count; i++) {
+                row[i].red = colours[i].r;
+                row[i].green = colours[i].g;
+                row[i].blue = colours[i].b;
+            }
+        }
 };
 
 /***** Global Constants *****/
@@ -94,6 +101,7 @@ void setup()
     
     //Initialise random seed from a floating analogue input
     randomSeed(analogRead(0));
+    animation.seedRandom(random(1, 0x7FFFFFFF));
 
     //Set up unicorn HAT
     unicorn.Begin();
@@ -33,7 +33,10 @@ class Animation : public RGBMatrixRenderer {
     public:
         Animation(uint16_t width, uint16_t height, uint16_t delay_ms, uint8_t fade_steps)
             : RGBMatrixRenderer{width,height}, animGOL(*this,fade_steps,delay_ms,0)
-        {}
+        {
+            //Unicorn pixel buffer keeps pixels between updates, so only changed cells need setting
+            setIncrementalUpdate(true);
+        }
 
         virtual ~Animation(){}
 
@@ -56,10 +59,6 @@ class Animation : public RGBMatrixRenderer {
             delay(delay_ms);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return random(a,b);
-        }
-
     private:
         UnicornHD unicorn;
         GameOfLife animGOL;
@@ -72,6 +71,17 @@ class Animation : public RGBMatrixRenderer {
             col.blue = colour.b;
             unicorn.Pixels()[y*getGridHeight()+x] = col;
         }
+
+        virtual void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Pixels along a row are contiguous in the unicorn buffer, so copy the span straight in
+            CRGB* row = &unicorn.Pixels()[y*getGridHeight()+x];
+            for (uint16_t i = 0; i < count; i++) {
+                row[i].red = colours[i].r;
+                row[i].green = colours[i].g;
+                row[i].blue = colours[i].b;
+            }
+        }
 };
 
 /***** Global Constants *****/
@@ -93,6 +103,7 @@ void setup()
     
     //Initialise random seed from a floating analogue input
     randomSeed(analogRead(0));
+    animation.seedRandom(random(1, 0x7FFFFFFF));
 
     //Set up unicorn HAT
     unicorn.Begin();
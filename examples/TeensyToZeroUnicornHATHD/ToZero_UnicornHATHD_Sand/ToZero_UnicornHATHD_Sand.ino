@@ -30,10 +30,20 @@
 // Passed as a reference into the animation class, so need to dereference 'this' which is a pointer
 // using the syntax *this
 class Animation : public RGBMatrixRenderer {
+    //Black, the box and the 4 colours of sand, with room to spare
+    static const uint16_t maxColours = 16;
+    //4 blocks of 4x4 grains
+    static const uint16_t maxGrains = 64;
+
     public:
         Animation(uint16_t width, uint16_t height, uint16_t shake, int16_t accel)
-            : RGBMatrixRenderer{width,height}, animSand(*this,shake), accel(accel)
+            : RGBMatrixRenderer{width,height,255,false,maxColours}, animSand(*this,shake,10,maxGrains), accel(accel)
         {
+            /* The palette and particle store are sized for the few colours and grains used here,
+             * rather than the defaults, which saves most of the memory the renderer would otherwise
+             * take on the microcontroller.
+             */
+
             /* Consider the coordinate space mapping to the display. In this example class we have
              * written the setPixel method such that position (0,0) is the bottom left of the LED
              * matrix. So increasing X is going to the right across the display and increasing Y is 
@@ -136,10 +146,6 @@ class Animation : public RGBMatrixRenderer {
             delay(delay_ms);
         }
 
-        int16_t random_int16(int16_t a, int16_t b) {
-            return random(a,b);
-        }
-
     private:
         UnicornHD unicorn;
         GravityParticles animSand;
@@ -154,6 +160,17 @@ class Animation : public RGBMatrixRenderer {
             col.blue = colour.b;
             unicorn.Pixels()[(getGridHeight()-y-1)*getGridHeight()+x] = col;
         }
+
+        virtual void writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+        {
+            //Pixels along a row are contiguous in the unicorn buffer, so copy the span straight in
+            CRGB* row = &unicorn.Pixels()[(getGridHeight()-y-1)*getGridHeight()+x];
+            for (uint16_t i = 0; i < count; i++) {
+                row[i].red = colours[i].r;
+                row[i].green = colours[i].g;
+                row[i].blue = colours[i].b;
+            }
+        }
 };
 
 /***** Global Constants *****/
@@ -173,6 +190,7 @@ void setup()
     
     //Initialise random seed from a floating analogue input
     randomSeed(analogRead(0));
+    animation.seedRandom(random(1, 0x7FFFFFFF));
 
     //Set up unicorn HAT
     unicorn.Begin();
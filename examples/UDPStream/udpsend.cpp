@@ -0,0 +1,217 @@
+/**************************************************************************************************
+ * Stream an animation over the network to remote panels
+ *
+ * Runs one of the animation classes on a UDPStreamRenderer, which sends the pixels changed in each
+ * frame to a receiver (see udpreceive in the RGBMatrix_RPi examples). The animation runs on any
+ * Linux machine, without display hardware or the rpi-rgb-led-matrix library. Frames can also be
+ * written to a recording, to be played back later (see playback in the RGBMatrix_RPi examples).
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "udpStream.h"
+#include "frameRecorder.h"
+#include "golife.h"
+#include "gravityparticles.h"
+#include "frameScheduler.h"
+
+volatile bool interrupt_received = false;
+static void InterruptHandler(int signo) {
+    interrupt_received = true;
+}
+
+// Renderer which streams frames to the receiver, and writes messages to stderr
+class StreamRenderer : public UDPStreamRenderer {
+    public:
+        StreamRenderer(uint16_t width, uint16_t height)
+            : UDPStreamRenderer{width,height}
+        {
+        }
+
+        void outputMessage(char msg[]) {
+            fprintf(stderr,"%s",msg);
+        }
+
+        void msSleep(int delay_ms) {
+            usleep(delay_ms * 1000);
+        }
+};
+
+static bool timeUp(time_t endTime)
+{
+    return interrupt_received || ( (endTime > 0) && (time(NULL) >= endTime) );
+}
+
+static void runGol(StreamRenderer& renderer, FrameScheduler& scheduler, uint8_t fadeSteps, time_t endTime)
+{
+    GameOfLife animation(renderer, fadeSteps, 0, 0);
+    animation.setBitPackedEngine(true);
+    animation.setFrameScheduler(&scheduler);
+    while (!timeUp(endTime)) {
+        animation.runCycle();
+    }
+}
+
+static void runSand(StreamRenderer& renderer, FrameScheduler& scheduler, time_t endTime)
+{
+    GravityParticles animation(renderer, 10, 100);
+    renderer.setIncrementalUpdate(true);
+
+    uint16_t numGrains = renderer.getGridWidth() * renderer.getGridHeight() / 4;
+    for (uint16_t i=0; i<numGrains; i++) {
+        animation.addParticle( renderer.getRandomColour() );
+    }
+
+    //Turn gravity round every few seconds, so the sand keeps moving
+    uint32_t frames = 0;
+    uint16_t steps = 1;
+    while (!timeUp(endTime)) {
+        if (frames % 150 == 0) {
+            int16_t accel = ((frames / 150) % 2) ? 50 : -50;
+            animation.setAcceleration(accel / 2, accel);
+        }
+        animation.runCycle(steps);
+        steps = scheduler.waitForFrame();
+        frames++;
+    }
+}
+
+static int usage(const char *progname) {
+    fprintf(stderr, "usage: %s <options>\n", progname);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr,
+            "\t-H <host>       : Host or address to stream to, which can be a broadcast or multicast address (default 127.0.0.1).\n"
+            "\t-p <port>       : Port to stream to (default %d).\n"
+            "\t-c <columns>    : Width of the grid in pixels (default 64).\n"
+            "\t-r <rows>       : Height of the grid in pixels (default 32).\n"
+            "\t-a <animator>   : Animation to stream, gol or sand (default gol).\n"
+            "\t-f <steps>      : Number of steps in Game of Life colour fades (1=no fades).\n"
+            "\t-m <msecs>      : Milliseconds between frames.\n"
+            "\t-k <frames>     : Frames between keyframes, which receivers pick up from after losing packets.\n"
+            "\t-t <seconds>    : Run for these number of seconds, then exit.\n"
+            "\t-w <file>       : Also write the frames to a recording file.\n",
+            UDP_STREAM_DEFAULT_PORT);
+    fprintf(stderr, "Example:\n\t%s -H 192.168.1.50 -c 64 -r 64 -a sand -t 60\n"
+            "Streams falling sand to a 64x64 panel for 60 seconds\n", progname);
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char* host = "127.0.0.1";
+    int port = UDP_STREAM_DEFAULT_PORT;
+    int width = 64;
+    int height = 32;
+    const char* animator = "gol";
+    int fadeSteps = 10;
+    int frameMs = 30;
+    int keyframes = 60;
+    int runtimeSeconds = -1;
+    const char* recordPath = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:r:a:f:m:k:t:w:")) != -1) {
+        switch (opt) {
+        case 'H':
+        host = optarg;
+        break;
+
+        case 'p':
+        port = atoi(optarg);
+        break;
+
+        case 'c':
+        width = atoi(optarg);
+        break;
+
+        case 'r':
+        height = atoi(optarg);
+        break;
+
+        case 'a':
+        animator = optarg;
+        break;
+
+        case 'f':
+        fadeSteps = atoi(optarg);
+        break;
+
+        case 'm':
+        frameMs = atoi(optarg);
+        break;
+
+        case 'k':
+        keyframes = atoi(optarg);
+        break;
+
+        case 't':
+        runtimeSeconds = atoi(optarg);
+        break;
+
+        case 'w':
+        recordPath = optarg;
+        break;
+
+        default: /* '?' */
+        return usage(argv[0]);
+        }
+    }
+    if ( (width <= 0) || (height <= 0) || (frameMs <= 0) || (fadeSteps <= 0)
+      || ( (strcmp(animator, "gol") != 0) && (strcmp(animator, "sand") != 0) ) ) {
+        return usage(argv[0]);
+    }
+
+    srand(time(NULL));
+    StreamRenderer renderer(width, height);
+    renderer.seedRandom(rand() + 1);
+    renderer.setKeyframeInterval(keyframes);
+    renderer.openStream(host, port);
+    FrameScheduler scheduler(renderer, frameMs * 1000, frameMs * 1000);
+
+    //The recorder gets a copy of every frame the stream renderer is given
+    FrameRecorder recorder(width, height);
+    if (recordPath != NULL) {
+        recorder.open(recordPath);
+        renderer.setMirror(&recorder);
+    }
+
+    signal(SIGTERM, InterruptHandler);
+    signal(SIGINT, InterruptHandler);
+
+    time_t endTime = (runtimeSeconds > 0) ? time(NULL) + runtimeSeconds : 0;
+    if (strcmp(animator, "gol") == 0) {
+        runGol(renderer, scheduler, fadeSteps, endTime);
+    }
+    else {
+        runSand(renderer, scheduler, endTime);
+    }
+
+    uint32_t frames = scheduler.getFrameCount();
+    printf("Sent %lu packets, %lu bytes (%lu bytes per frame over %lu frames)\n",
+        (unsigned long)renderer.getPacketsSent(), (unsigned long)renderer.getBytesSent(),
+        (unsigned long)(frames ? renderer.getBytesSent() / frames : 0), (unsigned long)frames);
+    if (recordPath != NULL) {
+        renderer.setMirror(NULL);
+        recorder.close();
+        printf("Recorded %lu frames to %s\n", (unsigned long)recorder.getFramesRecorded(), recordPath);
+    }
+    return 0;
+}
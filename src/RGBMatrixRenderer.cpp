@@ -32,16 +32,54 @@
 
 #include "RGBMatrixRenderer.h"
 #include <stdexcept>
+#include <stdlib.h>
+#if defined(RGB_MATRIX_PROFILE) && !defined(ARDUINO)
+#include <time.h>
+#endif
 
-// default constructor
-RGBMatrixRenderer::RGBMatrixRenderer(uint16_t width, uint16_t height, uint8_t brightnessLimit, bool inCubeMode)
-    : gridWidth(width), gridHeight(height), maxBrightness(brightnessLimit), cubeMode(inCubeMode)
+uint8_t* RGBMatrixRenderer::arena = NULL;
+uint32_t RGBMatrixRenderer::arenaSize = 0;
+uint32_t RGBMatrixRenderer::arenaUsed = 0;
+
+/* default constructor. The palette holds up to maxColours_ colours (including black), so
+ * renderers for animations with only a few colours can use a much smaller palette.
+ */
+RGBMatrixRenderer::RGBMatrixRenderer(uint16_t width, uint16_t height, uint8_t brightnessLimit, bool inCubeMode, uint16_t maxColours_)
+    : maxColours(maxColours_), maxBrightness(brightnessLimit), incrementalUpdate(false), cubeMode(inCubeMode)
 {
+    if (maxColours < 2) {
+        throw std::invalid_argument( "Palette must hold at least 2 colours." );
+    }
+#if defined(RGB_MATRIX_FIXED_SIZE)
+    if ((width != RGB_MATRIX_WIDTH) || (height != RGB_MATRIX_HEIGHT)) {
+        throw std::invalid_argument( "Grid size does not match RGB_MATRIX_WIDTH and RGB_MATRIX_HEIGHT." );
+    }
+#else
+    gridWidth = width;
+    gridHeight = height;
+#endif
+    cubeTransitions = NULL;
+    //Room for circles as large as the grid, so drawing circles does not need to allocate memory
+    circleWidthsRadius = -1;
+    circleWidthsSize = (width > height ? width : height) + 1;
+    circleWidths = (uint16_t*)allocateAligned(sizeof(uint16_t) * circleWidthsSize);
+    doubleBuffered = false;
+    backBuffer = NULL;
+    frontBuffer = NULL;
+    mirror = NULL;
+    //Seed from rand, so programs which seed rand from the time still vary between runs
+    randomStream.seed(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+#if defined(RGB_MATRIX_THREADS)
+    presentPending = false;
+    presentExit = false;
+#endif
+
     //Set panel size if in cube mode
     if (inCubeMode) {
         //Width has to be 3/2 of height in cube mode
         if (width == height * 3 / 2) {
             panelSize = height / 2;
+            buildCubeTransitions();
         }
         else {
             //Unsupported panel arrangement for cube mode
@@ -50,12 +88,57 @@ RGBMatrixRenderer::RGBMatrixRenderer(uint16_t width, uint16_t height, uint8_t br
     }
     
     // Allocate memory for colour palette array
-    palette = new RGB_colour[maxColours];
+    palette = (RGB_colour*)allocateAligned(sizeof(RGB_colour) * maxColours);
     palette[0] = RGB_colour{0,0,0};
     coloursDefined = 0;
+
+    // Allocate memory for palette hash index (cleared along with the image), with room for every
+    // colour before the index is 3/4 full
+    uint32_t indexSize = 16;
+    while ( (indexSize < PALETTE_INDEX_SIZE) && (indexSize / 4 * 3 < maxColours) ) {
+        indexSize *= 2;
+    }
+    paletteIndexMask = indexSize - 1;
+    paletteIndex = (uint16_t*)allocateAligned(sizeof(uint16_t) * indexSize);
     
+#if defined(RGB_MATRIX_FIXED_SIZE)
+    // Pixel buffers are held in the renderer
+    img = imgStore;
+    dirty = dirtyStore;
+    occupied = occupiedStore;
+    spanBuffer = spanStore;
+#else
     // Allocate memory for pixels array
-    img = new uint16_t[width * height];
+    uint32_t pixels = (uint32_t)width * height;
+    img = (uint16_t*)allocateAligned(sizeof(uint16_t) * pixels);
+
+    // Allocate memory for changed pixels bitmap (1 bit per pixel)
+    dirty = (uint8_t*)allocateAligned((pixels + 7) / 8);
+
+    // Allocate memory for occupied pixels bitmap (1 bit per pixel)
+    occupied = (uint8_t*)allocateAligned((pixels + 7) / 8);
+
+    // Allocate memory for a row of pixel colours to send to the display in one go
+    spanBuffer = (RGB_colour*)allocateAligned(sizeof(RGB_colour) * width);
+#endif
+
+    // The base layer uses the buffers above, and more layers can be added over it
+    layers[0].img = img;
+    layers[0].occupied = occupied;
+    layers[0].blend = LAYER_OVER;
+    layers[0].opacity = 255;
+    layers[0].visible = true;
+    layerOrder[0] = 0;
+    layerCount = 1;
+    activeLayer = 0;
+
+#if defined(RGB_MATRIX_PROFILE)
+    // Start with empty profile stats
+    profileCurrent = ProfileFrame();
+    profileFrameCount = 0;
+    profileNestedNs = 0;
+    profileDumpInterval = 0;
+#endif
 
     clearImage();
 
@@ -64,30 +147,84 @@ RGBMatrixRenderer::RGBMatrixRenderer(uint16_t width, uint16_t height, uint8_t br
 // default destructor
 RGBMatrixRenderer::~RGBMatrixRenderer()
 {
-    delete [] palette;
-    delete [] img;
+    //Renderers which use double buffering should turn it off in their own destructor, as the
+    //display cannot be sent frames once the renderer subclass has been destroyed
+    setDoubleBuffered(false);
+    for (uint8_t i=1; i<layerCount; i++) {
+        freeAligned(layers[i].img);
+        freeAligned(layers[i].occupied);
+    }
+    freeAligned(palette);
+    freeAligned(paletteIndex);
+#if !defined(RGB_MATRIX_FIXED_SIZE)
+    freeAligned(layers[0].img);
+    freeAligned(dirty);
+    freeAligned(layers[0].occupied);
+    freeAligned(spanBuffer);
+#endif
+    freeAligned(cubeTransitions);
+    freeAligned(circleWidths);
 } //~RGBMatrixRenderer
 
-uint16_t RGBMatrixRenderer::getGridWidth()
+#if defined(RGB_MATRIX_FIXED_SIZE)
+const uint16_t RGBMatrixRenderer::gridWidth;
+const uint16_t RGBMatrixRenderer::gridHeight;
+#endif
+
+uint8_t RGBMatrixRenderer::getMaxBrightness()
 {
-    return gridWidth;
+    return maxBrightness;
 }
 
-uint16_t RGBMatrixRenderer::getGridHeight()
+bool RGBMatrixRenderer::getCubeMode()
 {
-    return gridHeight;
+    return cubeMode;
 }
 
-uint8_t RGBMatrixRenderer::getMaxBrightness()
+uint8_t RGBMatrixRenderer::getPanelSize()
 {
-    return maxBrightness;
+    return panelSize;
+}
+
+//Transform for moving off a cube panel. edgeX and edgeY are 0 when moving off the left or bottom
+//edge, 2 when moving off the right or top edge, and 1 when staying within the panel in that direction.
+const CubeTransition& RGBMatrixRenderer::getCubeTransition(uint8_t panel, uint8_t edgeX, uint8_t edgeY)
+{
+    return cubeTransitions[panel * 9 + edgeY * 3 + edgeX];
+}
+
+/* Random value from a up to (but not including) b. Animators draw from the renderer's own random
+ * stream through randomRange, which is inlined. This is kept so existing programs calling it still
+ * work, and can be overridden to use another random source.
+ */
+int16_t RGBMatrixRenderer::random_int16(int16_t a, int16_t b)
+{
+    return randomStream.range(a,b);
+}
+
+//Restart the random stream from a seed, so the following animation repeats exactly
+void RGBMatrixRenderer::seedRandom(uint32_t seed)
+{
+    randomStream.seed(seed);
+}
+
+//Split a new random stream off the renderer's stream, for an animator or worker thread to use alone
+RandomStream RGBMatrixRenderer::splitRandom()
+{
+    return randomStream.split();
+}
+
+//Fill an array with random values from a up to (but not including) b
+void RGBMatrixRenderer::fillRandom(int16_t* values, uint32_t count, int16_t a, int16_t b)
+{
+    randomStream.fillRange(values, count, a, b);
 }
 
 RGB_colour RGBMatrixRenderer::getRandomColour()
 {
     //Fetches a random colour from the palette if palette is full, otherwise returns a new one
     if (coloursDefined >= maxColours) {
-        return getColour(random_int16(0,maxColours));
+        return getColour(randomRange(0,maxColours));
     }
     else {
         return newRandomColour();
@@ -99,14 +236,14 @@ RGB_colour RGBMatrixRenderer::newRandomColour()
 {
     // Init colour randomly
     RGB_colour colour;
-    colour.r = random_int16(0,maxBrightness);
-    colour.g = random_int16(0,maxBrightness);
-    colour.b = random_int16(0,maxBrightness);
+    colour.r = randomRange(0,maxBrightness);
+    colour.g = randomRange(0,maxBrightness);
+    colour.b = randomRange(0,maxBrightness);
     uint8_t minBrightness = maxBrightness * 3 / 4;
     
     //Prevent colours being too dim
     if (colour.r<minBrightness && colour.g<minBrightness && colour.b<minBrightness) {
-        uint8_t c = random_int16(0,3);
+        uint8_t c = randomRange(0,3);
         switch (c) {
         case 0:
             colour.r = 200;
@@ -169,10 +306,84 @@ uint8_t RGBMatrixRenderer::getPanel(MovingPixel pixel)
     return panel;
 };
 
+//Build table of transforms for pixels moving off each cube panel, for every edge and corner
+void RGBMatrixRenderer::buildCubeTransitions()
+{
+    /* Panels 0-2 are the bottom row of the grid, and 3-5 the top row. For each panel this gives the
+     * panel across each edge (in the order right, up, left, down) and the number of quarter turns
+     * anticlockwise the direction of travel rotates when crossing that edge.
+     */
+    static const uint8_t edgePanel[6][4] = {
+        {1, 5, 4, 3},
+        {2, 5, 0, 3},
+        {4, 5, 1, 3},
+        {4, 2, 1, 0},
+        {5, 2, 3, 0},
+        {1, 2, 4, 0},
+    };
+    static const uint8_t edgeTurns[6][4] = {
+        {0, 0, 3, 2},
+        {0, 1, 0, 1},
+        {3, 2, 0, 0},
+        {0, 0, 3, 2},
+        {0, 1, 0, 1},
+        {3, 2, 0, 0},
+    };
+    //Rotation matrix for each number of quarter turns, and the offset to rotate about the panel centre
+    static const int8_t turnMatrix[4][4] = {
+        {1, 0, 0, 1},
+        {0, -1, 1, 0},
+        {-1, 0, 0, -1},
+        {0, 1, -1, 0},
+    };
+    static const uint8_t turnOffset[4][2] = {
+        {0, 0},
+        {1, 0},
+        {1, 1},
+        {0, 1},
+    };
+
+    cubeTransitions = (CubeTransition*)allocateAligned(sizeof(CubeTransition) * 6 * 9);
+    for (uint8_t panel=0; panel<6; panel++) {
+        for (uint8_t edgeY=0; edgeY<3; edgeY++) {
+            for (uint8_t edgeX=0; edgeX<3; edgeX++) {
+                //Cross the left or right edge, then the top or bottom edge (which may have been
+                //turned into a different edge of the next panel by the first crossing)
+                uint8_t dest = panel;
+                uint8_t turns = 0;
+                if (edgeX != 1) {
+                    uint8_t edge = (edgeX == 2) ? 0 : 2;
+                    turns = edgeTurns[dest][edge];
+                    dest = edgePanel[dest][edge];
+                }
+                if (edgeY != 1) {
+                    uint8_t edge = (((edgeY == 2) ? 1 : 3) + turns) % 4;
+                    turns = (turns + edgeTurns[dest][edge]) % 4;
+                    dest = edgePanel[dest][edge];
+                }
+
+                //Shift a position which has moved off the panel back on as if it wrapped, relative to
+                //the panel origin. Then turn it about the panel centre and translate to the new panel.
+                int16_t shiftX = (1 - edgeX) * panelSize - (panel % 3) * panelSize;
+                int16_t shiftY = (1 - edgeY) * panelSize - (panel / 3) * panelSize;
+                CubeTransition &t = cubeTransitions[panel * 9 + edgeY * 3 + edgeX];
+                t.xx = turnMatrix[turns][0];
+                t.xy = turnMatrix[turns][1];
+                t.yx = turnMatrix[turns][2];
+                t.yy = turnMatrix[turns][3];
+                t.offsetX = t.xx * shiftX + t.xy * shiftY + turnOffset[turns][0] * (panelSize - 1) + (dest % 3) * panelSize;
+                t.offsetY = t.yx * shiftX + t.yy * shiftY + turnOffset[turns][1] * (panelSize - 1) + (dest / 3) * panelSize;
+            }
+        }
+    }
+}
+
 //Method for a cube, updates a grid coordinates while keeping on the matrix, with optional wrapping
 MovingPixel  RGBMatrixRenderer::updatePosition(MovingPixel pixel, bool wrap)
 {
     MovingPixel newPixel(0,0,0,0);
+    int16_t moveX = 0;
+    int16_t moveY = 0;
 
     //Update the pixel fine position (fraction of a pixel position)
     uint16_t fineInc = abs(pixel.fineX + pixel.vx);
@@ -189,6 +400,7 @@ MovingPixel  RGBMatrixRenderer::updatePosition(MovingPixel pixel, bool wrap)
         }
         newPixel.x = newPositionX(pixel.x,wholePix,wrap);
         newPixel.fineX = partPix;
+        moveX = wholePix;
 // char msg1[96];
 // sprintf(msg1, "WholePix=%d PartPix=%d OldFine: %d,%d NewFine: %d,%d\n", wholePix, partPix, pixel.fineX, pixel.fineY, newPixel.fineX, newPixel.fineY);
 // outputMessage(msg1);
@@ -216,6 +428,7 @@ MovingPixel  RGBMatrixRenderer::updatePosition(MovingPixel pixel, bool wrap)
         }
         newPixel.y = newPositionY(pixel.y,wholePix,wrap);
         newPixel.fineY = partPix;
+        moveY = wholePix;
 // char msg1[96];
 // sprintf(msg1, "WholePix=%d PartPix=%d OldFine: %d,%d NewFine: %d,%d\n", wholePix, partPix, pixel.fineX, pixel.fineY, newPixel.fineX, newPixel.fineY);
 // outputMessage(msg1);
@@ -232,303 +445,36 @@ MovingPixel  RGBMatrixRenderer::updatePosition(MovingPixel pixel, bool wrap)
     newPixel.vx = pixel.vx;
     newPixel.vy = pixel.vy;
 
-    if (cubeMode)
-    {
+    if (cubeMode) {
         //For cube, the panels are arranged in 2 rows of 3. The bottom row of 3 panels represent 
         //3 sides with x being across, and y being up. The top row represents the top, back and bottom 
         //sides of the cube. x and y directions vary across these 3 panels wrt to the underlying 3 x 2
-        //matrix.
-
-        //Determine which panel the pixel is on now
-        uint8_t panelRow = pixel.y / panelSize;
-        uint8_t panelCol = pixel.x / panelSize;
-        uint16_t newX;
-        uint16_t newY;
-        int16_t newFineX;
-        //int16_t newFineY;
-
-        //Determine which panel the new pixel is on (before cube wrapping translation is applied)
-        uint8_t panelRowNew = newPixel.y / panelSize;
-        uint8_t panelColNew = newPixel.x / panelSize;
-
-// char msg1[96];
-// sprintf(msg1, "Cube Mode. Wrap=%d On Panel: %d,%d Moving to panel: %d,%d pos: %d,%d ", wrap, panelCol, panelRow, panelColNew, panelRowNew, pixel.x, pixel.y);
-// outputMessage(msg1);
+        //matrix. Moves off a panel are mapped onto the panel on the other side of the cube edge
+        //(or corner) using the transition table for the panel and the edge it is moving over.
+        int16_t x = pixel.x + moveX;
+        int16_t y = pixel.y + moveY;
+        uint8_t panelCol = (pixel.x >= panelSize) + (pixel.x >= 2 * panelSize);
+        uint8_t panelRow = (pixel.y >= panelSize);
+        int16_t localX = x - panelCol * panelSize;
+        int16_t localY = y - panelRow * panelSize;
+        uint8_t edgeX = (localX >= 0) + (localX >= panelSize);
+        uint8_t edgeY = (localY >= 0) + (localY >= panelSize);
 
-        //Update wrapping if changed panel
-        if (wrap == false) {
+        if ( (wrap == false) && ((edgeX != 1) || (edgeY != 1)) ) {
             //If not wrapping, then don't allow move off panel
             newPixel = pixel;
-        } 
-        else if (panelRow == panelRowNew) {
-            if (panelRow == 0) {
-                // Bottom Row
-                if ( panelCol == 2 && panelColNew == 0) {
-                    //Wrapped off RH edge of panel3, so transpose onto panel 5
-                    newY = gridHeight - 1 - newPixel.x;
-                    newX = panelSize + newPixel.y;
-                    newPixel.x = newX;
-                    newPixel.y = newY;
-                    //Transpose part pixel positions
-                    newFineX = newPixel.fineY;
-                    newPixel.fineY = -newPixel.fineX;
-                    newPixel.fineX = newFineX;
-                    //Transpose X and Y velocities
-                    newPixel.vx = pixel.vy;
-                    newPixel.vy = -pixel.vx;
-                }
-                else if ( panelCol == 0 && panelColNew == 2) {
-                    //Wrapped off LH edge of panel1, so transpose onto panel 5
-                    newY = gridWidth - 1 - newPixel.x + panelSize;
-                    newX = panelSize + newPixel.y;
-                    newPixel.x = newX;
-                    newPixel.y = newY;
-                    //Transpose part pixel positions
-                    newFineX = newPixel.fineY;
-                    newPixel.fineY = -newPixel.fineX;
-                    newPixel.fineX = newFineX;
-                    //Transpose X and Y velocities
-                    newPixel.vx = pixel.vy;
-                    newPixel.vy = -pixel.vx;
-                }
-                // else {
-                //     //Remains on row 0, so just copy velocity to new pixel
-                //     newPixel.vx = pixel.vx;
-                //     newPixel.vy = pixel.vy;
-                // }
-            }
-            else { 
-                //Upper Row
-                if ( panelCol == 2 && panelColNew == 0) {
-                    //Wrapped off RH edge of panel6, so transpose onto panel 2
-                    newY = panelSize - 1 - newPixel.x;
-                    newX = newPixel.y;
-                    newPixel.x = newX;
-                    newPixel.y = newY;
-                    //Transpose part pixel positions
-                    newFineX = newPixel.fineY;
-                    newPixel.fineY = -newPixel.fineX;
-                    newPixel.fineX = newFineX;
-                    //Transpose X and Y velocities
-                    newPixel.vx = pixel.vy;
-                    newPixel.vy = -pixel.vx;
-                }
-                else if ( panelCol == 0 && panelColNew == 2) {
-                    //Wrapped off LH edge of panel4, so transpose onto panel 5
-                    newY = gridWidth - 1 - newPixel.x;
-                    newX = newPixel.y;
-                    newPixel.x = newX;
-                    newPixel.y = newY;
-                    //Transpose part pixel positions
-                    newFineX = newPixel.fineY;
-                    newPixel.fineY = -newPixel.fineX;
-                    newPixel.fineX = newFineX;
-                    //Transpose X and Y velocities
-                    newPixel.vx = pixel.vy;
-                    newPixel.vy = -pixel.vx;
-                }
-                // else {
-                //     //Remains on row 1, so just copy velocity to new pixel
-                //     newPixel.vx = pixel.vx;
-                //     newPixel.vy = pixel.vy;
-                // }
-            }
         }
         else {
-            //Change of panel row
-            if (panelCol == panelColNew) {
-                //Moving onto panel above or below (not diagonally)
-                uint8_t panelColNewCube = 0;
-                uint8_t panelRowNewCube = 0;
-                int16_t translate = 0;
-                if ( panelCol == 0 ) {
-                    if ( panelRow == 0 ) {
-                        //On panel 1
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 1 to panel 6
-                            //Shift 2 panels to the right. Y wraps as normal so no change
-                            translate = 2 * panelSize;
-                        } 
-                        else {
-                            //Moving down from panel 1 to 4 (flip X and Y)
-                            panelColNewCube = 0;
-                            panelRowNewCube = 1;
-                        }
-                    } 
-                    else {
-                        //On panel 4
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 4 to panel 3
-                            //Shift 2 panels to the right. Y wraps as normal so no change
-                            translate = 2 * panelSize;
-                        } 
-                        else {
-                            //Moving down from panel 4 to 1 (flip X and Y)
-                            panelColNewCube = 0;
-                            panelRowNewCube = 0;
-                        }
-                    }
-                }
-                else if ( panelCol == 1 ) {
-                    if ( panelRow == 0 ) {
-                        //On panel 2
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 2 to panel 6 (swap X and Y)
-                            panelColNewCube = 2;
-                            panelRowNewCube = 1;
-                            translate = 1;
-                        } 
-                        else {
-                            //Moving down from panel 2 to panel 4 (swap X and Y)
-                            panelColNewCube = 0;
-                            panelRowNewCube = 1;
-                            translate = 1;
-                        }
-                    } 
-                    else {
-                        //On panel 5
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 5 to panel 3 (swap X and Y)
-                            panelColNewCube = 2;
-                            panelRowNewCube = 0;
-                            translate = 1;
-                        } 
-                        else {
-                            //Moving down from panel 5 to panel 1 (swap X and Y)
-                            panelColNewCube = 0;
-                            panelRowNewCube = 0;
-                            translate = 1;
-                        }
-                    }
-                }
-                else {
-                    if ( panelRow == 0 ) {
-                        //On panel 3
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 3 to 6 (flip X and Y)
-                            panelColNewCube = 2;
-                            panelRowNewCube = 1;
-                        } 
-                        else {
-                            //Moving down from panel 3 to panel 4
-                            //Shift 2 panels to the left.
-                            translate = - 2 * panelSize; 
-                        }
-                    } 
-                    else {
-                        //On panel 6
-                        if ( pixel.vy > 0 ) {
-                            //Moving up from panel 6 to panel 3 (flip X and Y)
-                            panelColNewCube = 2;
-                            panelRowNewCube = 0;
-                        } 
-                        else {
-                            //Moving down from panel 6 to panel 1
-                            //Shift 2 panels to the left.
-                            translate = - 2 * panelSize; 
-                        }
-                    }
-                }
-
-                //Process operation
-                if (translate == 0) {
-                    //Flip X and Y within panel, then translate to position of final panel
-                    newPixel.x = panelSize - 1 - (newPixel.x - panelColNew * panelSize) + panelColNewCube * panelSize;
-                    newPixel.y = panelSize - 1 - (newPixel.y - panelRowNew * panelSize) + panelRowNewCube * panelSize;
-                    //Reverse part pixel positions
-                    newPixel.fineX = -newPixel.fineX;
-                    newPixel.fineY = -newPixel.fineY;
-                    //Reverse X and Y velocities
-                    newPixel.vx = -pixel.vx;
-                    newPixel.vy = -pixel.vy;
-                }
-                else if (translate == 1) {
-                    //Swap X and Y within panel, flip Y, then translate to position of final panel
-                    newX = panelSize - 1 - (newPixel.y - panelRowNew * panelSize) + panelColNewCube * panelSize;
-                    newPixel.y = (newPixel.x - panelColNew * panelSize) + panelRowNewCube * panelSize;
-                    newPixel.x = newX;
-                    //Transpose part pixel positions
-                    newFineX = -newPixel.fineY;
-                    newPixel.fineY = newPixel.fineX;
-                    newPixel.fineX = newFineX;
-                    //Transpose X and Y velocities
-                    newPixel.vx = -pixel.vy;
-                    newPixel.vy = pixel.vx;
-                }
-                else {
-                    //Translate x to new panel, Y wraps as for non-cube arrangement of flat panels, so no change in Y
-                    newPixel.x = newPixel.x + translate; 
-                    //Retain same X and Y velocities
-                    newPixel.vx = pixel.vx;
-                    newPixel.vy = pixel.vy;
-
-                }
-            }
-            else {
-                //Diagonal cases
-                if ( panelCol == 0 ) {
-                    if ( panelRow == 0 ) {
-                        //On panel 1
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    } 
-                    else {
-                        //On panel 4
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    }
-                }
-                else if ( panelCol == 1 ) {
-                    if ( panelRow == 0 ) {
-                        //On panel 2
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    } 
-                    else {
-                        //On panel 5
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    }
-                }
-                else {
-                    if ( panelRow == 0 ) {
-                        //On panel 3
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    } 
-                    else {
-                        //On panel 6
-                        if ( pixel.vy > 0 ) {
-                            //Moving up
-                        } 
-                        else {
-                            //Moving down
-                        }
-                    }
-                }
-            }
+            //The entry for staying on the panel is an identity transform, so no need to test for a wrap
+            const CubeTransition &t = cubeTransitions[(panelRow * 3 + panelCol) * 9 + edgeY * 3 + edgeX];
+            newPixel.x = t.xx * x + t.xy * y + t.offsetX;
+            newPixel.y = t.yx * x + t.yy * y + t.offsetY;
+            int16_t fineX = newPixel.fineX;
+            newPixel.fineX = t.xx * fineX + t.xy * newPixel.fineY;
+            newPixel.fineY = t.yx * fineX + t.yy * newPixel.fineY;
+            newPixel.vx = t.xx * pixel.vx + t.xy * pixel.vy;
+            newPixel.vy = t.yx * pixel.vx + t.yy * pixel.vy;
         }
-
     }
     
     return newPixel;
@@ -566,125 +512,583 @@ RGB_colour RGBMatrixRenderer::getColour(uint16_t id)
     return colour;
 }
 
+//Hash a colour to its starting slot in the palette index
+uint16_t RGBMatrixRenderer::getPaletteSlot(RGB_colour colour)
+{
+    uint32_t key = ((uint32_t)colour.r << 16) | ((uint32_t)colour.g << 8) | colour.b;
+    return (uint16_t)((key * 2654435761u) >> 16) & paletteIndexMask;
+}
+
 uint16_t RGBMatrixRenderer::getColourId(RGB_colour colour)
 {
-    uint16_t id = 0;
-    uint16_t lowestScore = 100;
-    uint16_t closestMatch = 0;
+    //Black is always zero
+    if ( (colour.r == 0) && (colour.g == 0) && (colour.b == 0) ) {
+        return 0;
+    }
 
-    //Search palette for matching colour (black is always zero)
-    if ( (colour.r !=0) || (colour.g !=0) || (colour.b !=0) ) {
-        for (uint16_t i=1; i<=coloursDefined; i++) {
+    PROFILE_SCOPE(*this, PROFILE_PALETTE);
 
-// char msg1[64];
-// sprintf(msg1, "Searching palette %d (size %d))\n", i, coloursDefined);
-// outputMessage(msg1);
+    //Search palette index for matching colour (open addressing, so probe until an empty slot)
+    uint16_t slot = getPaletteSlot(colour);
+    while (paletteIndex[slot] != 0) {
+        uint16_t i = paletteIndex[slot];
+        if ( (palette[i].r == colour.r)
+        && (palette[i].g == colour.g) 
+        && (palette[i].b == colour.b) ) {
+            PROFILE_COUNT(*this, PROFILE_PALETTE_HITS, 1);
+            return i;
+        }
+        slot = (slot + 1) & paletteIndexMask;
+    }
 
-            if ( (palette[i].r == colour.r)
-            && (palette[i].g == colour.g) 
-            && (palette[i].b == colour.b) ) {
-                id = i;
-                lowestScore = 0;
-                closestMatch = id;
-                break;
-            }
-            else if (coloursDefined < maxColours-1) {
-                //Determine if closest match so far (only needed if palette is already full)
-                uint16_t score = abs(palette[i].r - colour.r) + abs(palette[i].g - colour.g) + abs(palette[i].b - colour.b);
-                if (score < lowestScore) {
-                    lowestScore = score;
-                    closestMatch = i;
-                }
-            }
+    //Colours added after the index filled up are not in it, so search those directly
+    for (uint16_t i=coloursIndexed+1; i<=coloursDefined; i++) {
+        if ( (palette[i].r == colour.r)
+        && (palette[i].g == colour.g) 
+        && (palette[i].b == colour.b) ) {
+            PROFILE_COUNT(*this, PROFILE_PALETTE_HITS, 1);
+            return i;
         }
+    }
+
+    PROFILE_COUNT(*this, PROFILE_PALETTE_MISSES, 1);
+
+    //If match not found, add to palette if room
+    if (coloursDefined < maxColours-1) {
+        coloursDefined++;
         
-        //If match not found, add to palette if room
-        if (id == 0) {
-            if (coloursDefined < maxColours-1) {
-                coloursDefined++;
-                
 // char msg2[64];
 // sprintf(msg2, "Adding colour: %d, %d, %d (Total: %d)\n", colour.r,  colour.g, colour.b, coloursDefined);
 // outputMessage(msg2);
 
-                palette[coloursDefined] = colour;
-                id = coloursDefined;
-            }
-            else {
-                //Set to closest matching colour
-                id = closestMatch;
+        palette[coloursDefined] = colour;
+
+        //Index new colour in the empty slot found above, unless index is getting too full to probe quickly
+        if ( (coloursIndexed == coloursDefined - 1) && (coloursIndexed < ((uint32_t)paletteIndexMask + 1) / 4 * 3) ) {
+            paletteIndex[slot] = coloursDefined;
+            coloursIndexed++;
+        }
+        return coloursDefined;
+    }
+
+    //Palette is full, so set to closest matching colour
+    uint16_t id = getClosestColourId(colour);
 char msg3[64];
 sprintf(msg3, "Asked for (%d,%d,%d) but got (%d,%d,%d)\n", colour.r,  colour.g, colour.b, palette[id].r, palette[id].g, palette[id].b);
 outputMessage(msg3);
-            }
+
+    return id;
+}
+
+//Find the palette entry nearest to a colour (only used once the palette is full)
+uint16_t RGBMatrixRenderer::getClosestColourId(RGB_colour colour)
+{
+    uint16_t lowestScore = 65535;
+    uint16_t closestMatch = 0;
+
+    for (uint16_t i=1; i<=coloursDefined; i++) {
+        uint16_t score = abs(palette[i].r - colour.r) + abs(palette[i].g - colour.g) + abs(palette[i].b - colour.b);
+        if (score < lowestScore) {
+            lowestScore = score;
+            closestMatch = i;
         }
     }
 
-// if (id > 0) {
-//     char msg[64];
-//     sprintf(msg, "Returned colour at index: %d\n", id);
-//     outputMessage(msg);   
-// }
-
-    return id;
+    return closestMatch;
 }
 
 
-//Update Whole Matrix Display
+//Update Whole Matrix Display (or just the pixels changed since the last update in incremental mode)
 void RGBMatrixRenderer::updateDisplay()
 {
-    // Update pixel data on display
-//    uint16_t pixels = 0;
-    for(int y=0; y<gridHeight; y++) {
-        for(int x=0; x<gridWidth; x++) {
-            uint16_t colcode = img[y*gridWidth + x];
-            if (colcode) {
-                setPixel(x,y,getColour(colcode));
-//                pixels++;
+#if defined(RGB_MATRIX_PROFILE)
+    RGBMatrixProfileScope pushScope(*this, PROFILE_PUSH);
+#endif
+    if (incrementalUpdate) {
+        sendChanges();
+    }
+    else {
+        // Update pixel data on display a row at a time
+        for(uint16_t y=0; y<gridHeight; y++) {
+            uint32_t rowStart = (uint32_t)y * gridWidth;
+            for(uint16_t x=0; x<gridWidth; x++) {
+                spanBuffer[x] = (layerCount > 1) ? compositePixel(rowStart + x) : getColour(img[rowStart + x]);
             }
-            else {
-                setPixel(x,y,RGB_colour{0,0,0});
+            PROFILE_COUNT(*this, PROFILE_PIXELS, gridWidth);
+            outputSpan(0, y, gridWidth, spanBuffer);
+        }
+    }
+    clearDirty();
+    PROFILE_SCOPE(*this, PROFILE_SHOW);
+    presentFrame();
+}
+
+/* Send only pixels changed in memory since the last display update, whether or not incremental
+ * updates are turned on. Used by animators which move pixels several times between frames, so
+ * only their final positions get sent.
+ */
+void RGBMatrixRenderer::showChanges()
+{
+    {
+        PROFILE_SCOPE(*this, PROFILE_PUSH);
+        sendChanges();
+    }
+    clearDirty();
+    PROFILE_SCOPE(*this, PROFILE_SHOW);
+    presentFrame();
+}
+
+//Send each run of changed pixels along a row as a span
+void RGBMatrixRenderer::sendChanges()
+{
+    for(uint16_t y=0; y<gridHeight; y++) {
+        uint32_t rowStart = (uint32_t)y * gridWidth;
+        uint16_t runStart = 0;
+        uint16_t runLength = 0;
+        for(uint16_t x=0; x<gridWidth; x++) {
+            uint32_t index = rowStart + x;
+            if (dirty[index >> 3] & (1 << (index & 7))) {
+                if (runLength == 0) {
+                    runStart = x;
+                }
+                spanBuffer[runLength++] = (layerCount > 1) ? compositePixel(index) : getColour(img[index]);
+            }
+            else if (runLength > 0) {
+                PROFILE_COUNT(*this, PROFILE_PIXELS, runLength);
+                outputSpan(runStart, y, runLength, spanBuffer);
+                runLength = 0;
             }
         }
+        if (runLength > 0) {
+            PROFILE_COUNT(*this, PROFILE_PIXELS, runLength);
+            outputSpan(runStart, y, runLength, spanBuffer);
+        }
     }
-    showPixels();
-/*
-    char msg[32];
-    sprintf(msg, "Pixel count: %d\n", pixels);
-    outputMessage(msg);
+}
+
+//Turn on incremental display updates, where updateDisplay only sends pixels which changed in img.
+//Only suitable for displays which retain pixels between updates.
+void RGBMatrixRenderer::setIncrementalUpdate(bool incremental)
+{
+    incrementalUpdate = incremental;
+}
+
+/* Turn on double buffering, where pixels are drawn into a buffer and only sent to the display as
+ * a complete frame when presentFrame is called. This stops the display showing part drawn frames.
+ * Frames are sent on their own thread where available, so slow displays do not hold up drawing the
+ * next frame. Every presented frame is sent in full, so renderers can override writeSpan to copy
+ * rows into a spare hardware frame, and swap frames in showPixels. Turn on before drawing anything.
  */
+void RGBMatrixRenderer::setDoubleBuffered(bool enabled)
+{
+    if (enabled == doubleBuffered) {
+        return;
+    }
+
+    if (enabled) {
+        backBuffer = (RGB_colour*)allocateAligned(sizeof(RGB_colour) * gridWidth * gridHeight);
+        frontBuffer = (RGB_colour*)allocateAligned(sizeof(RGB_colour) * gridWidth * gridHeight);
+#if defined(RGB_MATRIX_THREADS)
+        presentPending = false;
+        presentExit = false;
+        presentThread = std::thread(&RGBMatrixRenderer::presentLoop, this);
+#endif
+        doubleBuffered = true;
+    }
+    else {
+#if defined(RGB_MATRIX_THREADS)
+        //Let the thread finish sending any waiting frame before stopping it
+        {
+            std::lock_guard<std::mutex> lock(presentMutex);
+            presentExit = true;
+        }
+        presentReady.notify_one();
+        presentThread.join();
+#endif
+        doubleBuffered = false;
+        freeAligned(backBuffer);
+        freeAligned(frontBuffer);
+        backBuffer = NULL;
+        frontBuffer = NULL;
+    }
+}
+
+//Show the frame drawn since the last call. Animations call this at the end of each frame. In double
+//buffered mode this hands the frame over to be sent to the display, otherwise it just calls showPixels.
+void RGBMatrixRenderer::presentFrame()
+{
+    if (mirror != NULL) {
+        mirror->presentFrame();
+    }
+
+    if (doubleBuffered == false) {
+        showPixels();
+        return;
+    }
+
+#if defined(RGB_MATRIX_THREADS)
+    std::unique_lock<std::mutex> lock(presentMutex);
+    //The front buffer cannot be replaced until the display has finished taking the last frame
+    presentDone.wait(lock, [this]{ return presentPending == false; });
+    memcpy(frontBuffer, backBuffer, sizeof(RGB_colour) * gridWidth * gridHeight);
+    presentPending = true;
+    lock.unlock();
+    presentReady.notify_one();
+#else
+    memcpy(frontBuffer, backBuffer, sizeof(RGB_colour) * gridWidth * gridHeight);
+    sendFrontBuffer();
+#endif
+}
+
+/* Send everything sent to the display to another renderer of the same size as well, such as a
+ * FrameRecorder to record the animation, or a UDPStreamRenderer to show it on a remote panel too.
+ * Pixels are sent as they are output, and frames shown on the mirror each time presentFrame is
+ * called. Set to NULL to stop.
+ */
+void RGBMatrixRenderer::setMirror(RGBMatrixRenderer* renderer)
+{
+    if ( (renderer != NULL) && ((renderer->getGridWidth() != gridWidth) || (renderer->getGridHeight() != gridHeight)) ) {
+        throw std::invalid_argument( "Mirror renderer must have the same grid size." );
+    }
+    mirror = renderer;
+}
+
+//Send the whole front buffer to the display, a row at a time
+void RGBMatrixRenderer::sendFrontBuffer()
+{
+    for(uint16_t y=0; y<gridHeight; y++) {
+        writeSpan(0, y, gridWidth, &frontBuffer[(uint32_t)y * gridWidth]);
+    }
+    showPixels();
 }
 
+#if defined(RGB_MATRIX_THREADS)
+//Thread which sends frames to the display as they are presented, in double buffered mode
+void RGBMatrixRenderer::presentLoop()
+{
+    std::unique_lock<std::mutex> lock(presentMutex);
+    while (true) {
+        presentReady.wait(lock, [this]{ return presentPending || presentExit; });
+        if (presentPending) {
+            lock.unlock();
+            sendFrontBuffer();
+            lock.lock();
+            presentPending = false;
+            presentDone.notify_all();
+        }
+        else {
+            return;
+        }
+    }
+}
+#endif
+
+/* Clear every layer and wipe the palette. Animators sharing the display with other layers should
+ * use clearLayer instead, as the palette ids on the other layers would no longer match their colours.
+ */
 void RGBMatrixRenderer::clearImage()
 {
-    //Clear img
-    for (uint16_t i=0; i<gridWidth * gridHeight; i++) {
-        img[i]=0;
+    //Clear img on every layer
+    uint32_t pixels = (uint32_t)gridWidth * gridHeight;
+    uint32_t bytes = (pixels + 7) / 8;
+    for (uint8_t l=0; l<layerCount; l++) {
+        for (uint32_t i=0; i<pixels; i++) {
+            layers[l].img[i]=0;
+        }
+        for (uint32_t i=0; i<bytes; i++) {
+            layers[l].occupied[i]=0;
+        }
     }
     //Wipe palette
     coloursDefined = 0;
+    for (uint32_t i=0; i<=paletteIndexMask; i++) {
+        paletteIndex[i]=0;
+    }
+    coloursIndexed = 0;
+
+    //Whole display needs redrawing
+    for (uint32_t i=0; i<bytes; i++) {
+        dirty[i]=0xFF;
+    }
+}
+
+/* Add an image layer over the existing layers, and return its number. Layers let several animators
+ * share one display (such as sand falling over a Game of Life background) without drawing over each
+ * other. Select a layer before running the animator which draws on it. Animators only see pixels on
+ * the selected layer, so particles collide with each other but not with the layers below.
+ */
+uint8_t RGBMatrixRenderer::addLayer(uint8_t blend, uint8_t opacity)
+{
+    if (layerCount >= RGB_MATRIX_MAX_LAYERS) {
+        throw std::invalid_argument( "Too many layers (see RGB_MATRIX_MAX_LAYERS)." );
+    }
+
+    uint32_t pixels = (uint32_t)gridWidth * gridHeight;
+    uint32_t bytes = (pixels + 7) / 8;
+    ImageLayer& layer = layers[layerCount];
+    layer.img = (uint16_t*)allocateAligned(sizeof(uint16_t) * pixels);
+    layer.occupied = (uint8_t*)allocateAligned(bytes);
+    memset(layer.img, 0, sizeof(uint16_t) * pixels);
+    memset(layer.occupied, 0, bytes);
+    layer.blend = blend;
+    layer.opacity = opacity;
+    layer.visible = true;
+    layerOrder[layerCount] = layerCount;
+
+    return layerCount++;
+}
+
+//Remove all layers added over the base layer, and select the base layer
+void RGBMatrixRenderer::removeLayers()
+{
+    for (uint8_t i=1; i<layerCount; i++) {
+        markLayerDirty(i);
+        freeAligned(layers[i].img);
+        freeAligned(layers[i].occupied);
+    }
+    if (layerOrder[0] != 0) {
+        markLayerDirty(0);
+    }
+    layerOrder[0] = 0;
+    layerCount = 1;
+    selectLayer(0);
 }
 
-uint16_t RGBMatrixRenderer::getPixelValue(uint16_t index)
+//Select the layer which pixels are drawn on and read from
+void RGBMatrixRenderer::selectLayer(uint8_t layer)
+{
+    if (layer >= layerCount) {
+        throw std::invalid_argument( "Layer has not been added." );
+    }
+    activeLayer = layer;
+    img = layers[layer].img;
+    occupied = layers[layer].occupied;
+}
+
+uint8_t RGBMatrixRenderer::getLayerCount()
+{
+    return layerCount;
+}
+
+uint8_t RGBMatrixRenderer::getSelectedLayer()
+{
+    return activeLayer;
+}
+
+//Show or hide a layer. Only the pixels set on the layer are redrawn.
+void RGBMatrixRenderer::setLayerVisible(uint8_t layer, bool visible)
+{
+    if (layers[layer].visible != visible) {
+        layers[layer].visible = visible;
+        markLayerDirty(layer);
+    }
+}
+
+//Set how a layer is combined with the layers below it (see LayerBlend)
+void RGBMatrixRenderer::setLayerBlend(uint8_t layer, uint8_t blend, uint8_t opacity)
+{
+    layers[layer].blend = blend;
+    layers[layer].opacity = opacity;
+    markLayerDirty(layer);
+}
+
+//Move a layer to a position in the drawing order, where 0 is drawn first (at the bottom)
+void RGBMatrixRenderer::setLayerDepth(uint8_t layer, uint8_t depth)
+{
+    if (depth >= layerCount) {
+        depth = layerCount - 1;
+    }
+
+    uint8_t from = 0;
+    while (layerOrder[from] != layer) {
+        from++;
+    }
+    for (; from < depth; from++) {
+        layerOrder[from] = layerOrder[from + 1];
+    }
+    for (; from > depth; from--) {
+        layerOrder[from] = layerOrder[from - 1];
+    }
+    layerOrder[depth] = layer;
+    markLayerDirty(layer);
+}
+
+//Clear all pixels on the selected layer, keeping the palette and other layers
+void RGBMatrixRenderer::clearLayer()
+{
+    markLayerDirty(activeLayer);
+    uint32_t pixels = (uint32_t)gridWidth * gridHeight;
+    memset(img, 0, sizeof(uint16_t) * pixels);
+    memset(occupied, 0, (pixels + 7) / 8);
+}
+
+//Mark the pixels set on a layer as needing to be redrawn
+void RGBMatrixRenderer::markLayerDirty(uint8_t layer)
+{
+    uint32_t bytes = ((uint32_t)gridWidth * gridHeight + 7) / 8;
+    const uint8_t* layerOccupied = layers[layer].occupied;
+    for (uint32_t i=0; i<bytes; i++) {
+        dirty[i] |= layerOccupied[i];
+    }
+}
+
+//Add a colour channel of a layer to the colour below, clipped at full brightness
+static inline uint8_t addChannel(uint8_t below, uint8_t above, uint8_t opacity)
+{
+    uint16_t sum = below + (opacity == 255 ? above : above * opacity / 255);
+    return (sum > 255) ? 255 : sum;
+}
+
+/* Combine the layers for one pixel. When activeColour is given it is used in place of the pixel
+ * on the selected layer, for pixels drawn straight to the display. Layers under the top most
+ * opaque pixel are hidden, so combining starts from there.
+ */
+RGB_colour RGBMatrixRenderer::compositePixel(uint32_t index, const RGB_colour* activeColour)
+{
+    uint8_t start = 0;
+    for (uint8_t depth=layerCount; depth-- > 0; ) {
+        uint8_t l = layerOrder[depth];
+        if ( layers[l].visible && (layers[l].blend == LAYER_OVER) && (layers[l].opacity == 255) ) {
+            bool set = ((activeColour != NULL) && (l == activeLayer))
+                ? ((activeColour->r | activeColour->g | activeColour->b) != 0) : (layers[l].img[index] != 0);
+            if (set) {
+                start = depth;
+                break;
+            }
+        }
+    }
+
+    RGB_colour colour;
+    for (uint8_t depth=start; depth<layerCount; depth++) {
+        uint8_t l = layerOrder[depth];
+        const ImageLayer& layer = layers[l];
+        if (!layer.visible) {
+            continue;
+        }
+        RGB_colour above = ((activeColour != NULL) && (l == activeLayer)) ? *activeColour : getColour(layer.img[index]);
+        if ((above.r | above.g | above.b) == 0) {
+            continue;
+        }
+        if (layer.blend == LAYER_ADD) {
+            colour.r = addChannel(colour.r, above.r, layer.opacity);
+            colour.g = addChannel(colour.g, above.g, layer.opacity);
+            colour.b = addChannel(colour.b, above.b, layer.opacity);
+        }
+        else if (layer.opacity == 255) {
+            colour = above;
+        }
+        else {
+            colour = blendColour(colour, above, layer.opacity, 255);
+        }
+    }
+
+    return colour;
+}
+
+//Combine a row of colours drawn straight to the display on the selected layer with the other layers
+const RGB_colour* RGBMatrixRenderer::compositeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+{
+    uint32_t index = (uint32_t)y * gridWidth + x;
+    for (uint16_t i=0; i<count; i++) {
+        spanBuffer[i] = compositePixel(index + i, &colours[i]);
+    }
+    return spanBuffer;
+}
+
+void RGBMatrixRenderer::markDirty(uint32_t index)
+{
+    dirty[index >> 3] |= 1 << (index & 7);
+}
+
+void RGBMatrixRenderer::clearDirty()
+{
+    uint32_t bytes = ((uint32_t)gridWidth * gridHeight + 7) / 8;
+    for (uint32_t i=0; i<bytes; i++) {
+        dirty[i]=0;
+    }
+}
+
+/* Allocate a buffer starting on a cache line boundary (see RGB_MATRIX_CACHE_LINE). The renderer and
+ * animators allocate all their buffers through here. The block actually allocated is stored just
+ * before the buffer, so it can be released by freeAligned. Buffers taken from an arena store NULL
+ * there instead, as they are released along with the whole arena.
+ */
+void* RGBMatrixRenderer::allocateAligned(uint32_t bytes)
+{
+    if (arena != NULL) {
+        uintptr_t start = ((uintptr_t)(arena + arenaUsed + sizeof(void*)) + RGB_MATRIX_CACHE_LINE - 1) & ~(uintptr_t)(RGB_MATRIX_CACHE_LINE - 1);
+        uint32_t end = (uint32_t)(start - (uintptr_t)arena) + bytes;
+        if ( (end > arenaSize) || (end < bytes) ) {
+            throw std::runtime_error( "Memory arena is too small." );
+        }
+        arenaUsed = end;
+        ((void**)start)[-1] = NULL;
+        return (void*)start;
+    }
+    uint8_t* block = new uint8_t[bytes + RGB_MATRIX_CACHE_LINE + sizeof(void*)];
+    uintptr_t start = ((uintptr_t)(block + sizeof(void*)) + RGB_MATRIX_CACHE_LINE - 1) & ~(uintptr_t)(RGB_MATRIX_CACHE_LINE - 1);
+    ((void**)start)[-1] = block;
+    return (void*)start;
+}
+
+//Release a buffer from allocateAligned (does nothing for NULL or buffers from an arena)
+void RGBMatrixRenderer::freeAligned(void* buffer)
+{
+    if (buffer != NULL) {
+        delete [] (uint8_t*)((void**)buffer)[-1];
+    }
+}
+
+/* Take all buffers allocated by renderers and animators from a block of memory from now on,
+ * instead of the heap, so one block sized when the program is built holds everything. Buffers
+ * are handed out in order and never given back, so the block must stay in place until all the
+ * objects using it are destroyed. Animators are given sizing hints in their constructors, so
+ * they allocate everything while being set up and do not grow later. Set up the objects, then
+ * call with NULL to go back to the heap. Not thread safe, so objects should be created from one
+ * thread while an arena is in use.
+ */
+void RGBMatrixRenderer::useArena(void* block, uint32_t bytes)
+{
+    arena = (uint8_t*)block;
+    arenaSize = (block != NULL) ? bytes : 0;
+    arenaUsed = 0;
+}
+
+//Bytes of the arena used so far, including alignment padding (useful to size the arena)
+uint32_t RGBMatrixRenderer::getArenaUsed()
+{
+    return arenaUsed;
+}
+
+uint16_t RGBMatrixRenderer::getPixelValue(uint32_t index)
 {
     return img[index];
 }
 
 uint16_t RGBMatrixRenderer::getPixelValue(uint16_t x, uint16_t y)
 {
-    return img[y*gridWidth + x];
+    return img[(uint32_t)y * gridWidth + x];
 }
 
-void RGBMatrixRenderer::setPixelValue(uint16_t index, uint16_t value)
+void RGBMatrixRenderer::setPixelValue(uint32_t index, uint16_t value)
 {
-    img[index] = value;
+    if (img[index] != value) {
+        img[index] = value;
+        markDirty(index);
+        if (value) {
+            occupied[index >> 3] |= 1 << (index & 7);
+        }
+        else {
+            occupied[index >> 3] &= ~(1 << (index & 7));
+        }
+    }
 }
 
 // Sets pixel colour in memory only (will not show changes until update display called) when persistent, else set instant
 void RGBMatrixRenderer::setPixelColour(uint16_t x, uint16_t y, RGB_colour colour, bool persistent)
 {
     if (persistent) {
-        img[y * gridWidth + x] = getColourId(colour);
+        setPixelValue((uint32_t)y * gridWidth + x, getColourId(colour));
     }
     else {
         setPixelInstant(x,y,colour);
@@ -692,72 +1096,217 @@ void RGBMatrixRenderer::setPixelColour(uint16_t x, uint16_t y, RGB_colour colour
 }
 
 // Sets pixel colour directly on display. Faster and non-persistent as in memory display
-// buffer does not get updated with the change
+// buffer does not get updated with the change. When there are several layers the colour is
+// combined with them as if it was drawn on the selected layer.
 void RGBMatrixRenderer::setPixelInstant(uint16_t x, uint16_t y, RGB_colour colour)
 {
-    setPixel(x,y,colour);
+    PROFILE_SCOPE(*this, PROFILE_PUSH);
+    PROFILE_COUNT(*this, PROFILE_PIXELS, 1);
+    if (layerCount > 1) {
+        colour = compositePixel((uint32_t)y * gridWidth + x, &colour);
+    }
+    outputPixel(x,y,colour);
 }
 
-void RGBMatrixRenderer::drawOctants(int xc, int yc, int x, int y, int yPrev, RGB_colour colour, bool solid, bool persistent)
+// Sets a row of pixel colours directly on the display, starting at x,y and increasing in x.
+// Non-persistent, like setPixelInstant
+void RGBMatrixRenderer::setSpanInstant(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
 {
-    if (x > 0) {
-        if (y == yPrev || solid == false) {
-            setPixelColour(xc+x, yc+y, colour, persistent);
-            setPixelColour(xc-x, yc+y, colour, persistent);
-            setPixelColour(xc+x, yc-y, colour, persistent);
-            setPixelColour(xc-x, yc-y, colour, persistent);
-            if (solid) {
-                for (int lineX = xc-y; lineX <= xc+y; lineX++){
-                    setPixelColour(lineX, yc+x, colour, persistent);
-                    setPixelColour(lineX, yc-x, colour, persistent);
-                }
-            }
-            else {
-                setPixelColour(xc+y, yc+x, colour, persistent);
-                setPixelColour(xc-y, yc+x, colour, persistent);
-                setPixelColour(xc+y, yc-x, colour, persistent);
-                setPixelColour(xc-y, yc-x, colour, persistent);
-            }
-        }
-        else {
-            //Inner most pixels of horizontal section, so fill all postions in x range
-            for (int lineX = xc-x; lineX <= xc+x; lineX++){
-                setPixelColour(lineX, yc+y, colour, persistent);
-                setPixelColour(lineX, yc-y, colour, persistent);
-            }
-            if (solid) {
-                //Middle of circle horizontal lines for every line
-                for (int lineX = xc-y; lineX <= xc+y; lineX++){
-                    setPixelColour(lineX, yc+x, colour, persistent);
-                    setPixelColour(lineX, yc-x, colour, persistent);
-                }
-            }
+    PROFILE_SCOPE(*this, PROFILE_PUSH);
+    PROFILE_COUNT(*this, PROFILE_PIXELS, count);
+    if (layerCount > 1) {
+        colours = compositeSpan(x,y,count,colours);
+    }
+    outputSpan(x,y,count,colours);
+}
+
+// Sets a horizontal line of pixels to one colour, clipped to the grid. Only looks up the colour
+// in the palette once for the whole line.
+void RGBMatrixRenderer::fillSpan(int x, int y, int count, RGB_colour colour, bool persistent)
+{
+    if ( (y < 0) || (y >= gridHeight) ) {
+        return;
+    }
+    if (x < 0) {
+        count += x;
+        x = 0;
+    }
+    if (x + count > gridWidth) {
+        count = gridWidth - x;
+    }
+    if (count <= 0) {
+        return;
+    }
+
+    if (persistent) {
+        fillSpanValue(x, y, count, getColourId(colour));
+    }
+    else {
+        for (int i=0; i<count; i++) {
+            spanBuffer[i] = colour;
         }
+        PROFILE_SCOPE(*this, PROFILE_PUSH);
+        PROFILE_COUNT(*this, PROFILE_PIXELS, count);
+        outputSpan(x,y,count,(layerCount > 1) ? compositeSpan(x,y,count,spanBuffer) : spanBuffer);
+    }
+}
+
+// Sets a horizontal line of pixels in memory to a palette id, clipped to the grid
+void RGBMatrixRenderer::fillSpanValue(int x, int y, int count, uint16_t id)
+{
+    if ( (y < 0) || (y >= gridHeight) ) {
+        return;
+    }
+    if (x < 0) {
+        count += x;
+        x = 0;
+    }
+    if (x + count > gridWidth) {
+        count = gridWidth - x;
+    }
+
+    uint32_t index = (uint32_t)y * gridWidth + x;
+    for (int i=0; i<count; i++) {
+        setPixelValue(index + i, id);
+    }
+}
+
+// Default implementation of sending a row of pixels to the display, one pixel at a time.
+// Renderers for hardware with a frame buffer can override this to copy whole rows at once.
+void RGBMatrixRenderer::writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+{
+    for (uint16_t i=0; i<count; i++) {
+        setPixel(x+i,y,colours[i]);
+    }
+}
+
+//Send a pixel to the display, or draw it into the back buffer when double buffered
+void RGBMatrixRenderer::outputPixel(uint16_t x, uint16_t y, RGB_colour colour)
+{
+    if (mirror != NULL) {
+        mirror->setPixelInstant(x,y,colour);
+    }
+    if (doubleBuffered) {
+        backBuffer[(uint32_t)y * gridWidth + x] = colour;
     }
     else {
-        setPixelColour(xc, yc+y, colour, persistent);
-        setPixelColour(xc, yc-y, colour, persistent);
-        if (solid) {
-            for (int lineX = xc-y; lineX <= xc+y; lineX++){
-                setPixelColour(lineX, yc, colour, persistent);
-            }
+        setPixel(x,y,colour);
+    }
+}
+
+//Send a row of pixels to the display, or draw them into the back buffer when double buffered
+void RGBMatrixRenderer::outputSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+{
+    if (mirror != NULL) {
+        mirror->setSpanInstant(x,y,count,colours);
+    }
+    if (doubleBuffered) {
+        memcpy(&backBuffer[(uint32_t)y * gridWidth + x], colours, sizeof(RGB_colour) * count);
+    }
+    else {
+        writeSpan(x,y,count,colours);
+    }
+}
+
+//Sets a pixel if it is on the grid
+void RGBMatrixRenderer::plotPixel(int x, int y, RGB_colour colour, bool persistent)
+{
+    if ( (x >= 0) && (x < gridWidth) && (y >= 0) && (y < gridHeight) ) {
+        setPixelColour(x, y, colour, persistent);
+    }
+}
+
+//Draw the 8 pixels at the same position in each octant of an outline circle
+void RGBMatrixRenderer::drawOctants(int xc, int yc, int x, int y, RGB_colour colour, bool persistent)
+{
+    plotPixel(xc+x, yc+y, colour, persistent);
+    plotPixel(xc-x, yc+y, colour, persistent);
+    plotPixel(xc+x, yc-y, colour, persistent);
+    plotPixel(xc-x, yc-y, colour, persistent);
+    plotPixel(xc+y, yc+x, colour, persistent);
+    plotPixel(xc-y, yc+x, colour, persistent);
+    plotPixel(xc+y, yc-x, colour, persistent);
+    plotPixel(xc-y, yc-x, colour, persistent);
+}
+
+/* Half width of each row of a solid circle, from the centre row (0) out to the top and bottom
+ * rows (radius). These follow the same Bresenham steps as outline circles, taking the widest
+ * point reached on each row. The widths are kept, as circles of the same size are usually
+ * drawn over and over.
+ */
+const uint16_t* RGBMatrixRenderer::getCircleWidths(int radius)
+{
+    if (radius == circleWidthsRadius) {
+        return circleWidths;
+    }
+    if (radius + 1 > circleWidthsSize) {
+        freeAligned(circleWidths);
+        circleWidthsSize = radius + 1;
+        circleWidths = (uint16_t*)allocateAligned(sizeof(uint16_t) * circleWidthsSize);
+    }
+    for (int i=0; i<=radius; i++) {
+        circleWidths[i] = 0;
+    }
+
+    int x = 0, y = radius;
+    int d = 3 - 2 * radius;
+    while (y >= x) {
+        if (circleWidths[y] < x) {
+            circleWidths[y] = x;
         }
-        else {
-            setPixelColour(xc-y, yc, colour, persistent);
-            setPixelColour(xc+y, yc, colour, persistent);
+        if (circleWidths[x] < y) {
+            circleWidths[x] = y;
+        }
+        x++;
+        if (d > 0) {
+            y--;
+            d = d + 4 * (x - y) + 10;
         }
+        else
+            d = d + 4 * x + 6;
+    }
+    //Final step lands just past the diagonal, which still widens the row it lands on
+    if (y >= 0 && circleWidths[y] < x) {
+        circleWidths[y] = x;
+    }
+
+    circleWidthsRadius = radius;
+    return circleWidths;
+}
+
+//Draw one row of a solid circle, either into memory using a palette id or directly to the display
+void RGBMatrixRenderer::drawCircleSpan(int x, int y, int count, RGB_colour colour, uint16_t id, bool persistent)
+{
+    if (count <= 0) {
+        return;
+    }
+    if (persistent) {
+        fillSpanValue(x, y, count, id);
+    }
+    else {
+        fillSpan(x, y, count, colour, false);
     }
 }
- 
+
 // Function for circle-generation
-// using Bresenham's algorithm
+// using Bresenham's algorithm. Solid circles are drawn as one span per row, clipped to the grid.
 void RGBMatrixRenderer::drawCircle(int xc, int yc, int radius, RGB_colour colour, bool solid, bool persistent)
 {
+    if (solid) {
+        const uint16_t* widths = getCircleWidths(radius);
+        uint16_t id = persistent ? getColourId(colour) : 0;
+        for (int dy=-radius; dy<=radius; dy++) {
+            int halfWidth = widths[abs(dy)];
+            drawCircleSpan(xc - halfWidth, yc + dy, 2 * halfWidth + 1, colour, id, persistent);
+        }
+        return;
+    }
+
     int r = radius;
-    int x = 0, y = r, yPrev = y;
+    int x = 0, y = r;
     int d = 3 - 2 * r;
     //Draw the 4 pixels marking the top, bottom, left and right most points in the circle
-    drawOctants(xc, yc, x, y, yPrev, colour, solid, persistent);
+    drawOctants(xc, yc, x, y, colour, persistent);
     //Now draw the positions either side of the last points drawn and continue moving
     //around the circumference drawing 8 pixels each step
     while (y >= x) {
@@ -771,7 +1320,149 @@ void RGBMatrixRenderer::drawCircle(int xc, int yc, int radius, RGB_colour colour
         }
         else
             d = d + 4 * x + 6;
-        drawOctants(xc, yc, x, y, yPrev, colour, solid, persistent);
-        yPrev = y;
+        drawOctants(xc, yc, x, y, colour, persistent);
+    }
+}
+
+/* Move a solid circle. Pixels only covered by the old position are cleared to black, then the
+ * circle is drawn at the new position. Pixels in memory which already have the colour are not
+ * marked as changed, so only the pixels which differ get sent to the display.
+ */
+void RGBMatrixRenderer::moveCircle(int oldXc, int oldYc, int xc, int yc, int radius, RGB_colour colour, bool persistent)
+{
+    clearCircleMove(oldXc, oldYc, xc, yc, radius, persistent);
+    drawCircle(xc, yc, radius, colour, true, persistent);
+}
+
+/* Clear the pixels of a solid circle at its old position which are not covered by it at the new
+ * position. When several circles move, clear them all before drawing any at their new positions,
+ * so clearing one circle cannot leave a hole in another which it overlapped.
+ */
+void RGBMatrixRenderer::clearCircleMove(int oldXc, int oldYc, int xc, int yc, int radius, bool persistent)
+{
+    const uint16_t* widths = getCircleWidths(radius);
+    RGB_colour black = RGB_colour(0,0,0);
+
+    for (int y=oldYc-radius; y<=oldYc+radius; y++) {
+        int oldLeft = oldXc - widths[abs(y - oldYc)];
+        int oldRight = oldXc + widths[abs(y - oldYc)];
+        if (abs(y - yc) <= radius) {
+            //Clear the ends of the old row outside the new one
+            int newLeft = xc - widths[abs(y - yc)];
+            int newRight = xc + widths[abs(y - yc)];
+            drawCircleSpan(oldLeft, y, ((oldRight < newLeft - 1) ? oldRight : newLeft - 1) - oldLeft + 1, black, 0, persistent);
+            int clearRight = (oldLeft > newRight + 1) ? oldLeft : newRight + 1;
+            drawCircleSpan(clearRight, y, oldRight - clearRight + 1, black, 0, persistent);
+        }
+        else {
+            drawCircleSpan(oldLeft, y, oldRight - oldLeft + 1, black, 0, persistent);
+        }
     }
 }
+
+#if defined(RGB_MATRIX_PROFILE)
+//Time in nanoseconds for profiling (wraps around, so only differences between times are meaningful).
+//Microcontrollers only have microsecond resolution.
+uint32_t RGBMatrixRenderer::profileClock()
+{
+#if defined(ARDUINO)
+    return micros() * 1000;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)now.tv_sec * 1000000000u + (uint32_t)now.tv_nsec;
+#endif
+}
+
+void RGBMatrixRenderer::profileCount(uint8_t counter, uint32_t amount)
+{
+    profileCurrent.count[counter] += amount;
+}
+
+//Start timing a section, returning the nested time of any enclosing section to be restored when it ends
+uint32_t RGBMatrixRenderer::beginProfileSection()
+{
+    uint32_t saved = profileNestedNs;
+    profileNestedNs = 0;
+    return saved;
+}
+
+//Add time in a section to its timer, less any time in sections inside it. This time is then
+//recorded as nested time of the enclosing section, so is not counted twice.
+void RGBMatrixRenderer::endProfileSection(uint8_t timer, uint32_t startNs, uint32_t savedNestedNs)
+{
+    uint32_t elapsed = profileClock() - startNs;
+    profileCurrent.timeNs[timer] += elapsed - profileNestedNs;
+    profileNestedNs = savedNestedNs + elapsed;
+}
+
+//Store stats for the frame just completed, writing out a summary every profileDumpInterval frames
+void RGBMatrixRenderer::endProfileFrame()
+{
+    profileFrames[profileFrameCount % PROFILE_HISTORY] = profileCurrent;
+    profileFrameCount++;
+    profileCurrent = ProfileFrame();
+
+    if ( (profileDumpInterval > 0) && (profileFrameCount % profileDumpInterval == 0) ) {
+        dumpProfile(profileDumpInterval);
+    }
+}
+
+//Write out a summary every given number of frames (0 to turn off)
+void RGBMatrixRenderer::setProfileDumpInterval(uint16_t frames)
+{
+    profileDumpInterval = frames;
+}
+
+//Write out average and maximum times, and average counts per frame, over the last given number of
+//frames (limited to the number of frames in the history)
+void RGBMatrixRenderer::dumpProfile(uint16_t frames)
+{
+    if (frames > PROFILE_HISTORY) {
+        frames = PROFILE_HISTORY;
+    }
+    if (frames > profileFrameCount) {
+        frames = profileFrameCount;
+    }
+    if (frames == 0) {
+        return;
+    }
+
+    uint64_t totalNs[PROFILE_TIMERS] = {0};
+    uint32_t maxNs[PROFILE_TIMERS] = {0};
+    uint32_t totals[PROFILE_COUNTERS] = {0};
+    for (uint16_t f=0; f<frames; f++) {
+        const ProfileFrame& frame = getProfileFrame(f);
+        for (uint8_t t=0; t<PROFILE_TIMERS; t++) {
+            totalNs[t] += frame.timeNs[t];
+            if (frame.timeNs[t] > maxNs[t]) {
+                maxNs[t] = frame.timeNs[t];
+            }
+        }
+        for (uint8_t c=0; c<PROFILE_COUNTERS; c++) {
+            totals[c] += frame.count[c];
+        }
+    }
+
+    char msg[256];
+    sprintf(msg, "profile frames=%lu simulate_us=%lu/%lu palette_us=%lu/%lu push_us=%lu/%lu show_us=%lu/%lu sleep_us=%lu/%lu\n",
+        (unsigned long)profileFrameCount,
+        (unsigned long)(totalNs[PROFILE_SIMULATE] / frames / 1000), (unsigned long)(maxNs[PROFILE_SIMULATE] / 1000),
+        (unsigned long)(totalNs[PROFILE_PALETTE] / frames / 1000), (unsigned long)(maxNs[PROFILE_PALETTE] / 1000),
+        (unsigned long)(totalNs[PROFILE_PUSH] / frames / 1000), (unsigned long)(maxNs[PROFILE_PUSH] / 1000),
+        (unsigned long)(totalNs[PROFILE_SHOW] / frames / 1000), (unsigned long)(maxNs[PROFILE_SHOW] / 1000),
+        (unsigned long)(totalNs[PROFILE_SLEEP] / frames / 1000), (unsigned long)(maxNs[PROFILE_SLEEP] / 1000));
+    outputMessage(msg);
+    sprintf(msg, "profile frames=%lu pixels=%lu palette_hits=%lu palette_misses=%lu collisions=%lu\n",
+        (unsigned long)profileFrameCount,
+        (unsigned long)(totals[PROFILE_PIXELS] / frames), (unsigned long)(totals[PROFILE_PALETTE_HITS] / frames),
+        (unsigned long)(totals[PROFILE_PALETTE_MISSES] / frames), (unsigned long)(totals[PROFILE_COLLISIONS] / frames));
+    outputMessage(msg);
+}
+
+//Stats for a recent frame (0 is the last complete frame)
+const ProfileFrame& RGBMatrixRenderer::getProfileFrame(uint16_t framesAgo)
+{
+    return profileFrames[(profileFrameCount - 1 - framesAgo) % PROFILE_HISTORY];
+}
+#endif
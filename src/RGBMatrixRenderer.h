@@ -39,9 +39,96 @@
 #else
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <cmath>
 #endif
 
+/* In double buffered mode, finished frames are sent to the display on a separate thread where
+ * threads are available (define RGB_MATRIX_NO_THREADS to always send them from the thread which
+ * draws the frames).
+ */
+#if !defined(ARDUINO) && !defined(RGB_MATRIX_NO_THREADS)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#define RGB_MATRIX_THREADS
+#endif
+
+/* Most slots in the hash index used to look up colours in the palette. Must be a power of 2.
+ * Renderers with a smaller palette use a smaller index, sized to the palette. Colours added once
+ * the index is 3/4 full are still stored in the palette, but are found by a linear search of just
+ * those extra entries. Kept small on microcontrollers to save memory.
+ */
+#ifndef PALETTE_INDEX_SIZE
+#if defined(ARDUINO)
+#define PALETTE_INDEX_SIZE 2048
+#else
+#define PALETTE_INDEX_SIZE 32768
+#endif
+#endif
+
+/* Default number of colours the palette holds, including black at id zero. Each colour takes 3
+ * bytes, so renderers for animations which only use a few colours can save a lot of memory by
+ * passing a smaller size to the constructor. Values much over 16400 hang the Teensy3.2 I am testing on.
+ */
+#ifndef RGB_MATRIX_MAX_COLOURS
+#define RGB_MATRIX_MAX_COLOURS 16400
+#endif
+
+/* Define RGB_MATRIX_WIDTH and RGB_MATRIX_HEIGHT for builds where every renderer drives a grid of
+ * one size, known when compiling. The grid size is then a constant in the renderer and animators,
+ * so index maths and edge wrapping compile to shifts and masks for power of 2 sizes. Buffers for
+ * each pixel or cell are also held in the objects, instead of being allocated from the heap.
+ */
+#if defined(RGB_MATRIX_WIDTH) && defined(RGB_MATRIX_HEIGHT)
+#define RGB_MATRIX_FIXED_SIZE
+#endif
+
+/* Alignment in bytes of buffers which hold a value for every pixel or cell. Aligning them to the
+ * size of a cache line means each buffer starts on a fresh line. Must be a power of 2, and at least
+ * the size of a pointer. Kept small on microcontrollers, which have no cache.
+ */
+#ifndef RGB_MATRIX_CACHE_LINE
+#if defined(ARDUINO)
+#define RGB_MATRIX_CACHE_LINE 4
+#else
+#define RGB_MATRIX_CACHE_LINE 64
+#endif
+#endif
+
+/* Most image layers a renderer can hold (see addLayer), including the base layer. Each layer
+ * added takes a palette id and an occupancy bit for every pixel.
+ */
+#ifndef RGB_MATRIX_MAX_LAYERS
+#define RGB_MATRIX_MAX_LAYERS 4
+#endif
+
+/* Define RGB_MATRIX_PROFILE to collect timings and counters for each frame. Stats for the last
+ * PROFILE_HISTORY frames are kept, and can be written out through outputMessage. The PROFILE_
+ * macros compile to nothing when profiling is not enabled.
+ */
+#ifndef PROFILE_HISTORY
+#define PROFILE_HISTORY 32
+#endif
+
+enum ProfileTimers { PROFILE_SIMULATE, PROFILE_PALETTE, PROFILE_PUSH, PROFILE_SHOW, PROFILE_SLEEP, PROFILE_TIMERS };
+enum ProfileCounters { PROFILE_PIXELS, PROFILE_PALETTE_HITS, PROFILE_PALETTE_MISSES, PROFILE_COLLISIONS, PROFILE_COUNTERS };
+
+struct ProfileFrame {
+    uint32_t timeNs[PROFILE_TIMERS]; //Time in each section, not including time in other sections timed inside it
+    uint32_t count[PROFILE_COUNTERS];
+};
+
+#if defined(RGB_MATRIX_PROFILE)
+#define PROFILE_FRAME(renderer) RGBMatrixProfileScope profileFrame_(renderer, PROFILE_SIMULATE, true)
+#define PROFILE_SCOPE(renderer, timer) RGBMatrixProfileScope profileScope_(renderer, timer)
+#define PROFILE_COUNT(renderer, counter, amount) (renderer).profileCount(counter, amount)
+#else
+#define PROFILE_FRAME(renderer)
+#define PROFILE_SCOPE(renderer, timer)
+#define PROFILE_COUNT(renderer, counter, amount)
+#endif
+
 struct RGB_colour {
     RGB_colour() : r(0), g(0), b(0) {}
     RGB_colour(uint8_t rr, uint8_t gg, uint8_t bb) : r(rr), g(gg), b(bb) {}
@@ -50,6 +137,63 @@ struct RGB_colour {
     uint8_t b;
 };
 
+/* Small fast pseudo random number generator (xorshift32), inlined into the loops which use it. Each
+ * stream has its own state, so a stream can be split off for an animator or worker thread which
+ * then needs no locking, and runs repeat exactly from the same seed.
+ */
+struct RandomStream {
+    RandomStream(uint32_t seedValue = 1) { seed(seedValue); }
+    //State must never be zero, or the stream only returns zeros
+    void seed(uint32_t seedValue) { state = seedValue ? seedValue : 0x9E3779B9; }
+    uint32_t next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    //Random value from a up to (but not including) b, where b - a is at most 65535
+    int16_t range(int16_t a, int16_t b) {
+        return a + (int16_t)(((next() >> 16) * (uint16_t)(b - a)) >> 16);
+    }
+    //New stream seeded from this one. The seed is mixed so the new stream does not just follow
+    //the same sequence one step behind this stream.
+    RandomStream split() {
+        uint32_t s = next() + 0x9E3779B9;
+        s = (s ^ (s >> 16)) * 0x85EBCA6B;
+        s = (s ^ (s >> 13)) * 0xC2B2AE35;
+        return RandomStream(s ^ (s >> 16));
+    }
+    void fill(uint32_t* values, uint32_t count) {
+        for (uint32_t i=0; i<count; i++) {
+            values[i] = next();
+        }
+    }
+    void fillRange(int16_t* values, uint32_t count, int16_t a, int16_t b) {
+        for (uint32_t i=0; i<count; i++) {
+            values[i] = range(a,b);
+        }
+    }
+    uint32_t state;
+};
+
+//How a layer is combined with the layers drawn before it
+enum LayerBlend : uint8_t {
+    LAYER_OVER, //Pixels which are not black cover the layers below (mixed by the layer opacity)
+    LAYER_ADD, //Pixel colours are added to the layers below (scaled by the layer opacity)
+};
+
+/* An image layer holds a palette id for each pixel, where id zero is see through. All layers share
+ * the renderer palette, and pixels changed on any layer are marked in one dirty bitmap, so display
+ * updates only combine the layers for pixels which changed.
+ */
+struct ImageLayer {
+    uint16_t* img;
+    uint8_t* occupied; // Bitmap of pixels in img which are not black
+    uint8_t blend;
+    uint8_t opacity; // 255 for fully opaque
+    bool visible;
+};
+
 struct MovingPixel {
     MovingPixel(uint16_t posX, uint16_t posY, int8_t velX, int8_t velY) : x(posX), y(posY), fineX(0), fineY(0),vx(velX), vy(velY) {}
     uint16_t x;
@@ -60,51 +204,149 @@ struct MovingPixel {
     int8_t vy;
 };
 
+/* Transform for a pixel moving off a cube panel onto another panel. New positions are worked out
+ * by applying the rotation to the position on the grid before wrapping, and adding the offset. 
+ * The rotation is also applied to velocities and part pixel positions.
+ */
+struct CubeTransition {
+    int8_t xx;
+    int8_t xy;
+    int8_t yx;
+    int8_t yy;
+    int16_t offsetX;
+    int16_t offsetY;
+};
+
 class RGBMatrixRenderer
 {
     //variables
     public:
         const uint8_t SUBPIXEL_RES = 100;
-        uint16_t getGridWidth();
-        uint16_t getGridHeight();
+        uint16_t getGridWidth() const { return gridWidth; }
+        uint16_t getGridHeight() const { return gridHeight; }
         uint8_t getMaxBrightness();
-        uint16_t getPixelValue(uint16_t);
+        bool getCubeMode();
+        uint8_t getPanelSize();
+        const CubeTransition& getCubeTransition(uint8_t,uint8_t,uint8_t);
+        uint16_t getPixelValue(uint32_t);
         uint16_t getPixelValue(uint16_t,uint16_t);
+        //Whether a pixel is set to any colour other than black, read from a bitmap 1/16th the size of the
+        //image so collision tests touch much less memory
+        bool isOccupied(uint32_t index) const { return occupied[index >> 3] & (1 << (index & 7)); }
+        //Random value from a up to (but not including) b, from the renderer's random stream
+        int16_t randomRange(int16_t a, int16_t b) { return randomStream.range(a,b); }
+        //Occupancy bits for the 8 pixels from index rounded down to a multiple of 8, so whole runs of
+        //black pixels can be skipped at once
+        uint8_t getOccupiedBits(uint32_t index) const { return occupied[index >> 3]; }
     protected:
+#if defined(RGB_MATRIX_FIXED_SIZE)
+        static const uint16_t gridWidth = RGB_MATRIX_WIDTH;
+        static const uint16_t gridHeight = RGB_MATRIX_HEIGHT;
+#else
         uint16_t gridWidth;
         uint16_t gridHeight;
+#endif
     private:
         //Maximum colours supported in palette (including black at index zero)
-        /* The larger the palette size, the more colours can be displayed, but palette 
-         * lookup time will increase the more colours added to the palette (affecting 
-         * speed of all pixel updates).
+        /* The larger the palette size, the more colours can be displayed. Lookups go through
+         * a hash index, so only colours added after the index fills up (see PALETTE_INDEX_SIZE)
+         * slow down pixel updates.
          */
-        const uint16_t maxColours = 16400; //Values much over 16400 hang the Teensy3.2 I am testing on. 
+        uint16_t maxColours;
+        uint16_t paletteIndexMask; // Number of slots in the palette hash index, less one
         
-        /* Require acceleration x and y components per panel for LED cubes. These are stored in a 12 member
-         * array containg the x component for each panel [0-5] followed by the y component for each panel [6-11]
-         */
-        uint16_t panelAccelVectors[11];
         uint8_t maxBrightness;
         uint16_t* img; // Internal 'map' of pixels
+        uint8_t* dirty; // Bitmap of pixels in img changed since the last display update
+        uint8_t* occupied; // Bitmap of pixels in img which are not black (palette id zero)
+        bool incrementalUpdate; // When set, display updates only push changed pixels
+        RGB_colour* spanBuffer; // One row of colours, used to batch pixels sent to the display
         RGB_colour* palette;
         uint16_t coloursDefined;
+        uint16_t* paletteIndex; // Hash table of palette ids keyed on colour (zero marks an empty slot)
+        uint16_t coloursIndexed; // Palette ids 1 to coloursIndexed are in the hash index
         uint8_t panelSize; //Number of pixels width and height of panels (used for cube mode, which only supports square panels)
         bool cubeMode;
+        RandomStream randomStream;
+        /* Layers are drawn in the order listed in layerOrder, from the bottom up. The img and
+         * occupied buffers above belong to the selected layer, so drawing and collision tests work
+         * on that layer alone.
+         */
+        ImageLayer layers[RGB_MATRIX_MAX_LAYERS];
+        uint8_t layerOrder[RGB_MATRIX_MAX_LAYERS];
+        uint8_t layerCount;
+        uint8_t activeLayer;
+#if defined(RGB_MATRIX_FIXED_SIZE)
+        //Storage for the pixel buffers, so they need no heap memory
+        alignas(RGB_MATRIX_CACHE_LINE) uint16_t imgStore[RGB_MATRIX_WIDTH * RGB_MATRIX_HEIGHT];
+        alignas(RGB_MATRIX_CACHE_LINE) uint8_t dirtyStore[(RGB_MATRIX_WIDTH * RGB_MATRIX_HEIGHT + 7) / 8];
+        alignas(RGB_MATRIX_CACHE_LINE) uint8_t occupiedStore[(RGB_MATRIX_WIDTH * RGB_MATRIX_HEIGHT + 7) / 8];
+        RGB_colour spanStore[RGB_MATRIX_WIDTH];
+#endif
+        CubeTransition* cubeTransitions; //For each cube panel, transforms when moving over each edge and corner
+        uint16_t* circleWidths; //Half width of each row of the last solid circle size drawn, from the centre row out
+        int circleWidthsRadius; //Radius circleWidths was worked out for (-1 when not worked out yet)
+        int circleWidthsSize;
+        /* In double buffered mode, pixels sent to the display are drawn into the back buffer instead.
+         * presentFrame copies the finished frame into the front buffer, which is then sent to the
+         * display while the next frame is drawn.
+         */
+        bool doubleBuffered;
+        RGB_colour* backBuffer;
+        RGB_colour* frontBuffer;
+        RGBMatrixRenderer* mirror; //Renderer which is also given every pixel and frame output by this one (NULL for none)
+#if defined(RGB_MATRIX_THREADS)
+        std::thread presentThread;
+        std::mutex presentMutex;
+        std::condition_variable presentReady; //Signalled when a frame is waiting to be sent
+        std::condition_variable presentDone; //Signalled when the waiting frame has been sent
+        bool presentPending;
+        bool presentExit;
+#endif
+#if defined(RGB_MATRIX_PROFILE)
+        ProfileFrame profileFrames[PROFILE_HISTORY]; //Ring buffer of stats for the most recent frames
+        ProfileFrame profileCurrent;
+        uint32_t profileFrameCount;
+        uint32_t profileNestedNs; //Time spent in sections timed inside the section currently being timed
+        uint16_t profileDumpInterval;
+#endif
+        //Block set by useArena which buffers are taken from instead of the heap (NULL to use the heap)
+        static uint8_t* arena;
+        static uint32_t arenaSize;
+        static uint32_t arenaUsed;
         
     //functions    
     public:
-        RGBMatrixRenderer(uint16_t, uint16_t, uint8_t=255, bool=false);
+        RGBMatrixRenderer(uint16_t, uint16_t, uint8_t=255, bool=false, uint16_t=RGB_MATRIX_MAX_COLOURS);
         virtual ~RGBMatrixRenderer();
-        void setPixelValue(uint16_t,uint16_t);
+        void setPixelValue(uint32_t,uint16_t);
         void setPixelColour(uint16_t, uint16_t, RGB_colour, bool=true);
         void setPixelInstant(uint16_t, uint16_t, RGB_colour);
+        void setSpanInstant(uint16_t, uint16_t, uint16_t, const RGB_colour*);
+        void fillSpan(int, int, int, RGB_colour, bool=true);
         void updateDisplay();
+        void showChanges();
+        void setIncrementalUpdate(bool);
+        void setDoubleBuffered(bool);
+        void presentFrame();
+        void setMirror(RGBMatrixRenderer*);
         void clearImage();
+        uint8_t addLayer(uint8_t=LAYER_OVER, uint8_t=255);
+        void removeLayers();
+        void selectLayer(uint8_t);
+        uint8_t getLayerCount();
+        uint8_t getSelectedLayer();
+        void setLayerVisible(uint8_t, bool);
+        void setLayerBlend(uint8_t, uint8_t, uint8_t=255);
+        void setLayerDepth(uint8_t, uint8_t);
+        void clearLayer();
         virtual void showPixels() = 0;
         virtual void msSleep(int) = 0;
         virtual void outputMessage(char[]) = 0;
-        virtual int16_t random_int16(int16_t a, int16_t b) = 0;
+        virtual int16_t random_int16(int16_t a, int16_t b);
+        void seedRandom(uint32_t);
+        RandomStream splitRandom();
+        void fillRandom(int16_t*, uint32_t, int16_t, int16_t);
         RGB_colour getRandomColour();
         RGB_colour newRandomColour();
         uint16_t newPositionX(uint16_t,uint16_t,bool=true);
@@ -112,12 +354,91 @@ class RGBMatrixRenderer
         MovingPixel updatePosition(MovingPixel,bool=true);
         RGB_colour blendColour(RGB_colour,RGB_colour,uint8_t,uint8_t);
         uint16_t getColourId(RGB_colour);
+        static void* allocateAligned(uint32_t);
+        static void freeAligned(void*);
+        static void useArena(void*, uint32_t);
+        static uint32_t getArenaUsed();
         RGB_colour getColour(uint16_t);
         void drawCircle(int, int, int, RGB_colour, bool=true, bool=true);
+        void moveCircle(int, int, int, int, int, RGB_colour, bool=true);
+        void clearCircleMove(int, int, int, int, int, bool=true);
+#if defined(RGB_MATRIX_PROFILE)
+        uint32_t profileClock();
+        void profileCount(uint8_t, uint32_t);
+        uint32_t beginProfileSection();
+        void endProfileSection(uint8_t, uint32_t, uint32_t);
+        void endProfileFrame();
+        void setProfileDumpInterval(uint16_t);
+        void dumpProfile(uint16_t);
+        const ProfileFrame& getProfileFrame(uint16_t);
+#endif
     private:
         uint16_t newPosition(uint16_t,uint16_t,uint16_t,bool);
         uint8_t getPanel(MovingPixel);
+        void buildCubeTransitions();
+        uint16_t getPaletteSlot(RGB_colour);
+        uint16_t getClosestColourId(RGB_colour);
+        void markDirty(uint32_t);
+        void clearDirty();
+        void sendChanges();
+        void markLayerDirty(uint8_t);
+        RGB_colour compositePixel(uint32_t, const RGB_colour* = NULL);
+        const RGB_colour* compositeSpan(uint16_t, uint16_t, uint16_t, const RGB_colour*);
         virtual void setPixel(uint16_t, uint16_t, RGB_colour) = 0;
-        void drawOctants(int, int, int, int, int, RGB_colour, bool, bool);
+        virtual void writeSpan(uint16_t, uint16_t, uint16_t, const RGB_colour*);
+        void outputPixel(uint16_t, uint16_t, RGB_colour);
+        void outputSpan(uint16_t, uint16_t, uint16_t, const RGB_colour*);
+        void sendFrontBuffer();
+#if defined(RGB_MATRIX_THREADS)
+        void presentLoop();
+#endif
+        void drawOctants(int, int, int, int, RGB_colour, bool);
+        void plotPixel(int, int, RGB_colour, bool);
+        void fillSpanValue(int, int, int, uint16_t);
+        void drawCircleSpan(int, int, int, RGB_colour, uint16_t, bool);
+        const uint16_t* getCircleWidths(int);
 
 }; //RGBMatrixRenderer
+
+/* Allocator for std::vector which takes memory through RGBMatrixRenderer::allocateAligned, so
+ * vectors held by animators come out of the arena when one is in use. Vectors should be reserved
+ * to their full size when set up, as blocks given back to an arena are not reused.
+ */
+template <class T>
+struct AlignedAllocator
+{
+    typedef T value_type;
+    AlignedAllocator() {}
+    template <class U> AlignedAllocator(const AlignedAllocator<U>&) {}
+    T* allocate(size_t count) { return (T*)RGBMatrixRenderer::allocateAligned(sizeof(T) * count); }
+    void deallocate(T* buffer, size_t) { RGBMatrixRenderer::freeAligned(buffer); }
+    template <class U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <class U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+}; //AlignedAllocator
+
+#if defined(RGB_MATRIX_PROFILE)
+//Times the enclosing scope into one of the profile timers (and ends the frame when used for PROFILE_FRAME)
+class RGBMatrixProfileScope
+{
+    public:
+        RGBMatrixProfileScope(RGBMatrixRenderer& renderer_, uint8_t timer_, bool endsFrame_=false)
+            : renderer(renderer_), timer(timer_), endsFrame(endsFrame_)
+        {
+            savedNestedNs = renderer.beginProfileSection();
+            startNs = renderer.profileClock();
+        }
+        ~RGBMatrixProfileScope()
+        {
+            renderer.endProfileSection(timer, startNs, savedNestedNs);
+            if (endsFrame) {
+                renderer.endProfileFrame();
+            }
+        }
+    private:
+        RGBMatrixRenderer& renderer;
+        uint8_t timer;
+        bool endsFrame;
+        uint32_t startNs;
+        uint32_t savedNestedNs;
+}; //RGBMatrixProfileScope
+#endif
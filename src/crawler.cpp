@@ -29,8 +29,8 @@ Crawler::Crawler(RGBMatrixRenderer &renderer_, uint16_t steps, uint16_t minSteps
     : renderer(renderer_), leadPixel(0,0,0,0), colChgCount(steps), dirChgCount(minSteps), anyAngle(anyAngle)
 {
     //Pick random start point
-    leadPixel.x = rand()%renderer.getGridWidth();
-    leadPixel.y = rand()%renderer.getGridHeight();
+    leadPixel.x = renderer.randomRange(0,renderer.getGridWidth());
+    leadPixel.y = renderer.randomRange(0,renderer.getGridHeight());
 
     //Force random direction change on start
     dirChg = minSteps + 1;
@@ -53,6 +53,8 @@ Crawler::~Crawler()
 //Run Cycle is called once per frame of the animation
 void Crawler::runCycle()
 {
+    PROFILE_FRAME(renderer);
+
     //Example of how to output messages to console, compatible with Arduino and C++ on Linux
 /*
     char msg[44];
@@ -161,7 +163,7 @@ void Crawler::runCycle()
         // 2 out of 8 chance we change direction
         // 0 or 1 mean opposite directions to turn from current direction
         // 2 or above means keep going in current direction
-        int c = rand()%8;
+        int c = renderer.randomRange(0,8);
         int dir = 0;
         switch(c) {
             case 0: 
@@ -180,8 +182,8 @@ void Crawler::runCycle()
         if (dir != 0 ) {
             if (leadPixel.vx == 0) {
                 if (anyAngle) {
-                    leadPixel.vx = dir*rand()%renderer.SUBPIXEL_RES+renderer.SUBPIXEL_RES;
-                    leadPixel.vy = dir*rand()%renderer.SUBPIXEL_RES;
+                    leadPixel.vx = dir*renderer.randomRange(0,renderer.SUBPIXEL_RES)+renderer.SUBPIXEL_RES;
+                    leadPixel.vy = dir*renderer.randomRange(0,renderer.SUBPIXEL_RES);
                 }
                 else {
                     leadPixel.vx = dir*renderer.SUBPIXEL_RES;
@@ -190,8 +192,8 @@ void Crawler::runCycle()
             }
             else {
                 if (anyAngle) {
-                    leadPixel.vx = dir*rand()%renderer.SUBPIXEL_RES;
-                    leadPixel.vy = dir*rand()%renderer.SUBPIXEL_RES+renderer.SUBPIXEL_RES;
+                    leadPixel.vx = dir*renderer.randomRange(0,renderer.SUBPIXEL_RES);
+                    leadPixel.vy = dir*renderer.randomRange(0,renderer.SUBPIXEL_RES)+renderer.SUBPIXEL_RES;
                 }
                 else {
                     leadPixel.vx = 0;
@@ -0,0 +1,298 @@
+/**************************************************************************************************
+ * Crawler swarm animator class
+ *
+ * Runs many crawlers across the grid at random, moving and drawing all of them in one pass per
+ * frame. Each crawler moves and changes direction and colour in the same way as a Crawler.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "crawlerSwarm.h"
+
+//Directions of travel. Crawlers are not moving until their first cycle picks a direction.
+#define HEADING_RIGHT 0
+#define HEADING_UP 1
+#define HEADING_LEFT 2
+#define HEADING_DOWN 3
+#define HEADING_NONE 4
+
+//Step in the same direction as the step before
+#define HEADING_KEEP 0xFF
+
+/* Steps of the cursor which clears the pixels around the lead pixel, for each direction of travel.
+ * The cursor goes to one side, forwards, across to the other side (two steps) and back, clearing
+ * each pixel it lands on. This is the same route a Crawler takes, so over cube edges (where the
+ * direction turns) the same pixels are cleared.
+ */
+static const uint8_t clearSteps[5][5] = {
+    {HEADING_UP, HEADING_RIGHT, HEADING_DOWN, HEADING_KEEP, HEADING_LEFT},
+    {HEADING_LEFT, HEADING_UP, HEADING_RIGHT, HEADING_KEEP, HEADING_DOWN},
+    {HEADING_UP, HEADING_LEFT, HEADING_DOWN, HEADING_KEEP, HEADING_RIGHT},
+    {HEADING_LEFT, HEADING_DOWN, HEADING_RIGHT, HEADING_KEEP, HEADING_UP},
+    {HEADING_UP, HEADING_LEFT, HEADING_DOWN, HEADING_KEEP, HEADING_RIGHT},
+};
+
+/* default constructor. Room for maxCrawlers_ crawlers is allocated up front, along with the tables
+ * of steps over the edges of the grid (or cube panels), so no memory is allocated while running.
+ */
+CrawlerSwarm::CrawlerSwarm(RGBMatrixRenderer &renderer_, uint16_t maxCrawlers_)
+    : renderer(renderer_), maxCrawlers(maxCrawlers_), numCrawlers(0)
+{
+    posX = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    posY = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    heading = (uint8_t*)RGBMatrixRenderer::allocateAligned(maxCrawlers);
+    colourId = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    colChg = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    dirChg = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    colChgCount = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+    dirChgCount = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxCrawlers);
+
+    //In cube mode every panel edge leads onto another panel, otherwise only the grid edges wrap
+    uint16_t width = renderer.getGridWidth();
+    uint16_t height = renderer.getGridHeight();
+    uint16_t panelWidth = width;
+    uint16_t panelHeight = height;
+    if (renderer.getCubeMode()) {
+        panelWidth = renderer.getPanelSize();
+        panelHeight = panelWidth;
+    }
+    uint32_t wrapCount = 2 * ((uint32_t)(width / panelWidth) * height + (uint32_t)(height / panelHeight) * width);
+
+    wrapRight = (int32_t*)RGBMatrixRenderer::allocateAligned(sizeof(int32_t) * width);
+    wrapUp = (int32_t*)RGBMatrixRenderer::allocateAligned(sizeof(int32_t) * height);
+    wrapLeft = (int32_t*)RGBMatrixRenderer::allocateAligned(sizeof(int32_t) * width);
+    wrapDown = (int32_t*)RGBMatrixRenderer::allocateAligned(sizeof(int32_t) * height);
+    wraps = (SwarmStep*)RGBMatrixRenderer::allocateAligned(sizeof(SwarmStep) * wrapCount);
+
+    uint32_t next = 0;
+    next = addWraps(wrapRight, width, panelWidth, height, next, 1, 0);
+    next = addWraps(wrapUp, height, panelHeight, width, next, 0, 1);
+    next = addWraps(wrapLeft, width, panelWidth, height, next, -1, 0);
+    addWraps(wrapDown, height, panelHeight, width, next, 0, -1);
+} //CrawlerSwarm
+
+// default destructor
+CrawlerSwarm::~CrawlerSwarm()
+{
+    RGBMatrixRenderer::freeAligned(posX);
+    RGBMatrixRenderer::freeAligned(posY);
+    RGBMatrixRenderer::freeAligned(heading);
+    RGBMatrixRenderer::freeAligned(colourId);
+    RGBMatrixRenderer::freeAligned(colChg);
+    RGBMatrixRenderer::freeAligned(dirChg);
+    RGBMatrixRenderer::freeAligned(colChgCount);
+    RGBMatrixRenderer::freeAligned(dirChgCount);
+    RGBMatrixRenderer::freeAligned(wrapRight);
+    RGBMatrixRenderer::freeAligned(wrapUp);
+    RGBMatrixRenderer::freeAligned(wrapLeft);
+    RGBMatrixRenderer::freeAligned(wrapDown);
+    RGBMatrixRenderer::freeAligned(wraps);
+} //~CrawlerSwarm
+
+/* Add a crawler at a random point, which changes colour every steps frames and keeps going in the
+ * same direction for at least minSteps frames, as for a Crawler. Returns false if the swarm is full.
+ */
+bool CrawlerSwarm::addCrawler(uint16_t steps, uint16_t minSteps)
+{
+    if (numCrawlers == maxCrawlers) {
+        return false;
+    }
+    uint16_t i = numCrawlers;
+
+    //Pick random start point
+    posX[i] = renderer.randomRange(0,renderer.getGridWidth());
+    posY[i] = renderer.randomRange(0,renderer.getGridHeight());
+    heading[i] = HEADING_NONE;
+
+    //Force random direction change on start
+    colChg[i] = 0;
+    dirChg[i] = minSteps + 1;
+    colChgCount[i] = steps;
+    dirChgCount[i] = minSteps;
+
+    //Initial random colour
+    colourId[i] = renderer.getColourId(renderer.getRandomColour());
+
+    numCrawlers++;
+    return true;
+}
+
+uint16_t CrawlerSwarm::getCrawlerCount()
+{
+    return numCrawlers;
+}
+
+//Run Cycle is called once per frame of the animation
+void CrawlerSwarm::runCycle()
+{
+    PROFILE_FRAME(renderer);
+
+    uint16_t width = renderer.getGridWidth();
+    for (uint16_t i=0; i<numCrawlers; i++) {
+        uint16_t x = posX[i];
+        uint16_t y = posY[i];
+        uint8_t dir = heading[i];
+
+        //Set current position pixel
+        renderer.setPixelValue((uint32_t)y * width + x, colourId[i]);
+
+        //Clear pixels around direction of travel
+        uint16_t cursorX = x;
+        uint16_t cursorY = y;
+        uint8_t cursorDir = dir;
+        const uint8_t* route = clearSteps[dir];
+        for (uint8_t s=0; s<5; s++) {
+            if (route[s] != HEADING_KEEP) {
+                cursorDir = route[s];
+            }
+            step(cursorX, cursorY, cursorDir);
+            renderer.setPixelValue((uint32_t)cursorY * width + cursorX, 0);
+        }
+
+        //Update direction if more than set number of steps since last change
+        dirChg[i]++;
+        if (dirChg[i] > dirChgCount[i]) {
+            dirChg[i] = 0;
+
+            // 2 out of 8 chance we change direction
+            // 0 or 1 mean opposite directions to turn from current direction
+            // 2 or above means keep going in current direction
+            int c = renderer.randomRange(0,8);
+            int turn = 0;
+            switch(c) {
+                case 0:
+                    turn = -1;
+                    break;
+                case 1:
+                    turn = 1;
+                    break;
+            }
+
+            //Override random change if not moving (happens on start-up)
+            if (dir == HEADING_NONE) {
+                turn = 1;
+            }
+
+            if (turn != 0) {
+                if ( (dir == HEADING_RIGHT) || (dir == HEADING_LEFT) ) {
+                    dir = (turn > 0) ? HEADING_UP : HEADING_DOWN;
+                }
+                else {
+                    dir = (turn > 0) ? HEADING_RIGHT : HEADING_LEFT;
+                }
+            }
+        }
+
+        //Update postion
+        step(x, y, dir);
+        posX[i] = x;
+        posY[i] = y;
+        heading[i] = dir;
+
+        //Update colour every x steps
+        colChg[i]++;
+        if (colChg[i] >= colChgCount[i]) {
+            colChg[i] = 0;
+            colourId[i] = renderer.getColourId(renderer.getRandomColour());
+        }
+    }
+
+    renderer.updateDisplay();
+}
+
+/* Fill in a table of where steps off the edges of the panels land, for steps along one axis of the
+ * grid (given by the velocity vx,vy) from each of size rows or columns, which are length pixels long.
+ * Entries are stored in wraps from next on, and the position after the last one is returned.
+ */
+uint32_t CrawlerSwarm::addWraps(int32_t* table, uint16_t size, uint16_t panelSpan, uint16_t length, uint32_t next, int8_t vx, int8_t vy)
+{
+    bool forwards = (vx + vy > 0);
+    for (uint16_t i=0; i<size; i++) {
+        bool onEdge = forwards ? ((i + 1) % panelSpan == 0) : (i % panelSpan == 0);
+        if (onEdge == false) {
+            table[i] = -1;
+            continue;
+        }
+        table[i] = next;
+        for (uint16_t along=0; along<length; along++) {
+            MovingPixel pixel = (vx != 0) ? MovingPixel(i, along, vx * renderer.SUBPIXEL_RES, 0)
+                                          : MovingPixel(along, i, 0, vy * renderer.SUBPIXEL_RES);
+            pixel = renderer.updatePosition(pixel);
+            SwarmStep &landing = wraps[next + along];
+            landing.x = pixel.x;
+            landing.y = pixel.y;
+            if (pixel.vx > 0) {
+                landing.heading = HEADING_RIGHT;
+            }
+            else if (pixel.vx < 0) {
+                landing.heading = HEADING_LEFT;
+            }
+            else if (pixel.vy > 0) {
+                landing.heading = HEADING_UP;
+            }
+            else {
+                landing.heading = HEADING_DOWN;
+            }
+        }
+        next += length;
+    }
+    return next;
+}
+
+//Move one whole pixel in the direction given, turning the direction when it goes over a cube edge
+void CrawlerSwarm::step(uint16_t &x, uint16_t &y, uint8_t &dir)
+{
+    int32_t wrap;
+    switch (dir) {
+        case HEADING_RIGHT:
+            wrap = wrapRight[x];
+            if (wrap < 0) {
+                x++;
+                return;
+            }
+            wrap += y;
+            break;
+        case HEADING_UP:
+            wrap = wrapUp[y];
+            if (wrap < 0) {
+                y++;
+                return;
+            }
+            wrap += x;
+            break;
+        case HEADING_LEFT:
+            wrap = wrapLeft[x];
+            if (wrap < 0) {
+                x--;
+                return;
+            }
+            wrap += y;
+            break;
+        case HEADING_DOWN:
+            wrap = wrapDown[y];
+            if (wrap < 0) {
+                y--;
+                return;
+            }
+            wrap += x;
+            break;
+        default:
+            return;
+    }
+    x = wraps[wrap].x;
+    y = wraps[wrap].y;
+    dir = wraps[wrap].heading;
+}
@@ -0,0 +1,78 @@
+/**************************************************************************************************
+ * Crawler swarm animator class
+ *
+ * Runs many crawlers (see crawler.h) on one display. Each crawler behaves like a Crawler moving
+ * in whole pixel steps, but the swarm holds them all in flat arrays and moves and draws them in
+ * one pass per frame, followed by a single display update.
+ *
+ * Crawlers step one whole pixel up, down, left or right, so rather than working out each move
+ * through the renderer part pixel positions, the swarm uses tables of where each step off the
+ * edge of the grid (or cube panel) lands. These are built once from the renderer moves, so
+ * crawlers still wrap over the cube edges exactly as a Crawler does. Pixels are set by palette id,
+ * with the colour looked up once each time a crawler changes colour.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "RGBMatrixRenderer.h"
+
+//Where a step off the edge of the grid or a cube panel lands, and the direction it leaves in
+struct SwarmStep {
+    uint16_t x;
+    uint16_t y;
+    uint8_t heading;
+};
+
+class CrawlerSwarm
+{
+    //variables
+    public:
+    protected:
+    private:
+        RGBMatrixRenderer &renderer;
+        uint16_t maxCrawlers;
+        uint16_t numCrawlers;
+        //Crawler state, one entry per crawler
+        uint16_t* posX;
+        uint16_t* posY;
+        uint8_t* heading; //Direction of travel (right, up, left, down or not moving yet)
+        uint16_t* colourId; //Palette id of the crawler colour
+        uint16_t* colChg;
+        uint16_t* dirChg;
+        uint16_t* colChgCount;
+        uint16_t* dirChgCount;
+        //Steps off an edge, looked up by the start in wraps of the entries for the row or column
+        //being stepped from (-1 for rows and columns which are not on an edge in that direction)
+        int32_t* wrapRight;
+        int32_t* wrapUp;
+        int32_t* wrapLeft;
+        int32_t* wrapDown;
+        SwarmStep* wraps;
+    //functions
+    public:
+        CrawlerSwarm(RGBMatrixRenderer&,uint16_t);
+        ~CrawlerSwarm();
+        bool addCrawler(uint16_t,uint16_t);
+        uint16_t getCrawlerCount();
+        void runCycle();
+    protected:
+    private:
+        uint32_t addWraps(int32_t*,uint16_t,uint16_t,uint16_t,uint32_t,int8_t,int8_t);
+        void step(uint16_t&,uint16_t&,uint8_t&);
+
+}; //CrawlerSwarm
@@ -0,0 +1,348 @@
+/**************************************************************************************************
+ * Frame recording and playback
+ *
+ * Renderer which writes the frame stream to a file, and a player which shows the frames from a
+ * recording on another renderer at the rate they were recorded.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frameRecorder.h"
+#include <stdexcept>
+
+#if !defined(ARDUINO)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static uint32_t readValue32(const uint8_t* data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+#if !defined(ARDUINO)
+static void putValue32(uint8_t* data, uint32_t value)
+{
+    data[0] = value & 0xFF;
+    data[1] = (value >> 8) & 0xFF;
+    data[2] = (value >> 16) & 0xFF;
+    data[3] = value >> 24;
+}
+
+// default constructor
+FrameRecorder::FrameRecorder(uint16_t width, uint16_t height, uint8_t brightnessLimit, bool inCubeMode)
+    : FrameStreamRenderer(width, height, brightnessLimit, inCubeMode), file(NULL), framePeriod(0), startTime(0),
+      frameTime(0), lastFrameTime(0), sleepTime(0), framesShown(0), framesRecorded(0)
+{
+    //Playback always starts from the first frame, so only that needs to be a keyframe
+    setKeyframeInterval(0);
+    //Larger packets than a network takes mean less space is spent on packet headers
+    setMaxPacketSize(8192);
+} //FrameRecorder
+
+// default destructor
+FrameRecorder::~FrameRecorder()
+{
+    close();
+} //~FrameRecorder
+
+//Start a new recording, replacing any file already at the path
+void FrameRecorder::open(const char* path)
+{
+    close();
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        throw std::runtime_error("Could not open recording file.");
+    }
+    framesShown = 0;
+    framesRecorded = 0;
+    frameTime = 0;
+    lastFrameTime = 0;
+    sleepTime = 0;
+    writeHeader(0);
+
+    //Recordings must start with the whole grid
+    requestKeyframe();
+}
+
+//Finish the recording, filling in the number of frames and how long the last frame is shown for
+void FrameRecorder::close()
+{
+    if (file == NULL) {
+        return;
+    }
+    uint64_t endTime = (framesShown > 0) ? timeNow() : 0;
+    uint64_t lastPeriod = (framesRecorded > 0) ? endTime - lastFrameTime : 0;
+    if (lastPeriod == 0) {
+        lastPeriod = framePeriod;
+    }
+    if (lastPeriod > 0xFFFFFFFF) {
+        lastPeriod = 0xFFFFFFFF;
+    }
+    fseek(file, 0, SEEK_SET);
+    writeHeader(lastPeriod);
+    fclose(file);
+    file = NULL;
+}
+
+/* Record frames as if they were shown this many microseconds apart, rather than timing them by the
+ * clock. Delays from msSleep are added to the time without sleeping, so animations can be recorded
+ * faster than they run. Set to zero to time frames by the clock.
+ */
+void FrameRecorder::setFramePeriod(uint32_t period)
+{
+    framePeriod = period;
+}
+
+//Number of frames written to the file (frames with no changes are not stored)
+uint32_t FrameRecorder::getFramesRecorded()
+{
+    return framesRecorded;
+}
+
+void FrameRecorder::showPixels()
+{
+    if ( (framesShown == 0) && (framePeriod == 0) ) {
+        startTime = FrameScheduler::now();
+    }
+    frameTime = timeNow();
+    FrameStreamRenderer::showPixels();
+    framesShown++;
+}
+
+void FrameRecorder::msSleep(int delay_ms)
+{
+    if (framePeriod > 0) {
+        sleepTime += (uint64_t)delay_ms * 1000;
+    }
+    else {
+        usleep(delay_ms * 1000);
+    }
+}
+
+void FrameRecorder::outputMessage(char msg[])
+{
+    fprintf(stderr, "%s", msg);
+}
+
+//Store a packet, along with the time since the last frame when it starts a new one
+bool FrameRecorder::sendPacket(const uint8_t* data, uint16_t length)
+{
+    if (file == NULL) {
+        return false;
+    }
+    uint32_t delay = 0;
+    if (data[3] & STREAM_FRAME_START) {
+        uint64_t sinceLast = frameTime - lastFrameTime;
+        delay = (sinceLast > 0xFFFFFFFF) ? 0xFFFFFFFF : sinceLast;
+        lastFrameTime = frameTime;
+    }
+    uint8_t header[FRAME_RECORDING_PACKET_HEADER_SIZE];
+    putValue32(header, delay);
+    header[4] = length & 0xFF;
+    header[5] = length >> 8;
+    if ( (fwrite(header, sizeof(header), 1, file) != 1) || (fwrite(data, length, 1, file) != 1) ) {
+        //Only report the first failure, as it is likely to keep happening
+        if (getFailedPackets() == 0) {
+            char msg[] = "Could not write to recording file\n";
+            outputMessage(msg);
+        }
+        return false;
+    }
+    if (data[3] & STREAM_FRAME_END) {
+        framesRecorded++;
+    }
+    return true;
+}
+
+//Microseconds from the first frame, by the clock or by the fixed frame period
+uint64_t FrameRecorder::timeNow()
+{
+    if (framePeriod > 0) {
+        return (uint64_t)framesShown * framePeriod + sleepTime;
+    }
+    return FrameScheduler::now() - startTime;
+}
+
+void FrameRecorder::writeHeader(uint32_t lastPeriod)
+{
+    uint8_t header[FRAME_RECORDING_HEADER_SIZE];
+    header[0] = 'R';
+    header[1] = 'M';
+    header[2] = 'F';
+    header[3] = 'R';
+    header[4] = FRAME_RECORDING_VERSION & 0xFF;
+    header[5] = FRAME_RECORDING_VERSION >> 8;
+    header[6] = gridWidth & 0xFF;
+    header[7] = gridWidth >> 8;
+    header[8] = gridHeight & 0xFF;
+    header[9] = gridHeight >> 8;
+    header[10] = 0;
+    header[11] = 0;
+    putValue32(&header[12], framesRecorded);
+    putValue32(&header[16], lastPeriod);
+    fwrite(header, sizeof(header), 1, file);
+}
+#endif
+
+// default constructor
+FramePlayer::FramePlayer(RGBMatrixRenderer &renderer_, int16_t offsetX_, int16_t offsetY_)
+    : FrameStreamReceiver(renderer_, offsetX_, offsetY_), scheduler(renderer_, 33333), data(NULL), dataLength(0),
+      position(0), frameCount(0), lastFramePeriod(0), playing(false)
+#if !defined(ARDUINO)
+      , mapped(NULL)
+#endif
+{
+} //FramePlayer
+
+// default destructor
+FramePlayer::~FramePlayer()
+{
+    close();
+} //~FramePlayer
+
+#if !defined(ARDUINO)
+//Map a recording file into memory and play it from the start
+void FramePlayer::open(const char* path)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open recording file.");
+    }
+    struct stat info;
+    void* fileData = MAP_FAILED;
+    if ( (fstat(fd, &info) == 0) && (info.st_size >= FRAME_RECORDING_HEADER_SIZE) && (info.st_size <= 0xFFFFFFFF) ) {
+        fileData = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (fileData == MAP_FAILED) {
+        throw std::invalid_argument("Not a frame recording.");
+    }
+    //Frames are read through once from start to end
+    madvise(fileData, info.st_size, MADV_SEQUENTIAL);
+    try {
+        openData((const uint8_t*)fileData, info.st_size);
+    }
+    catch (...) {
+        munmap(fileData, info.st_size);
+        throw;
+    }
+    mapped = fileData;
+}
+#endif
+
+//Play a recording held in memory, which must stay in place until the player is closed
+void FramePlayer::openData(const uint8_t* recording, uint32_t length)
+{
+    close();
+    if ( (length < FRAME_RECORDING_HEADER_SIZE) || (recording[0] != 'R') || (recording[1] != 'M')
+      || (recording[2] != 'F') || (recording[3] != 'R') || (recording[4] != FRAME_RECORDING_VERSION) || (recording[5] != 0) ) {
+        throw std::invalid_argument("Not a frame recording.");
+    }
+    data = recording;
+    dataLength = length;
+    frameCount = readValue32(&recording[12]);
+    lastFramePeriod = readValue32(&recording[16]);
+    playing = false;
+    rewind();
+}
+
+void FramePlayer::close()
+{
+#if !defined(ARDUINO)
+    if (mapped != NULL) {
+        munmap(mapped, dataLength);
+        mapped = NULL;
+    }
+#endif
+    data = NULL;
+    dataLength = 0;
+    position = 0;
+    frameCount = 0;
+}
+
+/* Go back to the first frame. When playing in a loop, the first frame is still shown after the last
+ * one has been on for as long as it was recorded.
+ */
+void FramePlayer::rewind()
+{
+    position = FRAME_RECORDING_HEADER_SIZE;
+    restart();
+}
+
+/* Show the next frame of the recording, first waiting until it is due when wait is set (otherwise
+ * frames are shown as fast as they can be drawn). Returns false at the end of the recording.
+ */
+bool FramePlayer::playFrame(bool wait)
+{
+    if ( (data == NULL) || (position + FRAME_RECORDING_PACKET_HEADER_SIZE > dataLength) ) {
+        return false;
+    }
+    uint32_t end = nextFrame(position);
+
+    if (wait) {
+        //The scheduler is set for the time until the frame after this one is due
+        uint32_t period = lastFramePeriod;
+        if (end + FRAME_RECORDING_PACKET_HEADER_SIZE <= dataLength) {
+            period = readValue32(&data[end]);
+        }
+        scheduler.setFramePeriod(period > 0 ? period : 1);
+        if (playing) {
+            scheduler.waitForFrame();
+        }
+        else {
+            scheduler.start();
+        }
+    }
+    playing = true;
+
+    while (position + FRAME_RECORDING_PACKET_HEADER_SIZE <= end) {
+        uint16_t length = (uint16_t)data[position + 4] | ((uint16_t)data[position + 5] << 8);
+        if (position + FRAME_RECORDING_PACKET_HEADER_SIZE + length > end) {
+            break;
+        }
+        applyPacket(&data[position + FRAME_RECORDING_PACKET_HEADER_SIZE], length);
+        position += FRAME_RECORDING_PACKET_HEADER_SIZE + length;
+    }
+    position = end;
+    return true;
+}
+
+//Number of frames in the recording
+uint32_t FramePlayer::getFrameCount()
+{
+    return frameCount;
+}
+
+//Offset of the frame after the one starting at pos (the end of the data if it was cut short)
+uint32_t FramePlayer::nextFrame(uint32_t pos)
+{
+    while (pos + FRAME_RECORDING_PACKET_HEADER_SIZE <= dataLength) {
+        uint16_t length = (uint16_t)data[pos + 4] | ((uint16_t)data[pos + 5] << 8);
+        uint32_t next = pos + FRAME_RECORDING_PACKET_HEADER_SIZE + length;
+        if (next > dataLength) {
+            break;
+        }
+        if ( (length >= FRAME_STREAM_HEADER_SIZE) && (data[pos + FRAME_RECORDING_PACKET_HEADER_SIZE + 3] & STREAM_FRAME_END) ) {
+            return next;
+        }
+        pos = next;
+    }
+    return dataLength;
+}
@@ -0,0 +1,116 @@
+/**************************************************************************************************
+ * Frame recording and playback
+ *
+ * FrameRecorder is a renderer which writes frames to a file, as the frame stream described in
+ * frameStream.h. Only the pixels which changed in each frame are stored, as palette ids, so
+ * recordings of whole animations stay small. Animations can be recorded by running them on the
+ * recorder directly, or by mirroring the output of the renderer they are shown on (see
+ * RGBMatrixRenderer::setMirror).
+ *
+ * FramePlayer plays a recording back on any renderer at the rate it was recorded. Playback just
+ * copies the stored pixels to the display, so takes very little CPU time compared to running the
+ * animation again. Recordings are mapped into memory rather than read in, so long recordings do
+ * not need to fit in RAM. On microcontrollers, recordings can be played from memory (e.g. an array
+ * in flash).
+ *
+ * File format (all values little endian). A 20 byte header:
+ *   'R','M','F','R', version (16 bit), grid width (16 bit), grid height (16 bit), reserved (16 bit),
+ *   number of frames (32 bit), time the last frame is shown for in microseconds (32 bit)
+ * followed by each packet of the frame stream, stored as the time in microseconds since the frame
+ * before (32 bit, zero for packets after the first in a frame), the length of the packet (16 bit)
+ * and then the packet.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "frameStream.h"
+#include "frameScheduler.h"
+
+#define FRAME_RECORDING_VERSION 1
+#define FRAME_RECORDING_HEADER_SIZE 20
+#define FRAME_RECORDING_PACKET_HEADER_SIZE 6
+
+#if !defined(ARDUINO)
+class FrameRecorder : public FrameStreamRenderer
+{
+    //variables
+    public:
+    protected:
+    private:
+        FILE* file;
+        uint32_t framePeriod; //Microseconds per frame when recording at a fixed rate (0 to time frames by the clock)
+        FrameTime startTime;
+        uint64_t frameTime; //Time of the frame being recorded, in microseconds from the start of the recording
+        uint64_t lastFrameTime; //Time of the last frame written to the file
+        uint64_t sleepTime; //Time spent in msSleep when recording at a fixed rate
+        uint32_t framesShown;
+        uint32_t framesRecorded;
+
+    //functions
+    public:
+        FrameRecorder(uint16_t, uint16_t, uint8_t=255, bool=false);
+        virtual ~FrameRecorder();
+        void open(const char*);
+        void close();
+        void setFramePeriod(uint32_t);
+        uint32_t getFramesRecorded();
+        void showPixels();
+        void msSleep(int);
+        void outputMessage(char[]);
+    protected:
+        bool sendPacket(const uint8_t*, uint16_t);
+    private:
+        uint64_t timeNow();
+        void writeHeader(uint32_t);
+
+}; //FrameRecorder
+#endif
+
+class FramePlayer : public FrameStreamReceiver
+{
+    //variables
+    public:
+    protected:
+    private:
+        FrameScheduler scheduler;
+        const uint8_t* data;
+        uint32_t dataLength;
+        uint32_t position; //Offset in data of the next frame to play
+        uint32_t frameCount;
+        uint32_t lastFramePeriod; //Time the last frame is shown for
+        bool playing; //Cleared at the start of the recording, so the first frame is shown straight away
+#if !defined(ARDUINO)
+        void* mapped; //Recording mapped from a file, to be unmapped when closed
+#endif
+
+    //functions
+    public:
+        FramePlayer(RGBMatrixRenderer&, int16_t=0, int16_t=0);
+        ~FramePlayer();
+#if !defined(ARDUINO)
+        void open(const char*);
+#endif
+        void openData(const uint8_t*, uint32_t);
+        void close();
+        void rewind();
+        bool playFrame(bool=true);
+        uint32_t getFrameCount();
+    private:
+        uint32_t nextFrame(uint32_t);
+
+}; //FramePlayer
@@ -0,0 +1,247 @@
+/**************************************************************************************************
+ * Frame scheduler
+ *
+ * Paces animation frames against absolute deadlines, sleeping the thread between frames instead
+ * of spinning on the clock.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frameScheduler.h"
+#include <stdexcept>
+#if !defined(ARDUINO)
+#include <errno.h>
+#include <time.h>
+#endif
+
+// default constructor
+FrameScheduler::FrameScheduler(RGBMatrixRenderer &renderer_, uint32_t framePeriod_, uint32_t stepPeriod_)
+    : renderer(renderer_), maxStepsPerFrame(4), started(false), deadline(0), lastFrameStart(0), stepBacklog(0),
+      frameCount(0), missedFrames(0), reportFrames(0), reportMissed(0), reportWorstLate(0)
+{
+    setFramePeriod(framePeriod_);
+    stepPeriod = stepPeriod_;
+
+    //Report missed deadlines about once a second
+    reportInterval = 1000000 / framePeriod;
+    if (reportInterval == 0) {
+        reportInterval = 1;
+    }
+} //FrameScheduler
+
+//Set time between frames in microseconds
+void FrameScheduler::setFramePeriod(uint32_t period)
+{
+    if (period == 0) {
+        throw std::invalid_argument("Frame period must be greater than zero.");
+    }
+    framePeriod = period;
+    frameMicros = period;
+}
+
+void FrameScheduler::setFrameRate(uint16_t framesPerSecond)
+{
+    if (framesPerSecond == 0) {
+        throw std::invalid_argument("Frame rate must be greater than zero.");
+    }
+    setFramePeriod(1000000 / framesPerSecond);
+}
+
+/* Set simulated time in microseconds for each step of the animation, independent of the frame rate.
+ * waitForFrame then returns the number of steps due for the time since the last frame, up to
+ * maxSteps. Time beyond that is dropped so the animation slows down rather than falling further
+ * behind when frames take too long. Set to zero to run one step per frame.
+ */
+void FrameScheduler::setStepPeriod(uint32_t period, uint16_t maxSteps)
+{
+    stepPeriod = period;
+    maxStepsPerFrame = maxSteps;
+    stepBacklog = 0;
+}
+
+//Set number of frames between reports of missed deadlines (0 turns reports off)
+void FrameScheduler::setReportInterval(uint16_t frames)
+{
+    reportInterval = frames;
+    reportFrames = 0;
+}
+
+//Start timing from now, so the first frame is due one frame period later
+void FrameScheduler::start()
+{
+    lastFrameStart = now();
+    deadline = lastFrameStart + framePeriod;
+    frameMicros = framePeriod;
+    stepBacklog = 0;
+    started = true;
+}
+
+/* Sleep until the next frame is due, and return the number of simulation steps to run for it.
+ * When a deadline has already passed, the frame is counted as missed and the following deadline
+ * is set from now, so late frames are dropped rather than run back to back to catch up.
+ */
+uint16_t FrameScheduler::waitForFrame()
+{
+    if (!started) {
+        start();
+    }
+
+    FrameTime frameStart;
+    int32_t remaining = timeUntil(deadline);
+    if (remaining >= 0) {
+        {
+            PROFILE_SCOPE(renderer, PROFILE_SLEEP);
+            sleepUntil(deadline);
+        }
+        //Time from the deadline rather than when the thread woke, so wake up delays do not build up
+        frameStart = deadline;
+        deadline += framePeriod;
+    }
+    else {
+        missedFrames++;
+        reportMissed++;
+        if ((uint32_t)-remaining > reportWorstLate) {
+            reportWorstLate = -remaining;
+        }
+        frameStart = now();
+        deadline = frameStart + framePeriod;
+    }
+    frameMicros = frameStart - lastFrameStart;
+    lastFrameStart = frameStart;
+    frameCount++;
+
+    if (reportInterval > 0) {
+        reportFrames++;
+        if (reportFrames >= reportInterval) {
+            if (reportMissed > 0) {
+                char msg[80];
+                sprintf(msg, "Missed %u of %u frame deadlines, up to %lu us late\n",
+                    reportMissed, reportFrames, (unsigned long)reportWorstLate);
+                renderer.outputMessage(msg);
+            }
+            reportFrames = 0;
+            reportMissed = 0;
+            reportWorstLate = 0;
+        }
+    }
+
+    if (stepPeriod == 0) {
+        return 1;
+    }
+    stepBacklog += frameMicros;
+    uint32_t steps = stepBacklog / stepPeriod;
+    if (steps > maxStepsPerFrame) {
+        steps = maxStepsPerFrame;
+        stepBacklog = stepBacklog % stepPeriod;
+    }
+    else {
+        stepBacklog -= steps * stepPeriod;
+    }
+    return steps;
+}
+
+/* Sleep for a number of milliseconds outside the frame timing (e.g. to hold a pattern on screen).
+ * Deadlines are moved on by the pause, so it is not counted as missed frames or simulated time.
+ */
+void FrameScheduler::pause(uint32_t ms)
+{
+    if (!started) {
+        start();
+    }
+
+    FrameTime pauseStart = now();
+    uint32_t us = ms * 1000;
+    if (timeUntil(deadline) < 0) {
+        deadline = pauseStart;
+    }
+    deadline += us;
+    lastFrameStart += us;
+    {
+        PROFILE_SCOPE(renderer, PROFILE_SLEEP);
+        sleepUntil(pauseStart + us);
+    }
+}
+
+//Microseconds between the starts of the last two frames
+uint32_t FrameScheduler::getFrameMicros()
+{
+    return frameMicros;
+}
+
+uint32_t FrameScheduler::getFrameCount()
+{
+    return frameCount;
+}
+
+uint32_t FrameScheduler::getMissedFrames()
+{
+    return missedFrames;
+}
+
+//Current time in microseconds
+FrameTime FrameScheduler::now()
+{
+#if defined(ARDUINO)
+    return micros();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (FrameTime)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+//Microseconds until a time (negative once it has passed)
+int32_t FrameScheduler::timeUntil(FrameTime t)
+{
+#if defined(ARDUINO)
+    return (int32_t)(t - now());
+#else
+    int64_t diff = (int64_t)(t - now());
+    if (diff > INT32_MAX) {
+        return INT32_MAX;
+    }
+    if (diff < INT32_MIN) {
+        return INT32_MIN;
+    }
+    return diff;
+#endif
+}
+
+/* Sleep until an absolute time. On Linux this is a single absolute timer sleep, so time spent
+ * before the call does not delay the wake up. Microcontrollers sleep whole milliseconds using
+ * delay (which lets other tasks run) and wait out the remainder with delayMicroseconds.
+ */
+void FrameScheduler::sleepUntil(FrameTime t)
+{
+#if defined(ARDUINO)
+    int32_t remaining;
+    while ((remaining = timeUntil(t)) > 0) {
+        if (remaining >= 2000) {
+            delay(remaining / 1000 - 1);
+        }
+        else {
+            delayMicroseconds(remaining);
+        }
+    }
+#else
+    struct timespec ts;
+    ts.tv_sec = t / 1000000;
+    ts.tv_nsec = (t % 1000000) * 1000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        //Interrupted by a signal, so go back to sleep until the deadline
+    }
+#endif
+}
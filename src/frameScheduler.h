@@ -0,0 +1,89 @@
+/**************************************************************************************************
+ * Frame scheduler
+ *
+ * Paces animation frames against absolute deadlines, sleeping the thread between frames instead
+ * of spinning on the clock. Time spent drawing a frame does not add on to the frame period, and
+ * frames which miss their deadline are counted and reported through the renderer outputMessage.
+ *
+ * The simulation timestep can be set separately from the display frame rate, in which case each
+ * frame reports how many simulation steps are due so the animation speed does not depend on how
+ * fast the display can be updated.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#if defined(ARDUINO) && ARDUINO >= 100
+#include "Arduino.h"
+#elif defined(ARDUINO)
+#include "WProgram.h"
+#else
+#include <stdint.h>
+#endif
+
+#include "RGBMatrixRenderer.h"
+
+/* Times are kept in microseconds. Microcontrollers use the wrapping 32 bit micros() counter, so only
+ * differences between times are used there.
+ */
+#if defined(ARDUINO)
+typedef uint32_t FrameTime;
+#else
+typedef uint64_t FrameTime;
+#endif
+
+class FrameScheduler
+{
+    //variables
+    public:
+    protected:
+    private:
+        RGBMatrixRenderer& renderer;
+        uint32_t framePeriod; //Microseconds between frame deadlines
+        uint32_t stepPeriod; //Microseconds of simulation per step (0 to run one step per frame)
+        uint16_t maxStepsPerFrame; //Limit on steps run to catch up after a slow frame
+        bool started;
+        FrameTime deadline; //Time the next frame is due
+        FrameTime lastFrameStart;
+        uint32_t frameMicros; //Time between the starts of the last two frames
+        uint32_t stepBacklog; //Simulation time due but not yet run
+        uint32_t frameCount;
+        uint32_t missedFrames;
+        uint16_t reportInterval; //Frames between reports of missed deadlines (0 for no reports)
+        uint16_t reportFrames; //Frames since last report
+        uint16_t reportMissed; //Deadlines missed since last report
+        uint32_t reportWorstLate; //Microseconds the latest frame was late since last report
+
+    //functions
+    public:
+        FrameScheduler(RGBMatrixRenderer&, uint32_t, uint32_t=0);
+        void setFramePeriod(uint32_t);
+        void setFrameRate(uint16_t);
+        void setStepPeriod(uint32_t, uint16_t=4);
+        void setReportInterval(uint16_t);
+        void start();
+        uint16_t waitForFrame();
+        void pause(uint32_t);
+        uint32_t getFrameMicros();
+        uint32_t getFrameCount();
+        uint32_t getMissedFrames();
+        static FrameTime now();
+    private:
+        static int32_t timeUntil(FrameTime);
+        static void sleepUntil(FrameTime);
+
+}; //FrameScheduler
@@ -0,0 +1,526 @@
+/**************************************************************************************************
+ * Frame streams
+ *
+ * Renderer which encodes the pixels changed in each frame as a stream of packets, and a receiver
+ * which applies the packets to another renderer.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frameStream.h"
+#include <stdexcept>
+
+//Runs of at least this many pixels of one colour are sent as a fill, instead of an id for each pixel
+static const uint16_t FILL_MIN_RUN = 8;
+
+static uint16_t readValue(const uint8_t* data)
+{
+    return (uint16_t)data[0] | ((uint16_t)data[1] << 8);
+}
+
+// default constructor
+FrameStreamRenderer::FrameStreamRenderer(uint16_t width, uint16_t height, uint8_t brightnessLimit, bool inCubeMode)
+    : RGBMatrixRenderer(width, height, brightnessLimit, inCubeMode), packetLength(0), maxPacketSize(1400),
+      packetFlags(0), sequence(0), frameNumber(0), keyframeInterval(60), framesSinceKeyframe(0),
+      keyframePending(true), packetsSent(0), bytesSent(0), failedPackets(0)
+{
+    uint32_t pixels = (uint32_t)width * height;
+    frame = (RGB_colour*)allocateAligned(sizeof(RGB_colour) * pixels);
+    memset((void*)frame, 0, sizeof(RGB_colour) * pixels);
+    changed = (uint8_t*)allocateAligned((pixels + 7) / 8);
+    memset(changed, 0, (pixels + 7) / 8);
+    rowIds = new uint16_t[width];
+    streamPalette = new RGB_colour[FRAME_STREAM_MAX_COLOURS + 1];
+    streamIndex = new uint16_t[FRAME_STREAM_PALETTE_SIZE];
+    resetPalette();
+    packet = new uint8_t[maxPacketSize];
+} //FrameStreamRenderer
+
+// default destructor
+FrameStreamRenderer::~FrameStreamRenderer()
+{
+    freeAligned(frame);
+    freeAligned(changed);
+    delete [] rowIds;
+    delete [] streamPalette;
+    delete [] streamIndex;
+    delete [] packet;
+} //~FrameStreamRenderer
+
+//Set number of frames between keyframes, which receivers that lost packets wait for (0 to only send the first frame in full)
+void FrameStreamRenderer::setKeyframeInterval(uint16_t frames)
+{
+    keyframeInterval = frames;
+}
+
+//Send the whole grid in the next frame (e.g. when a new receiver is started)
+void FrameStreamRenderer::requestKeyframe()
+{
+    keyframePending = true;
+}
+
+/* Set the largest packet sent, in bytes. The default of 1400 fits in an ethernet frame along with
+ * UDP and IP headers, so packets streamed over a network are not split up on the way.
+ */
+void FrameStreamRenderer::setMaxPacketSize(uint16_t bytes)
+{
+    if (bytes < 64) {
+        throw std::invalid_argument("Stream packet size must be at least 64 bytes.");
+    }
+    delete [] packet;
+    packet = new uint8_t[bytes];
+    maxPacketSize = bytes;
+    packetLength = 0;
+}
+
+uint32_t FrameStreamRenderer::getPacketsSent()
+{
+    return packetsSent;
+}
+
+uint32_t FrameStreamRenderer::getBytesSent()
+{
+    return bytesSent;
+}
+
+uint32_t FrameStreamRenderer::getFailedPackets()
+{
+    return failedPackets;
+}
+
+//Pixels only go into the frame here, and are sent when the frame is shown
+void FrameStreamRenderer::setPixel(uint16_t x, uint16_t y, RGB_colour colour)
+{
+    writeSpan(x, y, 1, &colour);
+}
+
+//Mark pixels which differ from the frame, so full frame updates still only send what changed
+void FrameStreamRenderer::writeSpan(uint16_t x, uint16_t y, uint16_t count, const RGB_colour* colours)
+{
+    uint32_t index = (uint32_t)y * gridWidth + x;
+    for (uint16_t i=0; i<count; i++, index++) {
+        if ( (frame[index].r != colours[i].r) || (frame[index].g != colours[i].g) || (frame[index].b != colours[i].b) ) {
+            frame[index] = colours[i];
+            changed[index >> 3] |= 1 << (index & 7);
+        }
+    }
+}
+
+/* Send the pixels changed since the last frame, as runs along each row. Keyframes send every pixel,
+ * and start a new palette so receivers have every colour used by the frame.
+ */
+void FrameStreamRenderer::showPixels()
+{
+    uint32_t pixels = (uint32_t)gridWidth * gridHeight;
+    bool keyframe = keyframePending || ( (keyframeInterval > 0) && (framesSinceKeyframe >= keyframeInterval) );
+    if (keyframe) {
+        resetPalette();
+        memset(changed, 0xFF, (pixels + 7) / 8);
+        keyframePending = false;
+        framesSinceKeyframe = 0;
+    }
+    packetFlags = STREAM_FRAME_START | (keyframe ? STREAM_KEYFRAME : 0);
+
+    for (uint16_t y=0; y<gridHeight; y++) {
+        uint32_t rowStart = (uint32_t)y * gridWidth;
+        uint16_t x = 0;
+        while (x < gridWidth) {
+            uint32_t index = rowStart + x;
+            //Skip 8 unchanged pixels at a time
+            if ( ((index & 7) == 0) && (changed[index >> 3] == 0) && (x + 8 <= gridWidth) ) {
+                x += 8;
+            }
+            else if (changed[index >> 3] & (1 << (index & 7))) {
+                //Runs are kept short enough for all their colours to fit in the palette
+                uint16_t runStart = x;
+                while ( (x < gridWidth) && (x - runStart < FRAME_STREAM_MAX_COLOURS)
+                     && (changed[(rowStart + x) >> 3] & (1 << ((rowStart + x) & 7))) ) {
+                    x++;
+                }
+                sendRun(runStart, y, x - runStart);
+            }
+            else {
+                x++;
+            }
+        }
+    }
+    memset(changed, 0, (pixels + 7) / 8);
+
+    //Frames with no changes are not sent at all
+    if (packetLength > 0) {
+        flushPacket(true);
+        frameNumber++;
+    }
+    framesSinceKeyframe++;
+}
+
+//Forget all colours in the stream palette, so ids are given out from 1 again
+void FrameStreamRenderer::resetPalette()
+{
+    memset(streamIndex, 0, sizeof(uint16_t) * FRAME_STREAM_PALETTE_SIZE);
+    paletteCount = 0;
+    newColoursFrom = 1;
+}
+
+//Stream palette id for a colour, adding it to the palette if it is new
+uint16_t FrameStreamRenderer::getStreamId(RGB_colour colour)
+{
+    //Black is always zero
+    if ( (colour.r == 0) && (colour.g == 0) && (colour.b == 0) ) {
+        return 0;
+    }
+
+    uint32_t key = ((uint32_t)colour.r << 16) | ((uint32_t)colour.g << 8) | colour.b;
+    uint16_t slot = (uint16_t)((key * 2654435761u) >> 16) & (FRAME_STREAM_PALETTE_SIZE - 1);
+    while (streamIndex[slot] != 0) {
+        uint16_t i = streamIndex[slot];
+        if ( (streamPalette[i].r == colour.r) && (streamPalette[i].g == colour.g) && (streamPalette[i].b == colour.b) ) {
+            return i;
+        }
+        slot = (slot + 1) & (FRAME_STREAM_PALETTE_SIZE - 1);
+    }
+
+    //Room is made before each run, so the palette never fills up part way through one
+    paletteCount++;
+    streamPalette[paletteCount] = colour;
+    streamIndex[slot] = paletteCount;
+    return paletteCount;
+}
+
+/* Send a run of changed pixels as palette ids. Colours new to the palette are sent first, then the
+ * run is split into fills for long stretches of one colour and ids for the rest.
+ */
+void FrameStreamRenderer::sendRun(uint16_t x, uint16_t y, uint16_t count)
+{
+    //When the palette might not hold every colour in the run, start a new one. Receivers replace
+    //colours for ids as they are sent again, and pixels already sent keep their colours.
+    if ((uint32_t)paletteCount + count > FRAME_STREAM_MAX_COLOURS) {
+        resetPalette();
+    }
+
+    const RGB_colour* colours = &frame[(uint32_t)y * gridWidth + x];
+    for (uint16_t i=0; i<count; i++) {
+        rowIds[i] = getStreamId(colours[i]);
+    }
+    sendNewColours();
+
+    uint16_t literalStart = 0;
+    uint16_t i = 0;
+    while (i < count) {
+        uint16_t end = i + 1;
+        while ( (end < count) && (rowIds[end] == rowIds[i]) ) {
+            end++;
+        }
+        if (end - i >= FILL_MIN_RUN) {
+            if (i > literalStart) {
+                addLiteral(x + literalStart, y, &rowIds[literalStart], i - literalStart);
+            }
+            addFill(x + i, y, end - i, rowIds[i]);
+            literalStart = end;
+        }
+        i = end;
+    }
+    if (literalStart < count) {
+        addLiteral(x + literalStart, y, &rowIds[literalStart], count - literalStart);
+    }
+}
+
+//Send colours added to the palette since it was last sent
+void FrameStreamRenderer::sendNewColours()
+{
+    while (newColoursFrom <= paletteCount) {
+        uint16_t space = startRecord(STREAM_PALETTE, 4 + 3);
+        uint16_t count = (space - 4) / 3;
+        if (count > paletteCount - newColoursFrom + 1) {
+            count = paletteCount - newColoursFrom + 1;
+        }
+        putValue(newColoursFrom);
+        putValue(count);
+        for (uint16_t i=0; i<count; i++) {
+            RGB_colour colour = streamPalette[newColoursFrom + i];
+            packet[packetLength++] = colour.r;
+            packet[packetLength++] = colour.g;
+            packet[packetLength++] = colour.b;
+        }
+        newColoursFrom += count;
+    }
+}
+
+//Add ids for a run of pixels, using 8 bit ids when they are all small enough
+void FrameStreamRenderer::addLiteral(uint16_t x, uint16_t y, const uint16_t* ids, uint16_t count)
+{
+    uint8_t idBytes = 1;
+    for (uint16_t i=0; i<count; i++) {
+        if (ids[i] > 255) {
+            idBytes = 2;
+            break;
+        }
+    }
+
+    //Runs too long for the packet carry on in the next one
+    while (count > 0) {
+        uint16_t space = startRecord((idBytes == 1) ? STREAM_RUN8 : STREAM_RUN16, 6 + idBytes);
+        uint16_t fits = (space - 6) / idBytes;
+        if (fits > count) {
+            fits = count;
+        }
+        putValue(x);
+        putValue(y);
+        putValue(fits);
+        for (uint16_t i=0; i<fits; i++) {
+            if (idBytes == 1) {
+                packet[packetLength++] = (uint8_t)ids[i];
+            }
+            else {
+                putValue(ids[i]);
+            }
+        }
+        x += fits;
+        ids += fits;
+        count -= fits;
+    }
+}
+
+void FrameStreamRenderer::addFill(uint16_t x, uint16_t y, uint16_t count, uint16_t id)
+{
+    startRecord(STREAM_FILL, 8);
+    putValue(x);
+    putValue(y);
+    putValue(count);
+    putValue(id);
+}
+
+/* Add the type of a record to the packet, first sending the packet when there is not room for the
+ * type and at least the given number of bytes after it. Returns the bytes left after the type.
+ */
+uint16_t FrameStreamRenderer::startRecord(uint8_t type, uint16_t minBytes)
+{
+    if ( (packetLength > 0) && (packetLength + 1 + minBytes > maxPacketSize) ) {
+        flushPacket(false);
+    }
+    if (packetLength == 0) {
+        packet[0] = 'R';
+        packet[1] = 'M';
+        packet[2] = FRAME_STREAM_VERSION;
+        packet[3] = 0; //Flags are set when the packet is sent
+        packetLength = 4;
+        putValue(sequence);
+        putValue(frameNumber);
+        putValue(gridWidth);
+        putValue(gridHeight);
+    }
+    packet[packetLength++] = type;
+    return maxPacketSize - packetLength;
+}
+
+void FrameStreamRenderer::putValue(uint16_t value)
+{
+    packet[packetLength++] = value & 0xFF;
+    packet[packetLength++] = value >> 8;
+}
+
+//Send the packet built up so far. The sequence number moves on whether or not it went, so receivers see it as lost.
+void FrameStreamRenderer::flushPacket(bool frameEnd)
+{
+    packet[3] = packetFlags | (frameEnd ? STREAM_FRAME_END : 0);
+    if (sendPacket(packet, packetLength)) {
+        packetsSent++;
+        bytesSent += packetLength;
+    }
+    else {
+        failedPackets++;
+    }
+    sequence++;
+    packetFlags &= ~STREAM_FRAME_START;
+    packetLength = 0;
+}
+
+// default constructor
+FrameStreamReceiver::FrameStreamReceiver(RGBMatrixRenderer &renderer_, int16_t offsetX_, int16_t offsetY_)
+    : renderer(renderer_), offsetX(offsetX_), offsetY(offsetY_), started(false), synced(false),
+      expectedSequence(0), framesShown(0), lostPackets(0), badPackets(0)
+{
+    //Palette entries start out black, so ids the sender has not sent yet draw nothing
+    palette = new RGB_colour[FRAME_STREAM_MAX_COLOURS + 1];
+    spanBuffer = new RGB_colour[renderer.getGridWidth()];
+} //FrameStreamReceiver
+
+// default destructor
+FrameStreamReceiver::~FrameStreamReceiver()
+{
+    delete [] palette;
+    delete [] spanBuffer;
+} //~FrameStreamReceiver
+
+//Set the position in the stream grid shown at the bottom left of this renderer
+void FrameStreamReceiver::setOffset(int16_t x, int16_t y)
+{
+    offsetX = x;
+    offsetY = y;
+}
+
+//Forget the position in the stream, so the next keyframe is waited for (e.g. when a stream starts again)
+void FrameStreamReceiver::restart()
+{
+    started = false;
+    synced = false;
+}
+
+/* Apply a packet from the stream to the renderer, returning true when it completed a frame (which
+ * is then shown). Packets are ignored after any are lost, until the start of the next keyframe.
+ */
+bool FrameStreamReceiver::applyPacket(const uint8_t* data, uint16_t length)
+{
+    if ( (length < FRAME_STREAM_HEADER_SIZE) || (data[0] != 'R') || (data[1] != 'M') || (data[2] != FRAME_STREAM_VERSION) ) {
+        badPackets++;
+        return false;
+    }
+
+    uint8_t flags = data[3];
+    uint16_t sequence = readValue(&data[4]);
+    if (started) {
+        uint16_t missed = sequence - expectedSequence;
+        if (missed >= 0x8000) {
+            //Older than the last packet, so arrived out of order or twice
+            return false;
+        }
+        if (missed > 0) {
+            lostPackets += missed;
+            synced = false;
+        }
+    }
+    started = true;
+    expectedSequence = sequence + 1;
+
+    if (!synced) {
+        if ( ((flags & STREAM_KEYFRAME) == 0) || ((flags & STREAM_FRAME_START) == 0) ) {
+            return false;
+        }
+        synced = true;
+    }
+
+    if (!applyRecords(&data[FRAME_STREAM_HEADER_SIZE], length - FRAME_STREAM_HEADER_SIZE,
+            readValue(&data[8]), readValue(&data[10]))) {
+        badPackets++;
+        synced = false;
+        return false;
+    }
+
+    if (flags & STREAM_FRAME_END) {
+        renderer.presentFrame();
+        framesShown++;
+        return true;
+    }
+    return false;
+}
+
+//Apply each record in a packet, returning false if any run off the end of the packet or the stream grid
+bool FrameStreamReceiver::applyRecords(const uint8_t* data, uint16_t length, uint16_t streamWidth, uint16_t streamHeight)
+{
+    uint16_t pos = 0;
+    while (pos < length) {
+        uint8_t type = data[pos++];
+        if (type == STREAM_PALETTE) {
+            if (length - pos < 4) {
+                return false;
+            }
+            uint16_t first = readValue(&data[pos]);
+            uint16_t count = readValue(&data[pos + 2]);
+            pos += 4;
+            if ( (first == 0) || ((uint32_t)first + count > FRAME_STREAM_MAX_COLOURS + 1) || ((uint32_t)length - pos < (uint32_t)count * 3) ) {
+                return false;
+            }
+            for (uint16_t i=0; i<count; i++) {
+                palette[first + i] = RGB_colour(data[pos], data[pos + 1], data[pos + 2]);
+                pos += 3;
+            }
+        }
+        else if ( (type == STREAM_RUN8) || (type == STREAM_RUN16) || (type == STREAM_FILL) ) {
+            if (length - pos < 6) {
+                return false;
+            }
+            uint16_t x = readValue(&data[pos]);
+            uint16_t y = readValue(&data[pos + 2]);
+            uint16_t count = readValue(&data[pos + 4]);
+            pos += 6;
+            uint8_t idBytes = (type == STREAM_RUN8) ? 1 : ((type == STREAM_RUN16) ? 2 : 0);
+            uint32_t dataBytes = (idBytes == 0) ? 2 : (uint32_t)count * idBytes;
+            if ( ((uint32_t)length - pos < dataBytes) || (y >= streamHeight) || ((uint32_t)x + count > streamWidth) ) {
+                return false;
+            }
+            drawRun(x, y, count, &data[pos], idBytes);
+            pos += dataBytes;
+        }
+        else {
+            return false;
+        }
+    }
+    return true;
+}
+
+//Draw the part of a run of stream pixels which is on the renderer grid (idBytes is zero for a fill)
+void FrameStreamReceiver::drawRun(uint16_t x, uint16_t y, uint16_t count, const uint8_t* ids, uint8_t idBytes)
+{
+    int32_t gridX = (int32_t)x - offsetX;
+    int32_t gridY = (int32_t)y - offsetY;
+    if ( (gridY < 0) || (gridY >= renderer.getGridHeight()) ) {
+        return;
+    }
+    int32_t first = (gridX < 0) ? -gridX : 0;
+    int32_t end = count;
+    if (gridX + end > renderer.getGridWidth()) {
+        end = renderer.getGridWidth() - gridX;
+    }
+    if (first >= end) {
+        return;
+    }
+
+    for (int32_t i=first; i<end; i++) {
+        uint16_t id;
+        if (idBytes == 0) {
+            id = readValue(ids);
+        }
+        else if (idBytes == 1) {
+            id = ids[i];
+        }
+        else {
+            id = readValue(&ids[i * 2]);
+        }
+        spanBuffer[i - first] = (id <= FRAME_STREAM_MAX_COLOURS) ? palette[id] : RGB_colour(0,0,0);
+    }
+    renderer.setSpanInstant(gridX + first, gridY, end - first, spanBuffer);
+}
+
+uint32_t FrameStreamReceiver::getFramesShown()
+{
+    return framesShown;
+}
+
+uint32_t FrameStreamReceiver::getLostPackets()
+{
+    return lostPackets;
+}
+
+uint32_t FrameStreamReceiver::getBadPackets()
+{
+    return badPackets;
+}
+
+//Whether the receiver is showing the stream, rather than waiting for a keyframe after losing packets
+bool FrameStreamReceiver::isSynced()
+{
+    return synced;
+}
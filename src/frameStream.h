@@ -0,0 +1,159 @@
+/**************************************************************************************************
+ * Frame streams
+ *
+ * FrameStreamRenderer is a renderer which encodes frames as a stream of packets, instead of
+ * driving display hardware itself. Each frame only sends the pixels which changed since the last
+ * frame, so the size of the stream depends on how much of the display changes rather than on the
+ * size of the grid. Pixels are sent as ids into a palette which is sent along with them, in the
+ * same way the renderer image holds palette ids rather than colours. Classes derived from it send
+ * the packets on (see UDPStreamRenderer) or store them (see FrameRecorder).
+ *
+ * FrameStreamReceiver applies the packets to any other renderer, offset to a position in the stream
+ * grid so several displays can each show part of one large stream.
+ *
+ * Stream format (all values little endian). Each packet starts with a 12 byte header:
+ *   'R','M', version, flags, packet sequence (16 bit), frame number (16 bit),
+ *   stream grid width (16 bit), stream grid height (16 bit)
+ * followed by records, each starting with a one byte type:
+ *   STREAM_PALETTE: first id, count, then count RGB colours (3 bytes each)
+ *   STREAM_RUN8:    x, y, count, then count 8 bit palette ids for a run of pixels along a row
+ *   STREAM_RUN16:   x, y, count, then count 16 bit palette ids
+ *   STREAM_FILL:    x, y, count, 16 bit palette id to set a run of pixels to one colour
+ * where ids, coordinates and counts are 16 bits. Palette id zero is always black.
+ *
+ * Packets are numbered in sequence, so receivers can tell when a packet was lost. Keyframes send
+ * the whole grid and start a new palette, so receivers which lost packets (or which joined the
+ * stream late) pick up again from the next keyframe.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "RGBMatrixRenderer.h"
+
+/* Number of slots in the hash index used to look up stream palette ids. Must be a power of 2. The
+ * stream palette holds up to 3/4 of this many colours, after which a new palette is started.
+ * Streams must be encoded and decoded with the same size.
+ */
+#ifndef FRAME_STREAM_PALETTE_SIZE
+#if defined(ARDUINO)
+#define FRAME_STREAM_PALETTE_SIZE 2048
+#else
+#define FRAME_STREAM_PALETTE_SIZE 32768
+#endif
+#endif
+
+#define FRAME_STREAM_MAX_COLOURS (FRAME_STREAM_PALETTE_SIZE / 4 * 3)
+#define FRAME_STREAM_VERSION 1
+#define FRAME_STREAM_HEADER_SIZE 12
+
+enum StreamFlags {
+    STREAM_KEYFRAME = 1, //Packet is part of a keyframe, which starts a new palette and sends every pixel
+    STREAM_FRAME_START = 2, //First packet of a frame
+    STREAM_FRAME_END = 4, //Last packet of a frame, so the receiver shows the frame
+};
+
+enum StreamRecords { STREAM_PALETTE = 1, STREAM_RUN8, STREAM_RUN16, STREAM_FILL };
+
+class FrameStreamRenderer : public RGBMatrixRenderer
+{
+    //variables
+    public:
+    protected:
+    private:
+        RGB_colour* frame; // Colour of each pixel in the frame being streamed
+        uint8_t* changed; // Bitmap of pixels changed since they were last sent
+        uint16_t* rowIds; // Stream palette ids for a run of changed pixels
+        RGB_colour* streamPalette; // Stream palette, which receivers are sent as colours are first used
+        uint16_t* streamIndex; // Hash table of stream palette ids keyed on colour (zero marks an empty slot)
+        uint16_t paletteCount; // Ids 1 to paletteCount are in use
+        uint16_t newColoursFrom; // First id not yet sent to receivers
+        uint8_t* packet;
+        uint16_t packetLength;
+        uint16_t maxPacketSize;
+        uint8_t packetFlags;
+        uint16_t sequence;
+        uint16_t frameNumber;
+        uint16_t keyframeInterval; // Frames between keyframes (0 for only the first frame)
+        uint16_t framesSinceKeyframe;
+        bool keyframePending;
+        uint32_t packetsSent;
+        uint32_t bytesSent;
+        uint32_t failedPackets;
+
+    //functions
+    public:
+        FrameStreamRenderer(uint16_t, uint16_t, uint8_t=255, bool=false);
+        virtual ~FrameStreamRenderer();
+        void setKeyframeInterval(uint16_t);
+        void requestKeyframe();
+        void setMaxPacketSize(uint16_t);
+        uint32_t getPacketsSent();
+        uint32_t getBytesSent();
+        uint32_t getFailedPackets();
+        void showPixels();
+    protected:
+        virtual bool sendPacket(const uint8_t*, uint16_t) = 0;
+    private:
+        void setPixel(uint16_t, uint16_t, RGB_colour);
+        void writeSpan(uint16_t, uint16_t, uint16_t, const RGB_colour*);
+        void resetPalette();
+        uint16_t getStreamId(RGB_colour);
+        void sendRun(uint16_t, uint16_t, uint16_t);
+        void sendNewColours();
+        void addLiteral(uint16_t, uint16_t, const uint16_t*, uint16_t);
+        void addFill(uint16_t, uint16_t, uint16_t, uint16_t);
+        uint16_t startRecord(uint8_t, uint16_t);
+        void putValue(uint16_t);
+        void flushPacket(bool);
+
+}; //FrameStreamRenderer
+
+class FrameStreamReceiver
+{
+    //variables
+    public:
+    protected:
+    private:
+        RGBMatrixRenderer& renderer;
+        int16_t offsetX; // Position in the stream grid of the bottom left pixel of the renderer grid
+        int16_t offsetY;
+        RGB_colour* palette; // Colours for each stream palette id
+        RGB_colour* spanBuffer; // One row of colours, used to send runs of pixels to the renderer
+        bool started; // Set once the first packet arrives
+        bool synced; // Cleared when packets are lost, until the next keyframe starts
+        uint16_t expectedSequence;
+        uint32_t framesShown;
+        uint32_t lostPackets;
+        uint32_t badPackets;
+
+    //functions
+    public:
+        FrameStreamReceiver(RGBMatrixRenderer&, int16_t=0, int16_t=0);
+        virtual ~FrameStreamReceiver();
+        void setOffset(int16_t, int16_t);
+        bool applyPacket(const uint8_t*, uint16_t);
+        void restart();
+        uint32_t getFramesShown();
+        uint32_t getLostPackets();
+        uint32_t getBadPackets();
+        bool isSynced();
+    private:
+        bool applyRecords(const uint8_t*, uint16_t, uint16_t, uint16_t);
+        void drawRun(uint16_t, uint16_t, uint16_t, const uint8_t*, uint8_t);
+
+}; //FrameStreamReceiver
@@ -35,11 +35,16 @@ GameOfLife::GameOfLife(RGBMatrixRenderer &renderer_, uint8_t fadeSteps_, uint16_
     : renderer(renderer_)
 {
   // Allocate memory
-  cells = new uint8_t *[renderer.getGridWidth()];
-  for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
-  {
-    cells[x] = new uint8_t[renderer.getGridHeight()];
-  }
+  uint32_t cellCount = (uint32_t)renderer.getGridWidth() * renderer.getGridHeight();
+#if defined(RGB_MATRIX_FIXED_SIZE)
+  cells = cellStore;
+  nextCells = nextCellStore;
+#else
+  cells = (uint8_t *)RGBMatrixRenderer::allocateAligned(cellCount);
+  nextCells = (uint8_t *)RGBMatrixRenderer::allocateAligned(cellCount);
+#endif
+  memset(cells, 0, cellCount);
+  memset(nextCells, 0, cellCount);
 
   // Initialise member variables
   fadeSteps = fadeSteps_;
@@ -66,38 +71,71 @@ GameOfLife::GameOfLife(RGBMatrixRenderer &renderer_, uint8_t fadeSteps_, uint16_
     patternRepeatY = patternRepeatY_;
   }
 
-  cellColours = new RGB_colour[8];
+  cellColours = (RGB_colour *)RGBMatrixRenderer::allocateAligned(sizeof(RGB_colour) * 8);
+
+  // Buffer for a row of cell colours drawn during fades
+  rowColours = (RGB_colour *)RGBMatrixRenderer::allocateAligned(sizeof(RGB_colour) * renderer.getGridWidth());
+  if (fadeSteps > 1)
+  {
+    bornRamp = (RGB_colour *)RGBMatrixRenderer::allocateAligned(sizeof(RGB_colour) * 8 * (fadeSteps + 1));
+    diedRamp = (RGB_colour *)RGBMatrixRenderer::allocateAligned(sizeof(RGB_colour) * 8 * (fadeSteps + 1));
+    fadeCells = (uint32_t *)RGBMatrixRenderer::allocateAligned(sizeof(uint32_t) * cellCount);
+  }
 
   panelSize = renderer.getGridHeight();
   if (renderer.getGridWidth() < panelSize)
     panelSize = renderer.getGridWidth();
 
+  // Arrays for tracking which tiles of the grid are active
+  tilesX = (renderer.getGridWidth() + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+  tilesY = (renderer.getGridHeight() + (1 << TILE_SHIFT) - 1) >> TILE_SHIFT;
+  uint32_t tiles = (uint32_t)tilesX * tilesY;
+  tileQuiet = (uint8_t *)RGBMatrixRenderer::allocateAligned(tiles);
+  tileChanges = (uint8_t *)RGBMatrixRenderer::allocateAligned(tiles);
+  tileActive = (uint8_t *)RGBMatrixRenderer::allocateAligned(tiles);
+  tileRowActive = (uint8_t *)RGBMatrixRenderer::allocateAligned(tilesY);
+  resetTiles();
+
 } // GameOfLife
 
 // default destructor
 GameOfLife::~GameOfLife()
 {
-  for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
-  {
-    delete[] cells[x];
-  }
-  delete[] cells;
-  delete[] cellColours;
+#if !defined(RGB_MATRIX_FIXED_SIZE)
+  RGBMatrixRenderer::freeAligned(cells);
+  RGBMatrixRenderer::freeAligned(nextCells);
+#endif
+  RGBMatrixRenderer::freeAligned(cellColours);
+  RGBMatrixRenderer::freeAligned(rowColours);
+  RGBMatrixRenderer::freeAligned(bornRamp);
+  RGBMatrixRenderer::freeAligned(diedRamp);
+  RGBMatrixRenderer::freeAligned(fadeCells);
+  RGBMatrixRenderer::freeAligned(aliveBits);
+  RGBMatrixRenderer::freeAligned(changeBits);
+  RGBMatrixRenderer::freeAligned(westBits);
+  RGBMatrixRenderer::freeAligned(eastBits);
+  RGBMatrixRenderer::freeAligned(tileQuiet);
+  RGBMatrixRenderer::freeAligned(tileChanges);
+  RGBMatrixRenderer::freeAligned(tileActive);
+  RGBMatrixRenderer::freeAligned(tileRowActive);
+#if defined(GAME_OF_LIFE_THREADS)
+  stopWorkers();
+#endif
 } //~GameOfLife
 
 void GameOfLife::runCycle()
 {
-  int16_t x, y, xt, yt, xi, yi, neighbours;
+  PROFILE_FRAME(renderer);
   uint8_t maxRepeatsCount, maxContributor;
 
-  // Get highest repeating frame count for repeating patterns > 5 frames
+  // Get highest repeating frame count for repeating patterns of 4 or more frames
   maxRepeatsCount = 0;
   maxContributor = 0;
-  for (int8_t i = 4; i < maxRepeatCycle; ++i)
+  for (int8_t i = 3; i < maxRepeatCycle; ++i)
   {
-    if (unchangedPopulation[i] > maxRepeatsCount)
+    if (repeatCount[i] > maxRepeatsCount)
     {
-      maxRepeatsCount = unchangedPopulation[i];
+      maxRepeatsCount = repeatCount[i];
       maxContributor = i;
     }
   }
@@ -110,9 +148,9 @@ void GameOfLife::runCycle()
    *  - Population remains constant at 5 cells for 4xPanel size consecutive frames (gliding pattern)
    *  - Population remains constant at >5 cells 10xPanel size frames (as glider may collide with something)
    *  - Population cycles over a 4 step cycle for over 3xPanel size frames
-   *  - Pattern cycles over 6-24 frames for over 200 cycles
+   *  - Pattern cycles over 4-24 frames for over 200 cycles
    */
-  if (startOver || (alive == 0) || (unchangedCount > 5) || (repeat2Count > 6) || (repeat3Count > 35) || (unchangedPopulation[0] > panelSize * 10) || ((unchangedPopulation[0] > panelSize * 4) && (alive == 5)) || (unchangedPopulation[3] > panelSize * 3) || (maxRepeatsCount > 200))
+  if (startOver || (alive == 0) || (unchangedCount > 5) || (repeatCount[1] > 6) || (repeatCount[2] > 35) || (unchangedPopulation > panelSize * 10) || ((unchangedPopulation > panelSize * 4) && (alive == 5)) || (cyclePopulation > panelSize * 3) || (maxRepeatsCount > 200))
   {
     // Update min and max iterations counters
     if (iterations > 0)
@@ -128,25 +166,25 @@ void GameOfLife::runCycle()
       sprintf(msgEnd, "All died\n");
     else if (unchangedCount > 5)
       sprintf(msgEnd, "Static pattern for 5 frames\n");
-    else if (repeat2Count > 6)
+    else if (repeatCount[1] > 6)
       sprintf(msgEnd, "Pattern repeated over 2 frames\n");
-    else if (repeat3Count > 35)
+    else if (repeatCount[2] > 35)
       sprintf(msgEnd, "Pattern repeated over 3 frames\n");
-    else if (unchangedPopulation[0] > panelSize * 10)
+    else if (unchangedPopulation > panelSize * 10)
     {
       sprintf(msgEnd, "Population static over %d frames\n", (panelSize * 10));
     }
-    else if ((unchangedPopulation[0] > panelSize * 4) && (alive == 5))
+    else if ((unchangedPopulation > panelSize * 4) && (alive == 5))
     {
       sprintf(msgEnd, "Population static over %d frames with 5 cells exactly\n", (panelSize * 4));
     }
-    else if (unchangedPopulation[3] > panelSize * 3)
+    else if (cyclePopulation > panelSize * 3)
     {
       sprintf(msgEnd, "Population repeated over 4 step cycle %d x\n", (panelSize * 3));
     }
-    else if (maxRepeatsCount > 150)
+    else if (maxRepeatsCount > 200)
     {
-      sprintf(msgEnd, "Population repeated over %d step cycle 150x\n", (maxContributor + 1));
+      sprintf(msgEnd, "Pattern repeated over %d step cycle 200x\n", (maxContributor + 1));
     }
 
     char msg[255];
@@ -165,7 +203,7 @@ void GameOfLife::runCycle()
     {
       // End of fade, so update display
       fadeOn = false;
-      renderer.msSleep(delayms);
+      pause(delayms);
       applyChanges();
       renderer.updateDisplay();
     }
@@ -173,87 +211,16 @@ void GameOfLife::runCycle()
   else
   {
     // Run and update cycle
-    //  if ((delayms < 5) && ( (alive == 0) || (unchangedCount > 5 ) || (repeat2Count > 6) || (repeat3Count > 10)
-    //      || (unchangedPopulation[0] > 10)
-    //      || (unchangedPopulation[3] > 10) || (maxRepeatsCount > 20) ) )
+    //  if ((delayms < 5) && ( (alive == 0) || (unchangedCount > 5 ) || (repeatCount[1] > 6) || (repeatCount[2] > 10)
+    //      || (unchangedPopulation > 10)
+    //      || (cyclePopulation > 10) || (maxRepeatsCount > 20) ) )
     //  {
     //      //Debug delay
     //      renderer.msSleep(100);
     //  }
 
     // Apply rules of Game of Life to determine cells dying and being born
-    for (y = 0; y < renderer.getGridHeight(); ++y)
-    {
-      for (x = 0; x < renderer.getGridWidth(); ++x)
-      {
-        // For each cell, count neighbours, including wrapping over grid edges
-        neighbours = -1;
-        uint8_t scores[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // To count colours of surrounding cells to decide colour of new cell
-        for (xi = -1; xi < 2; ++xi)
-        {
-          xt = renderer.newPositionX(x, xi);
-          for (yi = -1; yi < 2; ++yi)
-          {
-            yt = renderer.newPositionY(y, yi);
-            if ((cells[xt][yt] & CELL_ALIVE) != 0)
-            {
-              ++neighbours;
-              uint8_t colIdx = cells[xt][yt] >> 5;
-              scores[colIdx]++;
-            }
-          }
-        }
-
-        /*
-            00: Cell is empty (free space) and staying that way
-            01: Cell is alive and surviving the next cycle
-            11: Cell is alive but is dying (counts as populated for this cycle but will be kills at end of cycle)
-            10: Cell is empty, but is going to spawn a new cell on the next cycle
-        */
-        // Initialise this cell change state to false
-        cells[x][y] &= ~CELL_CHANGE;
-        if (((cells[x][y] & CELL_ALIVE) != 0) && (neighbours < 2))
-        {
-          // Populated cell with too few neighbours, so it will die
-          cells[x][y] |= CELL_CHANGE; // turn on change bit
-        }
-        else if (((cells[x][y] & CELL_ALIVE) == 0) && (neighbours == 2))
-        {
-          // Empty cell with exactly 3 neighbours (count = 2 as did not count itself so was initialised as -1), so spawn new cell
-          cells[x][y] |= CELL_CHANGE; // turn on change bit
-          // Determine highest scoring colour from neighbours
-          uint8_t maxScore = 0;
-          uint8_t newCol = 0;
-          for (uint8_t i = 0; i < 8; ++i)
-          {
-            if (scores[i] > maxScore)
-            {
-              maxScore = scores[i];
-              newCol = i;
-            }
-          }
-
-          // Set new cell colour
-          cells[x][y] &= ~0b11100000; // Clear all colour bits
-          // Apply new colour bit values
-          cells[x][y] += newCol << 5;
-          // const char *bit_rep[16] = {
-          //     [ 0] = "0000", [ 1] = "0001", [ 2] = "0010", [ 3] = "0011",
-          //     [ 4] = "0100", [ 5] = "0101", [ 6] = "0110", [ 7] = "0111",
-          //     [ 8] = "1000", [ 9] = "1001", [10] = "1010", [11] = "1011",
-          //     [12] = "1100", [13] = "1101", [14] = "1110", [15] = "1111",
-          // };
-          // uint8_t byte = cells[x][y];
-          // sprintf(msg, "New cell value: %s%s.\n", bit_rep[byte >> 4], bit_rep[byte & 0x0F]);
-          // renderer.outputMessage(msg);
-        }
-        else if (((cells[x][y] & CELL_ALIVE) != 0) && (neighbours > 3))
-        {
-          // Populated cell with too many neighbours, so it will die
-          cells[x][y] |= CELL_CHANGE; // turn on change bit
-        }
-      }
-    }
+    runRules();
 
     // Fade cells in/out for births/deaths if fade steps set
     if (fadeSteps > 1)
@@ -274,14 +241,45 @@ void GameOfLife::runCycle()
       uint16_t waitLength = delayms * 100;
       if (waitLength > 3000)
         waitLength = 3000;
-      renderer.msSleep(waitLength);
+      pause(waitLength);
     }
   }
 
-  renderer.msSleep(delayms);
+  if (scheduler)
+  {
+    scheduler->waitForFrame();
+  }
+  else
+  {
+    PROFILE_SCOPE(renderer, PROFILE_SLEEP);
+    renderer.msSleep(delayms);
+  }
   iterations++;
 }
 
+// Hold the display for a number of milliseconds, without the time counting against the frame deadlines
+void GameOfLife::pause(uint16_t ms)
+{
+  if (scheduler)
+  {
+    scheduler->pause(ms);
+  }
+  else
+  {
+    PROFILE_SCOPE(renderer, PROFILE_SLEEP);
+    renderer.msSleep(ms);
+  }
+}
+
+/* Pace cycles against frame deadlines from a scheduler, instead of sleeping for the delay after
+ * each cycle. Time spent running the rules then no longer adds on to the delay. Pass NULL to go
+ * back to sleeping.
+ */
+void GameOfLife::setFrameScheduler(FrameScheduler* scheduler_)
+{
+  scheduler = scheduler_;
+}
+
 // Set index of preset pattern to start animation with
 void GameOfLife::setStartPattern(uint8_t patternIdx)
 {
@@ -303,18 +301,22 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
   const bool X = true;
   const bool O = false;
 
-  // Wipe img to reset palette
-  renderer.clearImage();
+  // Wipe img to reset palette. When sharing the display with other layers, only clear the layer
+  // being drawn on, as the other layers still use colours in the palette.
+  if (renderer.getLayerCount() > 1)
+    renderer.clearLayer();
+  else
+    renderer.clearImage();
 
   alive = 0;
   iterations = 0;
   fadeOn = false;
   fadeStep = fadeSteps;
   unchangedCount = 0;
+  unchangedPopulation = 0;
+  cyclePopulation = 0;
   for (uint8_t x = 0; x < maxRepeatCycle; ++x)
-    unchangedPopulation[x] = 0;
-  repeat2Count = 0;
-  repeat3Count = 0;
+    repeatCount[x] = 0;
   for (uint8_t x = 0; x < popHistorySize; ++x)
     population[x] = 0;
 
@@ -355,19 +357,19 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
     {
       for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
       {
-        uint8_t randNumber = renderer.random_int16(0, 100);
+        uint8_t randNumber = renderer.randomRange(0, 100);
         if (randNumber < 15)
         {
           // Pick random colour from palette
-          uint8_t colIdx = renderer.random_int16(0, 8);
-          cells[x][y] = colIdx << 5; // Set colour bits (3 RH most bits)
-          cells[x][y] |= CELL_ALIVE; // Set cell alive bit
+          uint8_t colIdx = renderer.randomRange(0, 8);
+          cells[(uint32_t)y * renderer.getGridWidth() + x] = colIdx << 5; // Set colour bits (3 RH most bits)
+          cells[(uint32_t)y * renderer.getGridWidth() + x] |= CELL_ALIVE; // Set cell alive bit
           renderer.setPixelColour(x, y, cellColours[colIdx]);
           alive++;
         }
         else
         {
-          cells[x][y] = 0;
+          cells[(uint32_t)y * renderer.getGridWidth() + x] = 0;
           renderer.setPixelColour(x, y, RGB_colour{0, 0, 0});
         }
       }
@@ -586,7 +588,7 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
       for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
       {
         // Clear cells outside pattern
-        cells[x][y] &= ~CELL_ALIVE;
+        cells[(uint32_t)y * renderer.getGridWidth() + x] &= ~CELL_ALIVE;
         renderer.setPixelColour(x, y, RGB_colour{0, 0, 0});
       }
     }
@@ -612,8 +614,8 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
             {
               if ((pattern[(16 - 1 - y + offsetY) * 16 + x - offsetX]))
               {
-                cells[x][y] = colIdx << 5; // Set colour bits (3 RH most bits)
-                cells[x][y] |= CELL_ALIVE; // Set cell alive bit
+                cells[(uint32_t)y * renderer.getGridWidth() + x] = colIdx << 5; // Set colour bits (3 RH most bits)
+                cells[(uint32_t)y * renderer.getGridWidth() + x] |= CELL_ALIVE; // Set cell alive bit
                 renderer.setPixelColour(x, y, cellColours[colIdx]);
                 alive++;
               }
@@ -629,6 +631,16 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
     }
   }
 
+  if (fadeSteps > 1)
+    buildFadeRamps();
+
+  // Next iteration starts out the same as this one, as the packed engine only writes cells which change
+  memcpy(nextCells, cells, (uint32_t)renderer.getGridWidth() * renderer.getGridHeight());
+  if (packedEngine)
+    packCells();
+  resetTiles();
+  hashBoard();
+
   renderer.updateDisplay();
 
   // Clear restart flag
@@ -640,204 +652,849 @@ void GameOfLife::initialiseGrid(uint8_t patternIdx)
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 void GameOfLife::applyChanges()
 {
-  uint8_t changes, gap;
-  int8_t popChk, prevPopChk;
+  uint16_t changes;
 
   changes = 0;
-  bool compare2 = true;
-  bool compare3 = true;
+  int32_t aliveChange = 0;
+  uint64_t hashChange = 0;
 
-  for (uint16_t y = 0; y < renderer.getGridHeight(); ++y)
+#if defined(GAME_OF_LIFE_THREADS)
+  if (threadCount > 1)
+    changes = applyBandChanges(aliveChange, hashChange);
+  else
+#endif
+  if (packedEngine)
+    changes = applyPackedChanges(0, renderer.getGridHeight(), aliveChange, hashChange, NULL);
+  else
+    changes = applyCellChanges(0, renderer.getGridHeight(), aliveChange, hashChange, NULL);
+  alive += aliveChange;
+  boardHash ^= hashChange;
+  updateTileQuiet();
+
+  // Increment counter if no changes made
+  if (changes == 0)
+    ++unchangedCount;
+  else
+    unchangedCount = 0;
+
+  // Count how many generations the board has matched the board from each number of generations ago
+  for (uint8_t period = 1; period <= maxRepeatCycle; ++period)
   {
-    for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
+    int8_t hashChk = hashCursor + 1 - period;
+    if (hashChk < 0)
+      hashChk += maxRepeatCycle;
+    if ((period <= hashCount) && (hashHistory[hashChk] == boardHash))
     {
-      // Update last 3 iterations history for this cell
-      if ((cells[x][y] & CELL_PREV2) != 0)
-        cells[x][y] |= CELL_PREV3;
-      else
-        cells[x][y] &= ~CELL_PREV3;
+      if (repeatCount[period - 1] < 255)
+        ++repeatCount[period - 1];
+    }
+    else
+    {
+      repeatCount[period - 1] = 0;
+    }
+  }
+  hashCursor++;
+  if (hashCursor > maxRepeatCycle - 1)
+    hashCursor = 0;
+  hashHistory[hashCursor] = boardHash;
+  if (hashCount < maxRepeatCycle)
+    hashCount++;
+
+  // Increment counters of unchanging population size, and population repeating over 4 generations.
+  // Patterns moving across the grid never repeat exactly, so these catch gliders and spaceships.
+  if (population[popCursor] == alive)
+    ++unchangedPopulation;
+  else
+    unchangedPopulation = 0;
+
+  popCursor++;
+  if (popCursor > popHistorySize - 1)
+    popCursor = 0;
+  if ((population[popCursor] > 0) && (population[popCursor] == alive))
+    ++cyclePopulation;
+  else
+    cyclePopulation = 0;
+  population[popCursor] = alive;
+
+  // char msg[64];
+  // sprintf(msg, "Repeat 2 count: %d, Repeat 3 count: %d\n", repeatCount[1], repeatCount[2]);
+  // renderer.outputMessage(msg);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply changes to each cell in turn. Returns number of cells changed.
+// Changed cells are drawn straight away, or their indexes stored in changedCells if not NULL
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint16_t GameOfLife::applyCellChanges(uint16_t firstRow, uint16_t endRow, int32_t &aliveChange,
+                                      uint64_t &hashChange, uint32_t *changedCells)
+{
+  uint16_t changes = 0;
+  uint16_t width = renderer.getGridWidth();
 
-      if ((cells[x][y] & CELL_PREV1) != 0)
-        cells[x][y] |= CELL_PREV2;
+  for (uint16_t y = firstRow; y < endRow; ++y)
+  {
+    uint32_t tileRow = (uint32_t)(y >> TILE_SHIFT) * tilesX;
+    for (uint16_t x = 0; x < width; ++x)
+    {
+      // Skip to the next tile when nothing in this one is changing
+      if (!tileChanges[tileRow + (x >> TILE_SHIFT)])
+      {
+        x |= (1 << TILE_SHIFT) - 1;
+        continue;
+      }
+      uint32_t idx = (uint32_t)y * width + x;
+      if (((cells[idx] ^ nextCells[idx]) & CELL_ALIVE) == 0)
+        continue;
+
+      cells[idx] = nextCells[idx];
+      if ((cells[idx] & CELL_ALIVE) != 0)
+        ++aliveChange; // New cell created
       else
-        cells[x][y] &= ~CELL_PREV2;
+        --aliveChange; // Dying cell killed
 
-      if ((cells[x][y] & CELL_ALIVE) != 0)
-        cells[x][y] |= CELL_PREV1;
+      hashChange ^= cellKey(idx);
+      if (changedCells == NULL)
+        drawCell(x, y);
       else
-        cells[x][y] &= ~CELL_PREV1;
+        changedCells[changes] = idx;
+      ++changes;
+    }
+  }
+
+  return changes;
+}
 
-      // Create new cells
-      if (((cells[x][y] & CELL_ALIVE) == 0) && ((cells[x][y] & CELL_CHANGE) != 0))
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply changes using the packed bits. Returns number of cells changed.
+// Changed cells are drawn straight away, or their indexes stored in changedCells if not NULL
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint16_t GameOfLife::applyPackedChanges(uint16_t firstRow, uint16_t endRow, int32_t &aliveChange,
+                                        uint64_t &hashChange, uint32_t *changedCells)
+{
+  uint16_t changes = 0;
+
+  for (uint16_t y = firstRow; y < endRow; ++y)
+  {
+    for (uint16_t w = 0; w < rowWords; ++w)
+    {
+      // Apply changes 64 cells at a time, then update just the cells which changed
+      uint32_t i = (uint32_t)y * rowWords + w;
+      uint64_t bits = changeBits[i];
+      aliveBits[i] ^= bits;
+      while (bits != 0)
       {
-        cells[x][y] |= CELL_ALIVE;
-        uint8_t colIdx = cells[x][y] >> 5;
-        renderer.setPixelColour(x, y, cellColours[colIdx]);
+        uint16_t x = w * 64 + __builtin_ctzll(bits);
+        bits &= bits - 1;
+        uint32_t idx = (uint32_t)y * renderer.getGridWidth() + x;
+        cells[idx] = nextCells[idx];
+        if ((cells[idx] & CELL_ALIVE) != 0)
+          ++aliveChange;
+        else
+          --aliveChange;
+
+        hashChange ^= cellKey(idx);
+        if (changedCells == NULL)
+          drawCell(x, y);
+        else
+          changedCells[changes] = idx;
         ++changes;
-        ++alive;
       }
-      else if (((cells[x][y] & CELL_ALIVE) != 0) && ((cells[x][y] & CELL_CHANGE) != 0))
+    }
+  }
+
+  return changes;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Work out the hash of the whole board from the live cells
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::hashBoard()
+{
+  boardHash = 0;
+  for (uint16_t y = 0; y < renderer.getGridHeight(); ++y)
+  {
+    for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
+    {
+      uint32_t idx = (uint32_t)y * renderer.getGridWidth() + x;
+      if ((cells[idx] & CELL_ALIVE) != 0)
+        boardHash ^= cellKey(idx);
+    }
+  }
+
+  // Start the history with the new board
+  hashCursor = 0;
+  hashHistory[hashCursor] = boardHash;
+  hashCount = 1;
+}
+
+/* Key for a live cell in the board hash. Keys are mixed from the cell index (using the splitmix64
+ * finaliser) rather than looked up in a table of random numbers, so no memory is needed for them.
+ */
+uint64_t GameOfLife::cellKey(uint32_t idx)
+{
+  uint64_t z = (idx + 1) * 0x9E3779B97F4A7C15ull;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Work out the colours for each fade step, fading births in green and deaths to red
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::buildFadeRamps()
+{
+  uint8_t halfSteps = fadeSteps / 2;
+  uint16_t maxBrightness = (uint16_t)(cellColours[0].r + cellColours[0].g + cellColours[0].b) / 2;
+  if (maxBrightness > 128)
+    maxBrightness = 128;
+  uint8_t max8bit = (uint8_t)(maxBrightness);
+  RGB_colour black = RGB_colour{0, 0, 0};
+  RGB_colour green = RGB_colour{0, max8bit, 0};
+  RGB_colour red = RGB_colour{max8bit, 0, 0};
+
+  for (uint8_t colIdx = 0; colIdx < 8; ++colIdx)
+  {
+    RGB_colour *born = &bornRamp[colIdx * (fadeSteps + 1)];
+    RGB_colour *died = &diedRamp[colIdx * (fadeSteps + 1)];
+    for (uint8_t step = 0; step <= fadeSteps; ++step)
+    {
+      if (step <= halfSteps)
+      {
+        // Cells being born fade from black to green, and dying cells from their colour to red
+        born[step] = renderer.blendColour(black, green, step, halfSteps);
+        died[step] = renderer.blendColour(cellColours[colIdx], red, step, halfSteps);
+      }
+      else
       {
-        // Kill dying cells
-        cells[x][y] &= ~CELL_ALIVE;
-        renderer.setPixelColour(x, y, RGB_colour{0, 0, 0});
-        ++changes;
-        --alive;
+        // Then new cells fade from green to their colour, and dying cells from red to black
+        born[step] = renderer.blendColour(green, cellColours[colIdx], step - halfSteps, fadeSteps - halfSteps);
+        died[step] = renderer.blendColour(red, black, step - halfSteps, fadeSteps - halfSteps);
       }
+    }
+  }
+}
 
-      // Compare cell to state 2 and 3 iterations ago
-      if (compare2 && (((cells[x][y] & CELL_ALIVE) == 0) != ((cells[x][y] & CELL_PREV2) == 0)))
-        compare2 = false;
-      if (compare3 && (((cells[x][y] & CELL_ALIVE) == 0) != ((cells[x][y] & CELL_PREV3) == 0)))
-        compare3 = false;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Draw one step of the fades for cells being born and dying
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::fadeInChanges(uint8_t step)
+{
+  // Draw the changing cells listed by the rules pass, sending each run of neighbouring cells
+  // along a row to the display as a span
+  uint16_t width = renderer.getGridWidth();
+  uint32_t runStart = 0;
+  uint16_t runLength = 0;
+  for (uint32_t c = 0; c < fadeCellCount; ++c)
+  {
+    uint32_t idx = fadeCells[c];
+    if ((runLength > 0) && ((idx != runStart + runLength) || (idx % width == 0)))
+    {
+      renderer.setSpanInstant(runStart % width, runStart / width, runLength, rowColours);
+      runLength = 0;
     }
+    if (runLength == 0)
+      runStart = idx;
+
+    // New cells take their colour from the next generation
+    if ((nextCells[idx] & CELL_ALIVE) != 0)
+      rowColours[runLength++] = bornRamp[(nextCells[idx] >> 5) * (fadeSteps + 1) + step];
+    else
+      rowColours[runLength++] = diedRamp[(cells[idx] >> 5) * (fadeSteps + 1) + step];
   }
+  if (runLength > 0)
+    renderer.setSpanInstant(runStart % width, runStart / width, runLength, rowColours);
 
-  popCursor++;
-  if (popCursor > popHistorySize - 1)
-    popCursor = 0;
-  population[popCursor] = alive;
+  PROFILE_SCOPE(renderer, PROFILE_SHOW);
+  renderer.presentFrame();
+}
 
-  // Increment counter if no changes made
-  if (changes == 0)
-    ++unchangedCount;
-  else
-    unchangedCount = 0;
+bool GameOfLife::getCellState(uint16_t x, uint16_t y)
+{
+  return ((cells[(uint32_t)y * renderer.getGridWidth() + x] & CELL_ALIVE) != 0);
+}
 
-  // Increment counter if last frame was identical to 2 frames ago (2 cycle repeat)
-  if (compare2)
-    ++repeat2Count;
-  else
-    repeat2Count = 0;
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply rules of Game of Life to each cell in turn, writing the next state of each cell to nextCells
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t GameOfLife::runCellRules(uint16_t firstRow, uint16_t endRow, uint8_t *changedTiles, uint32_t *changedCells)
+{
+  uint32_t changes = 0;
+  int16_t x, y, xt, yt, xi, yi, neighbours;
+  uint16_t width = renderer.getGridWidth();
+  uint16_t height = renderer.getGridHeight();
 
-  // Increment counter if last frame was identical to 3 frames ago (3 cycle repeat)
-  if (compare3)
-    ++repeat3Count;
-  else
-    repeat3Count = 0;
+  for (y = firstRow; y < endRow; ++y)
+  {
+    if (!tileRowActive[y >> TILE_SHIFT])
+      continue;
 
-  // Increment counter of unchanging population size
-  if (popCursor == 0)
-    popChk = popHistorySize - 1;
-  else
-    popChk = popCursor - 1;
+    uint32_t tileRow = (uint32_t)(y >> TILE_SHIFT) * tilesX;
+    for (x = 0; x < width; ++x)
+    {
+      // Skip to the next tile when nothing can change in this one
+      if (!tileActive[tileRow + (x >> TILE_SHIFT)])
+      {
+        x |= (1 << TILE_SHIFT) - 1;
+        continue;
+      }
+
+      // For each cell, count neighbours, including wrapping over grid edges
+      neighbours = -1;
+      uint8_t scores[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // To count colours of surrounding cells to decide colour of new cell
+      for (xi = -1; xi < 2; ++xi)
+      {
+        xt = x + xi;
+        if (xt < 0)
+          xt += width;
+        else if (xt >= width)
+          xt -= width;
+        for (yi = -1; yi < 2; ++yi)
+        {
+          yt = y + yi;
+          if (yt < 0)
+            yt += height;
+          else if (yt >= height)
+            yt -= height;
+          uint8_t neighbour = cells[(uint32_t)yt * width + xt];
+          if ((neighbour & CELL_ALIVE) != 0)
+          {
+            ++neighbours;
+            uint8_t colIdx = neighbour >> 5;
+            scores[colIdx]++;
+          }
+        }
+      }
+
+      /* Work out the state of this cell for the next iteration in nextCells, so the rules only ever
+       * read the current iteration. Cells change where their alive bit differs between the two.
+       */
+      uint32_t idx = (uint32_t)y * width + x;
+      uint8_t next = cells[idx];
+      if (((next & CELL_ALIVE) != 0) && (neighbours < 2))
+      {
+        // Populated cell with too few neighbours, so it will die
+        next &= ~CELL_ALIVE;
+      }
+      else if (((next & CELL_ALIVE) == 0) && (neighbours == 2))
+      {
+        // Empty cell with exactly 3 neighbours (count = 2 as did not count itself so was initialised as -1), so spawn new cell
+        // Determine highest scoring colour from neighbours
+        uint8_t maxScore = 0;
+        uint8_t newCol = 0;
+        for (uint8_t i = 0; i < 8; ++i)
+        {
+          if (scores[i] > maxScore)
+          {
+            maxScore = scores[i];
+            newCol = i;
+          }
+        }
 
-  if (population[popChk] == alive)
-    ++unchangedPopulation[0];
+        // Set new cell colour and alive bit
+        next = (newCol << 5) | CELL_ALIVE;
+      }
+      else if (((next & CELL_ALIVE) != 0) && (neighbours > 3))
+      {
+        // Populated cell with too many neighbours, so it will die
+        next &= ~CELL_ALIVE;
+      }
+      nextCells[idx] = next;
+
+      if (((next ^ cells[idx]) & CELL_ALIVE) != 0)
+      {
+        changedTiles[tileRow + (x >> TILE_SHIFT)] = 1;
+        if (changedCells != NULL)
+          changedCells[changes++] = idx;
+      }
+    }
+  }
+
+  return changes;
+}
+
+// Set pixel for a cell to its colour if alive, or black if dead
+void GameOfLife::drawCell(uint16_t x, uint16_t y)
+{
+  uint8_t cell = cells[(uint32_t)y * renderer.getGridWidth() + x];
+  if ((cell & CELL_ALIVE) != 0)
+    renderer.setPixelColour(x, y, cellColours[cell >> 5]);
   else
-    unchangedPopulation[0] = 0;
+    renderer.setPixelColour(x, y, RGB_colour{0, 0, 0});
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply rules of Game of Life to all cells, using the selected engine
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::runRules()
+{
+  updateActiveTiles();
 
-  // Check for repeating population cycles
-  bool gapCheck = false;
-  for (gap = 4; gap < maxRepeatCycle + 1; ++gap)
+#if defined(GAME_OF_LIFE_THREADS)
+  if (threadCount > 1)
   {
-    for (uint8_t i = 1; i < popHistorySize / gap; ++i)
+    /* The rules only read the current iteration, and write the next one into nextCells, so every
+     * band can run all its rows at once. The packed engine has to finish shifting rows first, as
+     * the rules read the shifted rows either side from the neighbouring bands.
+     */
+    if (packedEngine)
+      runBands(BAND_SHIFT);
+    runBands(BAND_RULES);
+
+    // Tiles can straddle bands, so each band flags changed tiles separately and they are merged here
+    uint32_t tiles = (uint32_t)tilesX * tilesY;
+    fadeCellCount = 0;
+    for (uint8_t i = 0; i < threadCount; ++i)
     {
-
-      for (uint8_t j = 0; j < gap; ++j)
+      for (uint32_t t = 0; t < tiles; ++t)
       {
-        popChk = popCursor - 1 - (gap * i) - j;
-        if (popChk < 0)
-          popChk += popHistorySize;
-        prevPopChk = popChk + (gap * i);
-        if (prevPopChk > popHistorySize - 1)
-          prevPopChk -= popHistorySize;
-        gapCheck = ((population[popChk] > 0) && (population[popChk] == population[prevPopChk]));
-
-        if (gapCheck == false)
+        if (bands[i].changedTiles[t])
         {
-          break;
+          tileChanges[t] = 1;
+          bands[i].changedTiles[t] = 0;
         }
       }
-      if (gapCheck == false)
+      // Bands cover the rows in order, so joining their lists keeps the changed cells in row order
+      if (fadeCells != NULL)
       {
-        break;
+        memcpy(&fadeCells[fadeCellCount], &bands[i].changedCells[0], sizeof(uint32_t) * bands[i].changes);
+        fadeCellCount += bands[i].changes;
       }
     }
-    if (gapCheck == true)
-      break;
+    return;
   }
+#endif
 
-  if (gapCheck == true)
-    ++unchangedPopulation[gap - 1];
+  if (packedEngine)
+  {
+    shiftPackedRows(0, renderer.getGridHeight());
+    fadeCellCount = runPackedRows(0, renderer.getGridHeight(), tileChanges, fadeCells);
+  }
   else
-    unchangedPopulation[gap - 1] = 0;
+  {
+    fadeCellCount = runCellRules(0, renderer.getGridHeight(), tileChanges, fadeCells);
+  }
+}
 
-  // char msg[64];
-  // sprintf(msg, "Repeat 2 count: %d, Repeat 3 count: %d\n", repeat2Count, repeat3Count);
-  // renderer.outputMessage(msg);
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Mark all tiles as changed, so everything is processed for the next few generations
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::resetTiles()
+{
+  uint32_t tiles = (uint32_t)tilesX * tilesY;
+  for (uint32_t t = 0; t < tiles; ++t)
+  {
+    tileQuiet[t] = 0;
+    tileChanges[t] = 0;
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-// Fade births in green, and death to red
+// Mark tiles which changed last generation, and the tiles around them, as active for the rules
 ///////////////////////////////////////////////////////////////////////////////////////////////////
-void GameOfLife::fadeInChanges(uint8_t step)
+void GameOfLife::updateActiveTiles()
 {
-  uint8_t halfSteps = fadeSteps / 2;
-  RGB_colour born;
-  RGB_colour died;
-  uint16_t maxBrightness = (uint16_t)(cellColours[0].r + cellColours[0].g + cellColours[0].b) / 2;
-  if (maxBrightness > 128)
-    maxBrightness = 128;
-  uint8_t max8bit = (uint8_t)(maxBrightness);
+  uint32_t tiles = (uint32_t)tilesX * tilesY;
+  for (uint32_t t = 0; t < tiles; ++t)
+    tileActive[t] = 0;
+  for (uint16_t ty = 0; ty < tilesY; ++ty)
+    tileRowActive[ty] = 0;
+
+  for (uint16_t ty = 0; ty < tilesY; ++ty)
+  {
+    for (uint16_t tx = 0; tx < tilesX; ++tx)
+    {
+      if (tileQuiet[(uint32_t)ty * tilesX + tx] != 0)
+        continue;
+
+      // Neighbouring tiles wrap over the grid edges, the same as the cells do
+      for (int8_t yi = -1; yi < 2; ++yi)
+      {
+        uint16_t yt = (ty + tilesY + yi) % tilesY;
+        tileRowActive[yt] = 1;
+        for (int8_t xi = -1; xi < 2; ++xi)
+          tileActive[(uint32_t)yt * tilesX + (tx + tilesX + xi) % tilesX] = 1;
+      }
+    }
+  }
+}
+
+// Reset count of quiet generations for tiles which just changed, and count up for the rest
+void GameOfLife::updateTileQuiet()
+{
+  uint32_t tiles = (uint32_t)tilesX * tilesY;
+  for (uint32_t t = 0; t < tiles; ++t)
+  {
+    if (tileChanges[t])
+    {
+      tileQuiet[t] = 0;
+      tileChanges[t] = 0;
+    }
+    else if (tileQuiet[t] < 255)
+    {
+      ++tileQuiet[t];
+    }
+  }
+}
+
+// Check whether any of the tiles covered by a word of packed bits are flagged
+bool GameOfLife::anyTileInWord(const uint8_t *tileFlags, uint16_t y, uint16_t w)
+{
+  uint32_t tileRow = (uint32_t)(y >> TILE_SHIFT) * tilesX;
+  uint16_t tile = w << (6 - TILE_SHIFT);
+  uint16_t endTile = tile + (1 << (6 - TILE_SHIFT));
+  if (endTile > tilesX)
+    endTile = tilesX;
+  for (; tile < endTile; ++tile)
+  {
+    if (tileFlags[tileRow + tile])
+      return true;
+  }
+  return false;
+}
+
+// Set number of threads used to run each iteration (only supported where threads are available)
+void GameOfLife::setThreadCount(uint8_t threads)
+{
+#if defined(GAME_OF_LIFE_THREADS)
+  stopWorkers();
+
+  // Each band needs at least 1 row
+  uint16_t maxThreads = renderer.getGridHeight();
+  if (threads > maxThreads)
+    threads = maxThreads;
+  if (threads < 1)
+    threads = 1;
+  threadCount = threads;
+  if (threadCount == 1)
+    return;
+
+  // Split grid into bands of rows, one per thread
+  bands.resize(threadCount);
+  uint16_t firstRow = 0;
+  for (uint8_t i = 0; i < threadCount; ++i)
+  {
+    uint16_t endRow = (uint32_t)renderer.getGridHeight() * (i + 1) / threadCount;
+    bands[i].firstRow = firstRow;
+    bands[i].endRow = endRow;
+    bands[i].changedCells.resize((uint32_t)(endRow - firstRow) * renderer.getGridWidth());
+    bands[i].changedTiles.assign((uint32_t)tilesX * tilesY, 0);
+    firstRow = endRow;
+  }
+
+  // Calling thread works on the first band, so start workers for the others
+  workersExit = false;
+  for (uint8_t i = 1; i < threadCount; ++i)
+    workers.push_back(std::thread(&GameOfLife::workerLoop, this, i, workGeneration));
+#endif
+}
+
+#if defined(GAME_OF_LIFE_THREADS)
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply changes to all bands on worker threads, then draw the changed cells in order
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint16_t GameOfLife::applyBandChanges(int32_t &aliveChange, uint64_t &hashChange)
+{
+  uint16_t changes = 0;
+
+  runBands(BAND_APPLY);
 
-  if (step <= halfSteps)
+  // Drawing has to be done on this thread, in the same order as a single thread would draw the cells
+  for (uint8_t i = 0; i < threadCount; ++i)
+  {
+    aliveChange += bands[i].aliveChange;
+    hashChange ^= bands[i].hashChange;
+    for (uint16_t c = 0; c < bands[i].changes; ++c)
+    {
+      uint32_t idx = bands[i].changedCells[c];
+      drawCell(idx % renderer.getGridWidth(), idx / renderer.getGridWidth());
+    }
+    changes += bands[i].changes;
+  }
+
+  return changes;
+}
+
+// Run a step of the iteration on all bands, returning when every band has finished
+void GameOfLife::runBands(uint8_t step)
+{
   {
-    // Set fade from black to green for cells being born
-    born = renderer.blendColour(RGB_colour{0, 0, 0}, RGB_colour{0, max8bit, 0}, step, halfSteps);
+    std::lock_guard<std::mutex> lock(workMutex);
+    workStep = step;
+    workPending = threadCount - 1;
+    ++workGeneration;
+  }
+  workReady.notify_all();
+
+  runBand(0, step);
+
+  std::unique_lock<std::mutex> lock(workMutex);
+  workDone.wait(lock, [this] { return workPending == 0; });
+}
+
+// Run a step of the iteration on the rows of one band
+void GameOfLife::runBand(uint8_t band, uint8_t step)
+{
+  Band &b = bands[band];
+
+  switch (step)
+  {
+  case BAND_SHIFT:
+    shiftPackedRows(b.firstRow, b.endRow);
+    break;
+  case BAND_RULES:
+    // Changed cells are only listed for fades, and the list is used again when applying the changes
+    if (packedEngine)
+      b.changes = runPackedRows(b.firstRow, b.endRow, &b.changedTiles[0], (fadeCells != NULL) ? &b.changedCells[0] : NULL);
+    else
+      b.changes = runCellRules(b.firstRow, b.endRow, &b.changedTiles[0], (fadeCells != NULL) ? &b.changedCells[0] : NULL);
+    break;
+  case BAND_APPLY:
+    b.aliveChange = 0;
+    b.hashChange = 0;
+    if (packedEngine)
+      b.changes = applyPackedChanges(b.firstRow, b.endRow, b.aliveChange, b.hashChange, &b.changedCells[0]);
+    else
+      b.changes = applyCellChanges(b.firstRow, b.endRow, b.aliveChange, b.hashChange, &b.changedCells[0]);
+    break;
+  }
+}
+
+// Worker thread loop, running each step on its band when signalled
+void GameOfLife::workerLoop(uint8_t band, uint32_t generation)
+{
+  while (true)
+  {
+    uint8_t step;
+    {
+      std::unique_lock<std::mutex> lock(workMutex);
+      workReady.wait(lock, [&] { return workersExit || (workGeneration != generation); });
+      if (workersExit)
+        return;
+      generation = workGeneration;
+      step = workStep;
+    }
+
+    runBand(band, step);
+
+    std::lock_guard<std::mutex> lock(workMutex);
+    if (--workPending == 0)
+      workDone.notify_one();
+  }
+}
+
+// Signal worker threads to exit and wait for them to finish
+void GameOfLife::stopWorkers()
+{
+  {
+    std::lock_guard<std::mutex> lock(workMutex);
+    workersExit = true;
+  }
+  workReady.notify_all();
+  for (size_t i = 0; i < workers.size(); ++i)
+    workers[i].join();
+  workers.clear();
+  threadCount = 1;
+}
+#endif
+
+// Switch between the bit packed engine (which works on 64 cells at a time) and the original cell by cell engine
+void GameOfLife::setBitPackedEngine(bool enabled)
+{
+  if (enabled && (aliveBits == NULL))
+  {
+    // Allocate packed bit arrays on first use
+    rowWords = (renderer.getGridWidth() + 63) / 64;
+    uint8_t lastBits = renderer.getGridWidth() - (rowWords - 1) * 64;
+    if (lastBits == 64)
+      lastWordMask = ~(uint64_t)0;
+    else
+      lastWordMask = ((uint64_t)1 << lastBits) - 1;
+
+    uint32_t words = (uint32_t)rowWords * renderer.getGridHeight();
+    aliveBits = (uint64_t *)RGBMatrixRenderer::allocateAligned(sizeof(uint64_t) * words);
+    changeBits = (uint64_t *)RGBMatrixRenderer::allocateAligned(sizeof(uint64_t) * words);
+    westBits = (uint64_t *)RGBMatrixRenderer::allocateAligned(sizeof(uint64_t) * words);
+    eastBits = (uint64_t *)RGBMatrixRenderer::allocateAligned(sizeof(uint64_t) * words);
+  }
+  if (enabled && !packedEngine)
+  {
+    packedEngine = true;
+    packCells();
+    resetTiles();
   }
   else
   {
-    // Set fade colour for cells dying out from red to black
-    died = renderer.blendColour(RGB_colour{max8bit, 0, 0}, RGB_colour{0, 0, 0}, step - halfSteps, fadeSteps - halfSteps);
+    packedEngine = enabled;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Copy cell states into the packed bit arrays
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::packCells()
+{
+  uint32_t words = (uint32_t)rowWords * renderer.getGridHeight();
+  for (uint32_t i = 0; i < words; ++i)
+  {
+    aliveBits[i] = 0;
+    changeBits[i] = 0;
   }
 
   for (uint16_t y = 0; y < renderer.getGridHeight(); ++y)
   {
     for (uint16_t x = 0; x < renderer.getGridWidth(); ++x)
     {
-      uint8_t colIdx = cells[x][y] >> 5;
+      uint32_t i = (uint32_t)y * rowWords + x / 64;
+      uint64_t bit = (uint64_t)1 << (x % 64);
+      if ((cells[(uint32_t)y * renderer.getGridWidth() + x] & CELL_ALIVE) != 0)
+        aliveBits[i] |= bit;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Shift packed rows ready for the rules to be applied
+///////////////////////////////////////////////////////////////////////////////////////////////////
+void GameOfLife::shiftPackedRows(uint16_t firstRow, uint16_t endRow)
+{
+  uint16_t last = rowWords - 1;
+  uint8_t lastBit = (renderer.getGridWidth() - 1) % 64;
+
+  for (uint16_t y = firstRow; y < endRow; ++y)
+  {
+    // Rows are unchanged since they were last shifted unless a tile in them is active
+    if (!tileRowActive[y >> TILE_SHIFT])
+      continue;
+
+    uint64_t *row = &aliveBits[(uint32_t)y * rowWords];
+    uint64_t *west = &westBits[(uint32_t)y * rowWords];
+    uint64_t *east = &eastBits[(uint32_t)y * rowWords];
+
+    // Shift row so each bit holds its west and east neighbours, wrapping over the grid edges
+    for (uint16_t w = 0; w < rowWords; ++w)
+    {
+      west[w] = row[w] << 1;
+      if (w > 0)
+        west[w] |= row[w - 1] >> 63;
+      east[w] = row[w] >> 1;
+      if (w < last)
+        east[w] |= row[w + 1] << 63;
+    }
+    west[0] |= (row[last] >> lastBit) & 1;
+    east[last] |= (row[0] & 1) << lastBit;
+    west[last] &= lastWordMask;
+    east[last] &= lastWordMask;
+  }
+}
 
-      if (((cells[x][y] & CELL_ALIVE) == 0) && ((cells[x][y] & CELL_CHANGE) != 0))
-      {
-        if (step <= halfSteps)
-        {
-          renderer.setPixelInstant(x, y, born);
-        }
-        else
-        {
-          // Set fade from green to active cell colour for cells being born
-          born = renderer.blendColour(RGB_colour{0, max8bit, 0}, cellColours[colIdx], step - halfSteps, fadeSteps - halfSteps);
-          renderer.setPixelInstant(x, y, born);
-        }
-      }
-      else if (((cells[x][y] & CELL_ALIVE) != 0) && ((cells[x][y] & CELL_CHANGE) != 0))
+///////////////////////////////////////////////////////////////////////////////////////////////////
+// Apply rules of Game of Life to 64 cells at a time, flagging cells which will change
+///////////////////////////////////////////////////////////////////////////////////////////////////
+uint32_t GameOfLife::runPackedRows(uint16_t firstRow, uint16_t endRow, uint8_t *changedTiles, uint32_t *changedCells)
+{
+  uint32_t changes = 0;
+  uint16_t height = renderer.getGridHeight();
+
+  for (uint16_t y = firstRow; y < endRow; ++y)
+  {
+    if (!tileRowActive[y >> TILE_SHIFT])
+      continue;
+
+    uint32_t tileRow = (uint32_t)(y >> TILE_SHIFT) * tilesX;
+    uint32_t above = (uint32_t)((y + 1 < height) ? y + 1 : 0) * rowWords;
+    uint32_t below = (uint32_t)((y > 0) ? y - 1 : height - 1) * rowWords;
+    uint32_t centre = (uint32_t)y * rowWords;
+
+    for (uint16_t w = 0; w < rowWords; ++w)
+    {
+      // Words only covering tiles where nothing can change have no change flags
+      if (!anyTileInWord(tileActive, y, w))
       {
-        if (step <= halfSteps)
-        {
-          // Set fade cells dying out from current colour to red
-          died = renderer.blendColour(cellColours[colIdx], RGB_colour{max8bit, 0, 0}, step, halfSteps);
-        }
-        renderer.setPixelInstant(x, y, died);
+        changeBits[centre + w] = 0;
+        continue;
       }
-      else if ((cells[x][y] & CELL_ALIVE) != 0)
+
+      // Add up the 8 neighbours of each cell using bitwise adders, giving a 3 bit count
+      // (a count of 8 wraps round to 0, which is fine as only counts of 2 and 3 matter)
+      uint64_t a = aliveBits[above + w], b = westBits[above + w], c = eastBits[above + w];
+      uint64_t d = westBits[centre + w], e = eastBits[centre + w];
+      uint64_t f = aliveBits[below + w], g = westBits[below + w], h = eastBits[below + w];
+
+      uint64_t t1 = a ^ b;
+      uint64_t sum1 = t1 ^ c;
+      uint64_t carry1 = (a & b) | (t1 & c);
+      uint64_t t2 = d ^ e;
+      uint64_t sum2 = t2 ^ f;
+      uint64_t carry2 = (d & e) | (t2 & f);
+      uint64_t sum3 = g ^ h;
+      uint64_t carry3 = g & h;
+      uint64_t t4 = sum1 ^ sum2;
+      uint64_t ones = t4 ^ sum3;
+      uint64_t carry4 = (sum1 & sum2) | (t4 & sum3);
+      uint64_t t5 = carry1 ^ carry2;
+      uint64_t sum5 = t5 ^ carry3;
+      uint64_t carry5 = (carry1 & carry2) | (t5 & carry3);
+      uint64_t twos = sum5 ^ carry4;
+      uint64_t fours = carry5 ^ (sum5 & carry4);
+
+      // Alive next iteration with 3 neighbours, or with 2 neighbours if alive now
+      uint64_t alive = aliveBits[centre + w];
+      uint64_t next = twos & ~fours & (ones | alive);
+      uint64_t changed = (alive ^ next);
+      if (w == rowWords - 1)
+        changed &= lastWordMask;
+      changeBits[centre + w] = changed;
+
+      // Update cells which will change, picking colours for new cells
+      while (changed != 0)
       {
-        renderer.setPixelInstant(x, y, cellColours[colIdx]);
+        uint16_t x = w * 64 + __builtin_ctzll(changed);
+        changed &= changed - 1;
+        changedTiles[tileRow + (x >> TILE_SHIFT)] = 1;
+        uint32_t idx = (uint32_t)y * renderer.getGridWidth() + x;
+        if ((cells[idx] & CELL_ALIVE) == 0)
+          nextCells[idx] = (getBirthColour(x, y) << 5) | CELL_ALIVE;
+        else
+          nextCells[idx] = cells[idx] & ~CELL_ALIVE;
+        if (changedCells != NULL)
+          changedCells[changes++] = idx;
       }
     }
   }
-  /*
-  char msg[100];
-  sprintf(msg, "Born col: %d,%d,%d Dead col: %d,%d,%d\n", born.r, born.g, born.b, died.r, died.g, died.b );
-  renderer.outputMessage(msg);
-  */
 
-  renderer.showPixels();
+  return changes;
 }
 
-bool GameOfLife::getCellState(uint16_t x, uint16_t y)
+// Determine highest scoring colour from the neighbours of a new cell
+uint8_t GameOfLife::getBirthColour(uint16_t x, uint16_t y)
 {
-  return ((cells[x][y] & CELL_ALIVE) != 0);
+  uint16_t width = renderer.getGridWidth();
+  uint16_t height = renderer.getGridHeight();
+  uint16_t xs[3] = {(uint16_t)((x > 0) ? x - 1 : width - 1), x, (uint16_t)((x + 1 < width) ? x + 1 : 0)};
+  uint16_t ys[3] = {(uint16_t)((y > 0) ? y - 1 : height - 1), y, (uint16_t)((y + 1 < height) ? y + 1 : 0)};
+  uint8_t scores[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+  for (uint8_t xi = 0; xi < 3; ++xi)
+  {
+    for (uint8_t yi = 0; yi < 3; ++yi)
+    {
+      uint8_t cell = cells[(uint32_t)ys[yi] * width + xs[xi]];
+      if ((cell & CELL_ALIVE) != 0)
+        scores[cell >> 5]++;
+    }
+  }
+
+  uint8_t maxScore = 0;
+  uint8_t newCol = 0;
+  for (uint8_t i = 0; i < 8; ++i)
+  {
+    if (scores[i] > maxScore)
+    {
+      maxScore = scores[i];
+      newCol = i;
+    }
+  }
+  return newCol;
 }
 
 RGB_colour GameOfLife::getCellColour(uint8_t idx)
@@ -37,7 +37,18 @@
 #include <stdio.h>
 #endif
 
+// Threads are used to run iterations in parallel where available (define GAME_OF_LIFE_NO_THREADS
+// to always run on a single thread)
+#if !defined(ARDUINO) && !defined(GAME_OF_LIFE_NO_THREADS)
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#define GAME_OF_LIFE_THREADS
+#endif
+
 #include "RGBMatrixRenderer.h"
+#include "frameScheduler.h"
 
 class GameOfLife
 {
@@ -46,14 +57,22 @@ class GameOfLife
     protected:
     private:
         static uint8_t const maxRepeatCycle = 24;
-        static uint8_t const popHistorySize = 48;
+        static uint8_t const popHistorySize = 4;
         static uint8_t const CELL_ALIVE = 0b00000001;
-        static uint8_t const CELL_CHANGE = 0b00000010;
-        static uint8_t const CELL_PREV1 = 0b00000100;
-        static uint8_t const CELL_PREV2 = 0b00001000;
-        static uint8_t const CELL_PREV3 = 0b00010000;
         //static uint8_t const CELL_COL1 = 0b00100000;
         RGB_colour* cellColours;
+        RGB_colour* rowColours;
+        /* Colours for cells being born and dying at each fade step, for each of the 8 cell colours
+         * (indexed by colour * (fadeSteps + 1) + step). Worked out when the colours are picked for
+         * each new grid, so fades only look colours up. Only allocated when fades are turned on.
+         */
+        RGB_colour* bornRamp = NULL;
+        RGB_colour* diedRamp = NULL;
+        /* Indexes of the cells changing in the next generation, in row order, listed by the rules
+         * pass when fades are turned on. Each fade step then only draws these cells.
+         */
+        uint32_t* fadeCells = NULL;
+        uint32_t fadeCellCount = 0;
         uint16_t delayms;
         uint8_t fadeSteps;
         uint8_t fadeStep = 1;
@@ -61,20 +80,90 @@ class GameOfLife
         uint8_t patternRepeatX = 1;
         uint8_t patternRepeatY = 1;
         RGBMatrixRenderer &renderer;
-        uint8_t** cells; //8bits representing [colour3,colour2,colour1,prev3,prev2,prev1,birth/death,alive]
+        FrameScheduler* scheduler = NULL; // Paces cycles when set, instead of sleeping delayms after each one
+        /* Cells are stored a row at a time in one block, with 8bits representing
+         * [colour3,colour2,colour1,unused,unused,unused,unused,alive]. The rules write the state of
+         * each cell for the next iteration into nextCells, and cells change where the alive bits differ.
+         * Applying the changes copies them back, so both arrays match between iterations.
+         */
+        uint8_t* cells;
+        uint8_t* nextCells;
+#if defined(RGB_MATRIX_FIXED_SIZE)
+        alignas(RGB_MATRIX_CACHE_LINE) uint8_t cellStore[RGB_MATRIX_WIDTH * RGB_MATRIX_HEIGHT];
+        alignas(RGB_MATRIX_CACHE_LINE) uint8_t nextCellStore[RGB_MATRIX_WIDTH * RGB_MATRIX_HEIGHT];
+#endif
         uint16_t alive = 0;
         uint16_t population[popHistorySize] = {};
         uint8_t popCursor = popHistorySize - 1; //Set to last position as gets incremented before use
         uint8_t unchangedCount = 0;
-        uint8_t repeat2Count = 0;
-        uint8_t repeat3Count = 0;
-        uint8_t unchangedPopulation[maxRepeatCycle] = {};
+        uint8_t unchangedPopulation = 0; // Generations with the same population as the last one
+        uint8_t cyclePopulation = 0;     // Generations with the same population as 4 generations ago
+        /* Repeating patterns are detected using a hash of the board, made by combining a key for each
+         * live cell with xor. So it is updated when cells are born or die, and the last maxRepeatCycle
+         * hashes are kept to compare the board against.
+         */
+        uint64_t boardHash = 0;
+        uint64_t hashHistory[maxRepeatCycle] = {};
+        uint8_t hashCursor = 0;  // Position of the hash from the last generation
+        uint8_t hashCount = 0;   // Number of hashes stored since the grid was initialised
+        uint8_t repeatCount[maxRepeatCycle] = {}; // Generations each period has repeated for (index 0 for period 1)
         uint32_t iterations = 0;
         uint32_t iterationsMin = 4294967295;
         uint32_t iterationsMax = 0;
         uint16_t panelSize;
         bool startOver;
         bool fadeOn;
+        /* Bit packed engine state. Cells are packed 64 per word along each row, so the rules can be
+         * worked out for 64 cells at a time. The cells array is still kept up to date for colours,
+         * fades and cell state.
+         */
+        bool packedEngine = false;
+        uint16_t rowWords;       // Number of 64 bit words per row
+        uint64_t lastWordMask;   // Bits in use in the last word of each row
+        uint64_t* aliveBits = NULL;
+        uint64_t* changeBits = NULL;
+        uint64_t* westBits = NULL; // Each row shifted so bits line up with the cell to the west
+        uint64_t* eastBits = NULL; // Each row shifted so bits line up with the cell to the east
+        /* Active tile tracking. The grid is split into 8x8 tiles. A cell can only change when a cell
+         * around it changed in the last generation, so the rules are only run on tiles where a cell
+         * changed last generation, plus the tiles around them. Changes are then only applied, and
+         * repainted during fades, on tiles with changes.
+         */
+        static uint8_t const TILE_SHIFT = 3;
+        uint16_t tilesX;
+        uint16_t tilesY;
+        uint8_t* tileQuiet;     // Generations since a cell in each tile changed (stops at 255)
+        uint8_t* tileChanges;   // Tiles with cells changing in the last rules pass
+        uint8_t* tileActive;    // Tiles the rules need running on this generation
+        uint8_t* tileRowActive; // Rows of tiles containing any active tile
+#if defined(GAME_OF_LIFE_THREADS)
+        /* The grid is split into horizontal bands of rows when running on several threads. Counts
+         * for each band are merged once all bands have finished each step.
+         */
+        struct Band
+        {
+            uint16_t firstRow;
+            uint16_t endRow;
+            uint32_t changes;
+            int32_t aliveChange;
+            uint64_t hashChange;
+            std::vector<uint32_t> changedCells; // Indexes of changed cells, to be drawn or faded in order
+            std::vector<uint8_t> changedTiles; // Tiles with changes flagged by this band, merged after the rules pass
+        };
+        static uint8_t const BAND_SHIFT = 0;
+        static uint8_t const BAND_RULES = 1;
+        static uint8_t const BAND_APPLY = 2;
+        uint8_t threadCount = 1;
+        std::vector<Band> bands;
+        std::vector<std::thread> workers;
+        std::mutex workMutex;
+        std::condition_variable workReady;
+        std::condition_variable workDone;
+        uint32_t workGeneration = 0; // Incremented to signal workers to run the next step
+        uint8_t workStep;
+        uint8_t workPending;
+        bool workersExit;
+#endif
     //functions
     public:
         GameOfLife(RGBMatrixRenderer&,uint8_t,uint16_t,uint8_t,uint8_t=1,uint8_t=1);
@@ -84,9 +173,36 @@ class GameOfLife
         bool getCellState(uint16_t,uint16_t);
         void setStartPattern(uint8_t);
         RGB_colour getCellColour(uint8_t);
+        void setBitPackedEngine(bool);
+        void setThreadCount(uint8_t);
+        void setFrameScheduler(FrameScheduler*);
     protected:
     private:
         void initialiseGrid(uint8_t);
         void applyChanges();
+        uint16_t applyCellChanges(uint16_t,uint16_t,int32_t&,uint64_t&,uint32_t*);
+        uint16_t applyPackedChanges(uint16_t,uint16_t,int32_t&,uint64_t&,uint32_t*);
+        void hashBoard();
+        static uint64_t cellKey(uint32_t);
+        void drawCell(uint16_t,uint16_t);
+        void pause(uint16_t);
+        void buildFadeRamps();
         void fadeInChanges(uint8_t);
+        void runRules();
+        uint32_t runCellRules(uint16_t,uint16_t,uint8_t*,uint32_t*);
+        void packCells();
+        void shiftPackedRows(uint16_t,uint16_t);
+        uint32_t runPackedRows(uint16_t,uint16_t,uint8_t*,uint32_t*);
+        void resetTiles();
+        void updateActiveTiles();
+        void updateTileQuiet();
+        bool anyTileInWord(const uint8_t*,uint16_t,uint16_t);
+        uint8_t getBirthColour(uint16_t,uint16_t);
+#if defined(GAME_OF_LIFE_THREADS)
+        uint16_t applyBandChanges(int32_t&,uint64_t&);
+        void runBands(uint8_t);
+        void runBand(uint8_t,uint8_t);
+        void workerLoop(uint8_t,uint32_t);
+        void stopWorkers();
+#endif
 }; //GameOfLife
@@ -26,8 +26,56 @@
 
 #include "gravitySimulation.h"  
 
-// default constructor
-GravitySimulation::GravitySimulation(RGBMatrixRenderer &renderer_, uint8_t maxRadius_)
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+// Integer square root (rounded down), used in place of sqrt when running in fixed point
+static inline uint32_t squareRoot(uint32_t value)
+{
+    if (value == 0) {
+        return 0;
+    }
+    //Start from the highest power of 4 not above the value
+    uint32_t root = 0;
+    uint32_t bit = 1UL << ((sizeof(unsigned long) * 8 - 1 - __builtin_clzl(value)) & ~1);
+    while (bit != 0) {
+        //Branch free version of: if value >= root + bit, subtract it and set this bit of the root
+        uint32_t trial = root + bit;
+        uint32_t mask = 0 - (uint32_t)(value >= trial);
+        value -= trial & mask;
+        root = (root >> 1) + (bit & mask);
+        bit >>= 2;
+    }
+    return root;
+}
+
+// Length of a vector, using the integer square root. Components are shifted down until the squares
+// fit in 32 bits, which only loses precision for the briefly very fast balls mid collision.
+static inline int32_t vectorLength(int32_t x, int32_t y, bool roundNearest=true)
+{
+    uint32_t ux = abs(x);
+    uint32_t uy = abs(y);
+    uint8_t shift = 0;
+    while ((ux | uy) >= 32768) {
+        ux >>= 1;
+        uy >>= 1;
+        shift++;
+    }
+    //Round to the nearest whole length, as always rounding down would lose energy on every collision
+    uint32_t lengthSquared = ux*ux + uy*uy;
+    uint32_t length = squareRoot(lengthSquared);
+    if (roundNearest && (lengthSquared - length*length > length)) {
+        length++;
+    }
+    return length << shift;
+}
+#endif
+
+//Storage for the grid end marker, as it is passed by reference when filling the grid
+const uint16_t GravitySimulation::noBall;
+
+/* default constructor. Pass the most balls that will be added as maxBalls_ to allocate room for
+ * them up front, so nothing is allocated as they are added or moved (balls beyond it are not added).
+ */
+GravitySimulation::GravitySimulation(RGBMatrixRenderer &renderer_, uint8_t maxRadius_, uint16_t maxBalls_)
     : renderer(renderer_)
 {
     //Normally the particle coordinate space is 256x the pixel resolution of the pixel matrix
@@ -52,6 +100,14 @@ GravitySimulation::GravitySimulation(RGBMatrixRenderer &renderer_, uint8_t maxRa
 
     numBalls = 0;
     maxRadius = maxRadius_;
+    maxBalls = maxBalls_;
+    if (maxBalls > 0) {
+        shapes.reserve(maxBalls);
+        gridNext.reserve(maxBalls);
+    }
+
+    //The grid starts with the smallest cells it can have, so it never needs more room later
+    resizeGrid();
 
 } //GravitySimulation
 
@@ -62,41 +118,176 @@ GravitySimulation::~GravitySimulation()
 
 GravitySimulation::Ball GravitySimulation::createBall() {
   GravitySimulation::Ball shape;
-  shape.x = rand() % renderer.getGridWidth();
-  shape.y = rand() % renderer.getGridHeight();
+  shape.x = fromPixels(renderer.randomRange(0, renderer.getGridWidth()));
+  shape.y = fromPixels(renderer.randomRange(0, renderer.getGridHeight()));
   if (maxRadius > 1){
-    shape.r = (rand() % (maxRadius-1)) + 1;
+    shape.r = renderer.randomRange(1, maxRadius);
   }
   else {
     shape.r = 1;
   }
-  shape.dx = float(rand() % 255) / 64.0f;
-  shape.dy = float(rand() % 255) / 64.0f;
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+  shape.dx = (renderer.randomRange(0, 255)) * spaceMultiplier / 64;
+  shape.dy = (renderer.randomRange(0, 255)) * spaceMultiplier / 64;
+#else
+  shape.dx = float(renderer.randomRange(0, 255)) / 64.0f;
+  shape.dy = float(renderer.randomRange(0, 255)) / 64.0f;
+#endif
   // Generate random colour which is not too dark
   uint8_t r = 0;
   uint8_t g = 0;
   uint8_t b = 0;
   while (r + g + b < 192) {
-    r = rand() % 255;
-    g = rand() % 255;
-    b = rand() % 255;
+    r = renderer.randomRange(0, 255);
+    g = renderer.randomRange(0, 255);
+    b = renderer.randomRange(0, 255);
   }
   shape.colour = RGB_colour(r, g, b);
+  shape.drawn = false;
+  shape.drawnX = 0;
+  shape.drawnY = 0;
   return shape;
 };
 
 void GravitySimulation::addBall()
 {
+    if ( (maxBalls > 0) && (shapes.size() >= maxBalls) ) {
+        return;
+    }
     shapes.push_back( createBall() );
 }
 
-//Run Cycle is called once per frame of the animation
-void GravitySimulation::runCycle()
+//Apply contact or repelling forces between a pair of shapes
+void GravitySimulation::applyForces(Ball &shape, Ball &other)
 {
+    //Check distance between shapes
+    Value sepx = other.x - shape.x;
+    Value sepy = other.y - shape.y;
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+    //Particle space coordinates use up to 16 bits, so squared distances need 64 bits
+    int64_t sepSquared = (int64_t)sepx*sepx + (int64_t)sepy*sepy;
+    int64_t spaceSquared = (int64_t)spaceMultiplier*spaceMultiplier;
+#else
+    float sepSquared = (sepx*sepx)+(sepy*sepy);
+    float spaceSquared = 1.0f;
+#endif
+
+    //Skip shapes too far apart to interact before taking the square root
+    uint8_t rd = shape.r + other.r;
+    if (mode == 1) {
+        if ( (repelRadius > 0) && (sepSquared > spaceSquared*repelRadius*repelRadius) ) {
+            return;
+        }
+    }
+    else if (sepSquared >= spaceSquared*rd*rd) {
+        return;
+    }
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+    uint16_t sep = vectorLength(sepx, sepy, false) / spaceMultiplier;
+#else
+    uint16_t sep = int(sqrt(sepSquared));
+#endif
+
+    //Don't try to process interactions if shapes exactly on top of one another
+    if(sep > 0.0) {
+
+        Value ax = 0;
+        Value ay = 0;
+
+        //Bounce if contacting
+        if( sep < rd) {
+            PROFILE_COUNT(renderer, PROFILE_COLLISIONS, 1);
+            // If forces between balls, allow to pass each other when overlapping,
+            // unless centres really close. Don't apply forces during overlap as
+            // force is too strong and they just stick together.
+            if (mode == 0 || sep < rd / 4) {
+                //Bounce balls off each other
+                /*
+                //Trig solution
+                float angle = atan2(sepy, sepx);
+                float targetX = shape.x + cos(angle) * sep;
+                float targetY = shape.y + sin(angle) * sep;
+                float ax = (targetX - shape.x);
+                float ay = (targetY - shape.y);
+                */
+
+                //Handle x and y components seperately (more efficient)
+                ax = sepx;
+                ay = sepy;
+            }
+        }
+        else {
+            switch(mode){
+                case 1:
+                //Repel, Force is inverse of distance squared (shared out over the substeps of each step)
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+                ax = -forcePower * sepx / ((int32_t)sep*sep*sep*substeps);
+                ay = -forcePower * sepy / ((int32_t)sep*sep*sep*substeps);
+#else
+                float force = -forcePower / (sep*sep*substeps);
+                ax = force * sepx / sep;
+                ay = force * sepy / sep;
+#endif
+
+                break;
+            }
+        }
+
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+        int32_t prePower = vectorLength(shape.dx, shape.dy) + vectorLength(other.dx, other.dy);
+#else
+        float prePower = sqrt(shape.dx*shape.dx+shape.dy*shape.dy) + sqrt(other.dx*other.dx+other.dy*other.dy);
+#endif
+        shape.dx -= ax * other.r;
+        shape.dy -= ay * other.r;
+        other.dx += ax * shape.r;
+        other.dy += ay * shape.r;
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+        int32_t postPower = vectorLength(shape.dx, shape.dy) + vectorLength(other.dx, other.dy);
+        if (postPower > 0) {
+            //Scale with 16 fractional bits, so there is only one division per collision. Results are
+            //rounded to nearest so balls do not steadily slow down.
+            int64_t scalePower = (((int64_t)prePower << 16) + postPower / 2) / postPower;
+
+            shape.dx = (shape.dx * scalePower + 32768) >> 16;
+            shape.dy = (shape.dy * scalePower + 32768) >> 16;
+            other.dx = (other.dx * scalePower + 32768) >> 16;
+            other.dy = (other.dy * scalePower + 32768) >> 16;
+        }
+#else
+        float postPower = sqrt(shape.dx*shape.dx+shape.dy*shape.dy) + sqrt(other.dx*other.dx+other.dy*other.dy);
+        float scalePower = prePower / postPower;
+
+        shape.dx = shape.dx * scalePower;
+        shape.dy = shape.dy * scalePower;
+        other.dx = other.dx * scalePower;
+        other.dy = other.dy * scalePower;
+#endif
+
+    
+    }
+}
+
+/* Run Cycle is called once per frame of the animation, running a number of fixed time steps of the
+ * simulation (see FrameScheduler::setStepPeriod). Each step is split into substeps, with collisions
+ * resolved after each one. Balls are only drawn once the last substep is done.
+ */
+void GravitySimulation::runCycle(uint16_t steps)
+{
+    PROFILE_FRAME(renderer);
+
     uint16_t i = 0;
-    uint16_t iterationsPerFrame = 1;
+    uint16_t iterationsPerFrame = steps * substeps;
     // uint16_t ballCount = 0;
     for (u_int16_t iter = 0; iter < iterationsPerFrame; iter++){
+        i = 0;
+        if (useGrid) {
+            //Empty grid, it is refilled as each shape is moved
+            for (auto &head : gridHeads) {
+                head = noBall;
+            }
+            gridNext.resize(shapes.size());
+        }
         // ballCount = 0;
         for (auto &shape : shapes) {
             // ballCount++;
@@ -104,140 +295,192 @@ void GravitySimulation::runCycle()
             // sprintf(msg, "Balls processed %d\n", ballCount );
             // renderer.outputMessage(msg);
 
-            float oldX = shape.x;
-            float oldY = shape.y;
-
             //Update shape position
-            shape.x += shape.dx/iterationsPerFrame;
-            shape.y += shape.dy/iterationsPerFrame;
+            shape.x += shape.dx/substeps;
+            shape.y += shape.dy/substeps;
 
             //Check for collision with shapes already updated
-            for(uint16_t j = 0; j < i; j++) {
-                //Check distance between shapes
-                float sepx = shapes[j].x - shape.x;
-                float sepy = shapes[j].y - shape.y;
-                uint16_t sep = int(sqrt((sepx*sepx)+(sepy*sepy)));
-
-                //Don't try to process interactions if shapes exactly on top of one another
-                if(sep > 0.0) {
-
-                    float ax = 0.0f;
-                    float ay = 0.0f;
-
-                    uint8_t rd = 0;
-                    float force = -forcePower;
-
-                    //Bounce if contacting
-                    rd = shape.r + shapes[j].r;
-                    if( sep < rd) {
-                        // If forces between balls, allow to pass each other when overlapping,
-                        // unless centres really close. Don't apply forces during overlap as
-                        // force is too strong and they just stick together.
-                        if (mode == 0 || sep < rd / 4) {
-                            //Bounce balls off each other
-                            /*
-                            //Trig solution
-                            float angle = atan2(sepy, sepx);
-                            float targetX = shape.x + cos(angle) * sep;
-                            float targetY = shape.y + sin(angle) * sep;
-                            float ax = (targetX - shape.x);
-                            float ay = (targetY - shape.y);
-                            */
-
-                            //Handle x and y components seperately (more efficient)
-                            ax = sepx;
-                            ay = sepy;
+            if (useGrid) {
+                //Only shapes in the surrounding grid cells are close enough to interact
+                uint16_t col = getGridCol(shape.x);
+                uint16_t row = getGridRow(shape.y);
+                uint16_t rowStart = (row > 0) ? row - 1 : 0;
+                uint16_t rowEnd = (row + 1 < gridRows) ? row + 1 : row;
+                uint16_t colStart = (col > 0) ? col - 1 : 0;
+                uint16_t colEnd = (col + 1 < gridCols) ? col + 1 : col;
+                for(uint16_t cellRow = rowStart; cellRow <= rowEnd; cellRow++) {
+                    for(uint16_t cellCol = colStart; cellCol <= colEnd; cellCol++) {
+                        for(uint16_t j = gridHeads[cellRow * gridCols + cellCol]; j != noBall; j = gridNext[j]) {
+                            applyForces(shape, shapes[j]);
                         }
                     }
-                    else {
-                        switch(mode){
-                            case 1:
-                            //Repel, Force is inverse of distance squared
-                            force = force / (sep*sep);
-                            ax = force * sepx / sep;
-                            ay = force * sepy / sep;
-
-                            break;
-                        }
-                    }
-
-                    float prePower = sqrt(shape.dx*shape.dx+shape.dy*shape.dy) + sqrt(shapes[j].dx*shapes[j].dx+shapes[j].dy*shapes[j].dy);
-                    shape.dx -= ax * shapes[j].r;
-                    shape.dy -= ay * shapes[j].r;
-                    shapes[j].dx += ax * shape.r;
-                    shapes[j].dy += ay * shape.r;
-                    float postPower = sqrt(shape.dx*shape.dx+shape.dy*shape.dy) + sqrt(shapes[j].dx*shapes[j].dx+shapes[j].dy*shapes[j].dy);
-                    float scalePower = prePower / postPower;
-
-                    shape.dx = shape.dx * scalePower;
-                    shape.dy = shape.dy * scalePower;
-                    shapes[j].dx = shapes[j].dx * scalePower;
-                    shapes[j].dy = shapes[j].dy * scalePower;
-
-                
+                }
+            }
+            else {
+                for(uint16_t j = 0; j < i; j++) {
+                    applyForces(shape, shapes[j]);
                 }
             }
 
             //Check shape remains in bounds of screen, reverse direction if not
-            if((shape.x - shape.r) < minX) {
+            Value radius = fromPixels(shape.r);
+            if((shape.x - radius) < minX) {
                 shape.dx *= -1;
-                shape.x = minX + shape.r;
+                shape.x = minX + radius;
             }
-            if((shape.x + shape.r) >= maxX) {
+            if((shape.x + radius) >= fromPixels(maxX)) {
                 shape.dx *= -1;
-                shape.x = maxX - shape.r;
+                shape.x = fromPixels(maxX - shape.r);
             }
-            if((shape.y - shape.r) < minY) {
+            if((shape.y - radius) < minY) {
                 shape.dy *= -1;
-                shape.y = minY + shape.r;
+                shape.y = minY + radius;
             }
-            if((shape.y + shape.r) >= maxY) {
+            if((shape.y + radius) >= fromPixels(maxY)) {
                 shape.dy *= -1;
-                shape.y = maxY - shape.r;
-            }
-
-            //Clear pixels for last drawn position of this circle on first iteration of positions simulation
-            if(iter == 0){
-                //Skip the slow calcs if 1:1 scale with screen
-                if(minX == 0 && minY == 0){
-                    //Draw circles at 1:1 scale on screen
-                    //graphics.circle(Point(shape.x, shape.y), shape.r);
-                    renderer.drawCircle(oldX, oldY, shape.r, RGB_colour(0,0,0)); 
-                }
+                shape.y = fromPixels(maxY - shape.r);
             }
 
-            //Draw new position on last iteration
-            if(iter == iterationsPerFrame-1){
-                //Skip the slow calcs if 1:1 scale with screen
-                if(minX == 0 && minY == 0){
-                    //Draw circles at 1:1 scale on screen
-                    //graphics.circle(Point(shape.x, shape.y), shape.r);
-                    renderer.drawCircle(oldX, oldY, shape.r, RGB_colour(0,0,0)); //Clear old position
-                    renderer.drawCircle(shape.x, shape.y, shape.r, shape.colour); //Draw in new position
-                }
-                else {
-                    // //Draw circles scaled to boundaries
-                    // float posX = graphics.bounds.w * (shape.x - minX) / (maxX - minX);
-                    // float posY = graphics.bounds.h * (shape.y - minY) / (maxY - minY);
-                    // float rad = graphics.bounds.h * shape.r / (maxY - minY);
-                    // if(rad < 2) rad = 2;
-                    // graphics.set_pen(shape.pen);
-                    // graphics.circle(Point(posX, posY), rad);
-
-                    
-                }
+            //Add to grid at final position, so shapes processed after this one can find it
+            if (useGrid) {
+                uint16_t cell = getGridRow(shape.y) * gridCols + getGridCol(shape.x);
+                gridNext[i] = gridHeads[cell];
+                gridHeads[cell] = i;
             }
 
             i++;
         }
 
     }
- 
+
+    //Draw new positions once the last substep is done
+    if(iterationsPerFrame > 0){
+        //Skip the slow calcs if 1:1 scale with screen
+        if(minX == 0 && minY == 0){
+            //Clear where every shape has moved away from before drawing any, so clearing one shape
+            //cannot erase part of another it overlapped. Each shape is then drawn in full, which
+            //only changes the pixels which differ from the last frame.
+            for (auto &shape : shapes) {
+                if (shape.drawn) {
+                    renderer.clearCircleMove(shape.drawnX, shape.drawnY, toPixels(shape.x), toPixels(shape.y), shape.r);
+                }
+            }
+            for (auto &shape : shapes) {
+                //Draw circles at 1:1 scale on screen
+                //graphics.circle(Point(shape.x, shape.y), shape.r);
+                shape.drawnX = toPixels(shape.x);
+                shape.drawnY = toPixels(shape.y);
+                shape.drawn = true;
+                renderer.drawCircle(shape.drawnX, shape.drawnY, shape.r, shape.colour);
+            }
+        }
+        else {
+            // //Draw circles scaled to boundaries
+            // float posX = graphics.bounds.w * (shape.x - minX) / (maxX - minX);
+            // float posY = graphics.bounds.h * (shape.y - minY) / (maxY - minY);
+            // float rad = graphics.bounds.h * shape.r / (maxY - minY);
+            // if(rad < 2) rad = 2;
+            // graphics.set_pen(shape.pen);
+            // graphics.circle(Point(posX, posY), rad);
+        }
+    }
 
     //Update LEDs
-    renderer.showPixels(); //Update the display (for hardware which is not instantaneous)
+    PROFILE_SCOPE(renderer, PROFILE_SHOW);
+    renderer.presentFrame(); //Update the display (for hardware which is not instantaneous)
 }
 
 void GravitySimulation::setMode(uint8_t mode_){
     mode = mode_;
+    resizeGrid();
+}
+
+//Select between the spatial grid (default) and testing every pair of shapes
+void GravitySimulation::setSpatialGrid(bool enabled){
+    useGrid = enabled;
+}
+
+//Set distance beyond which shapes do not repel each other in mode 1 (0 for no limit)
+void GravitySimulation::setRepelRadius(uint16_t radius){
+    repelRadius = radius;
+    resizeGrid();
+}
+
+//Split each step into smaller moves, so fast balls do not pass through each other between collision checks
+void GravitySimulation::setSubsteps(uint8_t substeps_){
+    substeps = (substeps_ > 0) ? substeps_ : 1;
+}
+
+uint16_t GravitySimulation::getBallCount(){
+    return shapes.size();
+}
+
+//Ball at an index from 0 to getBallCount() - 1, including where it was last drawn
+const GravitySimulation::Ball& GravitySimulation::getBall(uint16_t index){
+    return shapes[index];
+}
+
+//Size grid cells to the furthest distance shapes can interact over in the current mode
+void GravitySimulation::resizeGrid(){
+    uint16_t maxDim = renderer.getGridWidth();
+    if (renderer.getGridHeight() > maxDim) {
+        maxDim = renderer.getGridHeight();
+    }
+
+    gridCellSize = 2 * maxRadius;
+    if (mode == 1) {
+        if (repelRadius == 0) {
+            //No repel limit, so every shape can reach every other one
+            gridCellSize = maxDim;
+        }
+        else if (repelRadius > gridCellSize) {
+            gridCellSize = repelRadius;
+        }
+    }
+    if (gridCellSize < 1) {
+        gridCellSize = 1;
+    }
+    if (gridCellSize > maxDim) {
+        gridCellSize = maxDim;
+    }
+
+    gridCols = (renderer.getGridWidth() + gridCellSize - 1) / gridCellSize;
+    gridRows = (renderer.getGridHeight() + gridCellSize - 1) / gridCellSize;
+    gridHeads.assign(gridCols * gridRows, noBall);
+}
+
+//Grid column containing an x position (positions off the grid go in the edge cells)
+uint16_t GravitySimulation::getGridCol(Value x){
+    if (x < 0) {
+        return 0;
+    }
+    uint16_t col = uint16_t(toPixels(x)) / gridCellSize;
+    return (col < gridCols) ? col : gridCols - 1;
+}
+
+//Grid row containing a y position (positions off the grid go in the edge cells)
+uint16_t GravitySimulation::getGridRow(Value y){
+    if (y < 0) {
+        return 0;
+    }
+    uint16_t row = uint16_t(toPixels(y)) / gridCellSize;
+    return (row < gridRows) ? row : gridRows - 1;
+}
+
+//Convert a pixel position or distance into the units balls are simulated in
+GravitySimulation::Value GravitySimulation::fromPixels(int32_t pixels){
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+    return pixels * spaceMultiplier;
+#else
+    return pixels;
+#endif
+}
+
+//Convert a simulated position into whole pixels
+int16_t GravitySimulation::toPixels(Value value){
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+    return value / spaceMultiplier;
+#else
+    return int16_t(value);
+#endif
 }
@@ -51,19 +51,35 @@
 
 using std::vector;
 
+/* Define GRAVITY_SIMULATION_FIXED_POINT to run the simulation in integer maths, for boards without
+ * a floating point unit. Ball positions and velocities are then held in the same sub pixel coordinate
+ * space as GravityParticles uses (spaceMultiplier units per pixel) instead of as floats in pixels.
+ */
 class GravitySimulation
 {
     //variables
     public:
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+        typedef int32_t Value;
+#else
+        typedef float Value;
+#endif
         struct Ball {
-            float     x;
-            float     y;
+            Value     x;
+            Value     y;
             uint8_t   r;
-            float     dx;
-            float     dy;
+            Value     dx;
+            Value     dy;
             RGB_colour colour;
+            bool      drawn; // Set once the ball has been drawn at drawnX,drawnY
+            int16_t   drawnX;
+            int16_t   drawnY;
         };
+#if defined(GRAVITY_SIMULATION_FIXED_POINT)
+        int16_t forcePower = 2;
+#else
         float forcePower = 2.0f;
+#endif
     protected:
     private:
         int delayms;
@@ -71,21 +87,46 @@ class GravitySimulation
         uint16_t spaceMultiplier;
         uint16_t maxParticles;
         uint16_t numBalls;
+        uint16_t maxBalls; // Most balls that can be added, with room for them allocated up front (0 for no limit)
         uint16_t maxX;
         uint16_t maxY;
-        vector<Ball> shapes;
+        vector<Ball, AlignedAllocator<Ball> > shapes;
         uint8_t mode = 0;
-        float minX = 0;
-        float minY = 0;
+        Value minX = 0;
+        Value minY = 0;
         uint8_t maxRadius;
+        uint16_t repelRadius = 0; //Distance beyond which balls do not repel (0 for no limit)
+        uint8_t substeps = 1; //Number of smaller moves each step is split into, with collisions checked after each
+        bool useGrid = true;
+        /* Uniform grid used to find balls near enough to interact. Cells are at least as large as the
+         * interaction distance, so each ball only needs testing against balls in the 3x3 block of cells
+         * around it. Balls are held in a linked list per cell, rebuilt as they are moved each frame.
+         */
+        static const uint16_t noBall = 0xFFFF;
+        uint16_t gridCellSize;
+        uint16_t gridCols;
+        uint16_t gridRows;
+        vector<uint16_t, AlignedAllocator<uint16_t> > gridHeads; //First ball in each cell
+        vector<uint16_t, AlignedAllocator<uint16_t> > gridNext; //Next ball in the same cell as each ball
     //functions
     public:
-        GravitySimulation(RGBMatrixRenderer&,uint8_t);
+        GravitySimulation(RGBMatrixRenderer&,uint8_t,uint16_t=0);
         ~GravitySimulation();
-        void runCycle();
+        void runCycle(uint16_t=1);
         void addBall();
         void setMode(uint8_t);
+        void setSpatialGrid(bool);
+        void setRepelRadius(uint16_t);
+        void setSubsteps(uint8_t);
+        uint16_t getBallCount();
+        const Ball& getBall(uint16_t);
     protected:
     private:
         Ball createBall();
+        void applyForces(Ball&,Ball&);
+        void resizeGrid();
+        uint16_t getGridCol(Value);
+        uint16_t getGridRow(Value);
+        Value fromPixels(int32_t);
+        int16_t toPixels(Value);
 }; //GravitySimulation
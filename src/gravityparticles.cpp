@@ -35,8 +35,51 @@
 
 #include "gravityparticles.h"  
 
-// default constructor
-GravityParticles::GravityParticles(RGBMatrixRenderer &renderer_, uint16_t shake_, uint8_t bounce_)
+// Use SIMD instructions to update particle velocities where available (define GRAVITY_PARTICLES_NO_SIMD
+// to always use the plain C++ version)
+#if !defined(GRAVITY_PARTICLES_NO_SIMD)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define GRAVITY_PARTICLES_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define GRAVITY_PARTICLES_NEON
+#endif
+#endif
+
+// Terminal velocity (in any direction) is 256 units -- equal to
+// 1 pixel -- which keeps moving particles from passing through each other
+// and other such mayhem.  Though it takes some extra math, velocity is
+// clipped as a 2D vector (not separately-limited X & Y) so that
+// diagonal movement isn't faster
+static inline void capVelocity(int16_t &vx, int16_t &vy, uint16_t velCap)
+{
+    int32_t v2 = (int32_t)vx*vx+(int32_t)vy*vy; // Velocity squared
+
+    if(v2 > (int32_t)velCap*velCap) { // If v^2 > 65536, then v > 256
+        float v = sqrt((float)v2); // Velocity vector magnitude
+        vx = (int16_t)(velCap*(float)vx/v); // Maintain heading
+        vy = (int16_t)(velCap*(float)vy/v); // Limit magnitude
+    }
+}
+
+// For each cube panel, the component of the 3D acceleration which acts along the panel x direction
+// followed by the one which acts along the panel y direction (0=x, 1=y, 2=z, with the sign of each).
+// The 3D x, y and z directions are to the right, up and out of the front of panel 0.
+static const int8_t panelAxes[6][4] = {
+    {0,  1, 1,  1},
+    {2, -1, 1,  1},
+    {0, -1, 1,  1},
+    {0, -1, 2, -1},
+    {1,  1, 2, -1},
+    {0,  1, 2, -1},
+};
+
+/* default constructor. Pass the most particles that will be added as maxParticles_ to allocate
+ * the store once at that size, so it is never expanded (particles beyond it are not added).
+ * Otherwise the store starts small and grows as particles are added.
+ */
+GravityParticles::GravityParticles(RGBMatrixRenderer &renderer_, uint16_t shake_, uint8_t bounce_, uint16_t maxParticles_)
     : renderer(renderer_)
 {
     //Normally the particle coordinate space is 256x the pixel resolution of the pixel matrix
@@ -54,15 +97,22 @@ GravityParticles::GravityParticles(RGBMatrixRenderer &renderer_, uint16_t shake_
     }
 
     // Allocate initial memory for particles array
-    uint16_t max = renderer.getGridWidth() * renderer.getGridHeight();
-    if (max < 100) {
+    uint32_t max = (uint32_t)renderer.getGridWidth() * renderer.getGridHeight();
+    fixedStore = (maxParticles_ > 0);
+    if (fixedStore) {
+        maxParticles = maxParticles_;
+    }
+    else if (max < 100) {
         maxParticles =  max;
     }
     else {
         maxParticles = 100;
     }
     
-    particles = new Particle[maxParticles];
+    posX = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxParticles);
+    posY = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * maxParticles);
+    velX = (int16_t*)RGBMatrixRenderer::allocateAligned(sizeof(int16_t) * maxParticles);
+    velY = (int16_t*)RGBMatrixRenderer::allocateAligned(sizeof(int16_t) * maxParticles);
 
     // The 'sand' particles exist in an integer coordinate space that's 256X
     // the scale of the pixel grid, allowing them to move and interact at
@@ -72,11 +122,27 @@ GravityParticles::GravityParticles(RGBMatrixRenderer &renderer_, uint16_t shake_
 
     velCap = spaceMultiplier * 64; //Make this possible to set via a method. Needs to be * 4 for sand, but * 16 for fast particles.
 
+    //In cube mode particles move between panels over the cube edges rather than bouncing off
+    //the edges of the grid
+    cubeMode = renderer.getCubeMode();
+    if (cubeMode) {
+        panelSpan = renderer.getPanelSize() * spaceMultiplier;
+    }
+    else {
+        panelSpan = 0;
+    }
+
     numParticles = 0;
     shake = shake_;
     bounce = bounce_;
+    drawMoves = true;
     accelX = 0;
     accelY = 0;
+    for (uint8_t p=0; p<6; p++) {
+        panelAccelX[p] = 0;
+        panelAccelY[p] = 0;
+    }
+    jitter = renderer.splitRandom();
 
     //Loss should be between 1 - 6. If should not be < 1 and particles will gain energy from collisions then
     loss = 1.0+float_t(255-bounce_)*5/255;    
@@ -90,42 +156,42 @@ GravityParticles::GravityParticles(RGBMatrixRenderer &renderer_, uint16_t shake_
 // default destructor
 GravityParticles::~GravityParticles()
 {
-    delete [] particles;
+    RGBMatrixRenderer::freeAligned(posX);
+    RGBMatrixRenderer::freeAligned(posY);
+    RGBMatrixRenderer::freeAligned(velX);
+    RGBMatrixRenderer::freeAligned(velY);
 } //~GravityParticles
 
-//Run Cycle is called once per frame of the animation
-void GravityParticles::runCycle()
+/* Run Cycle is called once per frame of the animation, running a number of fixed time steps of the
+ * simulation. Running more steps when frames are slow (see FrameScheduler::setStepPeriod) keeps
+ * the particles moving at the same speed whatever the display rate. When running several steps,
+ * particles are only moved in memory, and the changed pixels are sent once the last step is done.
+ */
+void GravityParticles::runCycle(uint16_t steps)
 {
-    int32_t v2; // Velocity squared
-    float   v;  // Absolute velocity
-    int16_t shakeFactor = shake / 2;
+    PROFILE_FRAME(renderer);
 
-    //Apply 2D accel vector to particle velocities...
-    for(uint16_t i=0; i<numParticles; i++) {
-        int16_t axa = accelX + renderer.random_int16(-shakeFactor,shakeFactor+1); // A little randomness makes
-        int16_t aya = accelY + renderer.random_int16(-shakeFactor,shakeFactor+1); // tall stacks topple better!
-        particles[i].vx += axa;
-        particles[i].vy += aya;
-        // Terminal velocity (in any direction) is 256 units -- equal to
-        // 1 pixel -- which keeps moving particles from passing through each other
-        // and other such mayhem.  Though it takes some extra math, velocity is
-        // clipped as a 2D vector (not separately-limited X & Y) so that
-        // diagonal movement isn't faster
-        v2 = (int32_t)particles[i].vx*particles[i].vx+(int32_t)particles[i].vy*particles[i].vy;
-
-        if(v2 > (velCap*velCap) ) { // If v^2 > 65536, then v > 256
-            v = sqrt((float)v2); // Velocity vector magnitude
-            particles[i].vx = (int16_t)(velCap*(float)particles[i].vx/v); // Maintain heading
-            particles[i].vy = (int16_t)(velCap*(float)particles[i].vy/v); // Limit magnitude
-        }
-    //REMEMBER these debug messages kill the speed of the animation if more than around 10 particles!
-    // char msg[80];
-    // sprintf(msg, "Particle %d Vel: %d,%d; a=%d,%d\n", i, int(particles[i].vx), int(particles[i].vy), axa, aya );
-    // renderer.outputMessage(msg);
+    drawMoves = (steps == 1);
+    for(uint16_t step=0; step<steps; step++) {
+        //Apply 2D accel vector to particle velocities, then update positions
+        applyAcceleration();
+        moveParticles();
+    }
 
+    //Update LEDs
+    PROFILE_SCOPE(renderer, PROFILE_SHOW);
+    if (drawMoves) {
+        renderer.presentFrame(); //Update the display (for hardware which is not instantaneous)
     }
-        
-    // ...then update position of each particle, one at a time, checking for
+    else {
+        renderer.showChanges();
+    }
+}
+
+// Move each particle by its velocity, with collisions
+void GravityParticles::moveParticles()
+{
+    // Update position of each particle, one at a time, checking for
     // collisions and having them react.  This really seems like it shouldn't
     // work, as only one particle is considered at a time while the rest are
     // regarded as stationary.  Yet this naive algorithm, taking many not-
@@ -136,51 +202,57 @@ void GravityParticles::runCycle()
     // calculations and volument of code quickly got out of hand for both
     // the tiny 8-bit AVR microcontroller and my tiny dinosaur brain.)
 
-    uint16_t i, oldidx, newidx, delta;
+    uint16_t i;
+    uint32_t oldidx, newidx, delta;
     uint16_t  newx, newy; //Needs to handle positions overshooting and undershooting grid space
     const int over = 10 * spaceMultiplier; //Add buffer amount to unsigned integers, to keep undershoots >=0
     //const float loss = 1.2; //How much velocity is divided by on each collision
     const int velDiv = 256; //Amount that velocity is divided by when applied to position
     for(i=0; i<numParticles; i++) {
-        newx = particles[i].x + over + (particles[i].vx/velDiv) ; // New position in particle space
-        newy = particles[i].y + over + (particles[i].vy/velDiv);
+        if (cubeMode && moveOffPanel(i)) {
+            //Particle was moving over the edge of a cube panel, which has been dealt with
+            continue;
+        }
+
+        newx = posX[i] + over + (velX[i]/velDiv) ; // New position in particle space
+        newy = posY[i] + over + (velY[i]/velDiv);
         if(newx > maxX + over) {         // If particle would go out of bounds
             newx = maxX + over;          // keep it inside, and
             if ( bounce > 0 ) {
-                particles[i].vx /= -loss;   // give a slight bounce off the wall
+                velX[i] /= -loss;   // give a slight bounce off the wall
             }
             else {
-                particles[i].vx = 0;        // Stop it dead if no bounce
+                velX[i] = 0;        // Stop it dead if no bounce
             }
         } else if(newx < over) {
             newx = over;
             if ( bounce > 0 ) {
-                particles[i].vx /= -loss;   // give a slight bounce off the wall
+                velX[i] /= -loss;   // give a slight bounce off the wall
             }
             else {
-                particles[i].vx = 0;        // Stop it dead if no bounce
+                velX[i] = 0;        // Stop it dead if no bounce
             }
         }
         if(newy > maxY + over) {
             newy = maxY + over;
             if ( bounce > 0 ) {
-                particles[i].vy /= -loss;   // give a slight bounce off the wall
+                velY[i] /= -loss;   // give a slight bounce off the wall
             }
             else {
-                particles[i].vy = 0;        // Stop it dead if no bounce
+                velY[i] = 0;        // Stop it dead if no bounce
             }
         } else if(newy < over) {
             newy = over;
             if ( bounce > 0 ) {
-                particles[i].vy /= -loss;   // give a slight bounce off the wall
+                velY[i] /= -loss;   // give a slight bounce off the wall
                 // char msg[100];
-                // sprintf(msg, "Particle %d: vy %d  bounce %d)\n", i, particles[i].vy, bounce );
+                // sprintf(msg, "Particle %d: vy %d  bounce %d)\n", i, velY[i], bounce );
                 // renderer.outputMessage(msg);
             }
             else {
-                particles[i].vy = 0;        // Stop it dead if no bounce
+                velY[i] = 0;        // Stop it dead if no bounce
                 // char msg[100];
-                // sprintf(msg, "Particle %d: vy %d  bounce %d)\n", i, particles[i].vy, bounce );
+                // sprintf(msg, "Particle %d: vy %d  bounce %d)\n", i, velY[i], bounce );
                 // renderer.outputMessage(msg);
             }
         }
@@ -188,8 +260,8 @@ void GravityParticles::runCycle()
         newx -= over;
         newy -= over;
 
-        oldidx = (particles[i].y/spaceMultiplier) * renderer.getGridWidth() + (particles[i].x/spaceMultiplier); // Prior pixel #
-        newidx = (newy      /spaceMultiplier) * renderer.getGridWidth() + (newx      /spaceMultiplier); // New pixel #
+        oldidx = (uint32_t)(posY[i]/spaceMultiplier) * renderer.getGridWidth() + (posX[i]/spaceMultiplier); // Prior pixel #
+        newidx = (uint32_t)(newy      /spaceMultiplier) * renderer.getGridWidth() + (newx      /spaceMultiplier); // New pixel #
 
     //REMEMBER these debug messages kill the speed of the animation if more than around 10 particles!
     // char msg[100];
@@ -197,55 +269,56 @@ void GravityParticles::runCycle()
     // renderer.outputMessage(msg);
 
         if((oldidx != newidx) // If particle is moving to a new pixel...
-            && renderer.getPixelValue(newidx) ) 
+            && renderer.isOccupied(newidx) ) 
         {       // but if that pixel is already occupied...
-            delta = abs(newidx - oldidx); // What direction when blocked?
+            PROFILE_COUNT(renderer, PROFILE_COLLISIONS, 1);
+            delta = (newidx > oldidx) ? newidx - oldidx : oldidx - newidx; // What direction when blocked?
             if(delta == 1) {            // 1 pixel left or right)
-                newx         = particles[i].x;  // Cancel X motion
-                particles[i].vx /= -loss;          // and bounce X velocity (Y is OK)
+                newx         = posX[i];  // Cancel X motion
+                velX[i] /= -loss;          // and bounce X velocity (Y is OK)
                 newidx       = oldidx;      // No pixel change
             } else if(delta == renderer.getGridWidth()) { // 1 pixel up or down
-                newy         = particles[i].y;  // Cancel Y motion
-                particles[i].vy /= -loss;          // and bounce Y velocity (X is OK)
+                newy         = posY[i];  // Cancel Y motion
+                velY[i] /= -loss;          // and bounce Y velocity (X is OK)
                 newidx       = oldidx;      // No pixel change
             } else { // Diagonal intersection is more tricky...
                 // Try skidding along just one axis of motion if possible (start w/
                 // faster axis).  Because we've already established that diagonal
                 // (both-axis) motion is occurring, moving on either axis alone WILL
                 // change the pixel index, no need to check that again.
-                if((abs(particles[i].vx) - abs(particles[i].vy)) >= 0) { // X axis is faster
-                    newidx = (particles[i].y / spaceMultiplier) * renderer.getGridWidth() + (newx / spaceMultiplier);
-                    if(!renderer.getPixelValue(newidx)) { // That pixel's free!  Take it!  But...
-                        newy         = particles[i].y; // Cancel Y motion
-                        particles[i].vy /= -loss;         // and bounce Y velocity
+                if((abs(velX[i]) - abs(velY[i])) >= 0) { // X axis is faster
+                    newidx = (uint32_t)(posY[i] / spaceMultiplier) * renderer.getGridWidth() + (newx / spaceMultiplier);
+                    if(!renderer.isOccupied(newidx)) { // That pixel's free!  Take it!  But...
+                        newy         = posY[i]; // Cancel Y motion
+                        velY[i] /= -loss;         // and bounce Y velocity
                     } else { // X pixel is taken, so try Y...
-                        newidx = (newy / spaceMultiplier) * renderer.getGridWidth() + (particles[i].x / spaceMultiplier);
-                        if(!renderer.getPixelValue(newidx)) { // Pixel is free, take it, but first...
-                        newx         = particles[i].x; // Cancel X motion
-                        particles[i].vx /= -loss;         // and bounce X velocity
+                        newidx = (uint32_t)(newy / spaceMultiplier) * renderer.getGridWidth() + (posX[i] / spaceMultiplier);
+                        if(!renderer.isOccupied(newidx)) { // Pixel is free, take it, but first...
+                        newx         = posX[i]; // Cancel X motion
+                        velX[i] /= -loss;         // and bounce X velocity
                         } else { // Both spots are occupied
-                        newx         = particles[i].x; // Cancel X & Y motion
-                        newy         = particles[i].y;
-                        particles[i].vx /= -loss;         // Bounce X & Y velocity
-                        particles[i].vy /= -loss;
+                        newx         = posX[i]; // Cancel X & Y motion
+                        newy         = posY[i];
+                        velX[i] /= -loss;         // Bounce X & Y velocity
+                        velY[i] /= -loss;
                         newidx       = oldidx;     // Not moving
                         }
                     }
                 } else { // Y axis is faster, start there
-                    newidx = (newy / spaceMultiplier) * renderer.getGridWidth() + (particles[i].x / spaceMultiplier);
-                    if(!renderer.getPixelValue(newidx)) { // Pixel's free!  Take it!  But...
-                        newx         = particles[i].x; // Cancel X motion
-                        particles[i].vy /= -loss;         // and bounce X velocity
+                    newidx = (uint32_t)(newy / spaceMultiplier) * renderer.getGridWidth() + (posX[i] / spaceMultiplier);
+                    if(!renderer.isOccupied(newidx)) { // Pixel's free!  Take it!  But...
+                        newx         = posX[i]; // Cancel X motion
+                        velY[i] /= -loss;         // and bounce X velocity
                     } else { // Y pixel is taken, so try X...
-                        newidx = (particles[i].y / spaceMultiplier) * renderer.getGridWidth() + (newx / spaceMultiplier);
-                        if(!renderer.getPixelValue(newidx)) { // Pixel is free, take it, but first...
-                            newy         = particles[i].y; // Cancel Y motion
-                            particles[i].vy /= -loss;         // and bounce Y velocity
+                        newidx = (uint32_t)(posY[i] / spaceMultiplier) * renderer.getGridWidth() + (newx / spaceMultiplier);
+                        if(!renderer.isOccupied(newidx)) { // Pixel is free, take it, but first...
+                            newy         = posY[i]; // Cancel Y motion
+                            velY[i] /= -loss;         // and bounce Y velocity
                         } else { // Both spots are occupied
-                            newx         = particles[i].x; // Cancel X & Y motion
-                            newy         = particles[i].y;
-                            particles[i].vx /= -loss;         // Bounce X & Y velocity
-                            particles[i].vy /= -loss;
+                            newx         = posX[i]; // Cancel X & Y motion
+                            newy         = posY[i];
+                            velX[i] /= -loss;         // Bounce X & Y velocity
+                            velY[i] /= -loss;
                             newidx       = oldidx;     // Not moving
                         }
                     }
@@ -258,17 +331,185 @@ void GravityParticles::runCycle()
             uint16_t colcode = renderer.getPixelValue(oldidx);
             renderer.setPixelValue(oldidx, 0);       // Clear old spot
             renderer.setPixelValue(newidx, colcode); // Set new spot
-            renderer.setPixelInstant(particles[i].x/spaceMultiplier,particles[i].y/spaceMultiplier, renderer.getColour(0) );       //Update on screen
-            renderer.setPixelInstant(newx/spaceMultiplier, newy/spaceMultiplier, renderer.getColour(colcode) ); //Update on screen
+            if (drawMoves) {
+                renderer.setPixelInstant(posX[i]/spaceMultiplier,posY[i]/spaceMultiplier, renderer.getColour(0) );       //Update on screen
+                renderer.setPixelInstant(newx/spaceMultiplier, newy/spaceMultiplier, renderer.getColour(colcode) ); //Update on screen
+            }
         }
-        particles[i].x  = newx; // Update particle position
-        particles[i].y  = newy;
+        posX[i]  = newx; // Update particle position
+        posY[i]  = newy;
 //sprintf(msg, "Chang %d: %d -> %d\n", i, oldidx, newidx );
 //renderer.outputMessage(msg);
     }
+}
 
-    //Update LEDs
-    renderer.showPixels(); //Update the display (for hardware which is not instantaneous)
+// Apply acceleration plus random shake to all particle velocities, then limit their speed
+void GravityParticles::applyAcceleration()
+{
+    // Random jitter in the range -shakeFactor to +shakeFactor
+    int16_t shakeFactor = shake / 2;
+    uint16_t i = 0;
+
+#if defined(GRAVITY_PARTICLES_SSE2) || defined(GRAVITY_PARTICLES_NEON)
+    //Update blocks of 8 particles at a time. Jitter is generated first in the same order as the
+    //plain version below, so both give identical results.
+    int16_t accX[8];
+    int16_t accY[8];
+    const int32_t velCap2 = (int32_t)velCap*velCap;
+    for(; i+8<=numParticles; i+=8) {
+        for(uint8_t k=0; k<8; k++) {
+            uint8_t panel = cubeMode ? getPanel(posX[i+k], posY[i+k]) : 0;
+            accX[k] = panelAccelX[panel] + jitter.range(-shakeFactor, shakeFactor + 1); // A little randomness makes
+            accY[k] = panelAccelY[panel] + jitter.range(-shakeFactor, shakeFactor + 1); // tall stacks topple better!
+        }
+#if defined(GRAVITY_PARTICLES_SSE2)
+        __m128i vx = _mm_add_epi16(_mm_loadu_si128((const __m128i*)&velX[i]), _mm_loadu_si128((const __m128i*)accX));
+        __m128i vy = _mm_add_epi16(_mm_loadu_si128((const __m128i*)&velY[i]), _mm_loadu_si128((const __m128i*)accY));
+
+        //Velocity squared as 32 bit values (particles 0-3 in lo, 4-7 in hi)
+        __m128i pairsLo = _mm_unpacklo_epi16(vx, vy);
+        __m128i pairsHi = _mm_unpackhi_epi16(vx, vy);
+        __m128i v2Lo = _mm_madd_epi16(pairsLo, pairsLo);
+        __m128i v2Hi = _mm_madd_epi16(pairsHi, pairsHi);
+        __m128i overLo = _mm_cmpgt_epi32(v2Lo, _mm_set1_epi32(velCap2));
+        __m128i overHi = _mm_cmpgt_epi32(v2Hi, _mm_set1_epi32(velCap2));
+        __m128i over = _mm_packs_epi32(overLo, overHi);
+
+        if (_mm_movemask_epi8(over) != 0) {
+            //Scale velocity of particles over the cap back to magnitude of the cap, maintaining heading
+            __m128 cap = _mm_set1_ps(velCap);
+            __m128 vLo = _mm_sqrt_ps(_mm_cvtepi32_ps(v2Lo));
+            __m128 vHi = _mm_sqrt_ps(_mm_cvtepi32_ps(v2Hi));
+            __m128i vxLo = _mm_srai_epi32(_mm_unpacklo_epi16(vx, vx), 16);
+            __m128i vxHi = _mm_srai_epi32(_mm_unpackhi_epi16(vx, vx), 16);
+            __m128i vyLo = _mm_srai_epi32(_mm_unpacklo_epi16(vy, vy), 16);
+            __m128i vyHi = _mm_srai_epi32(_mm_unpackhi_epi16(vy, vy), 16);
+            __m128i cappedX = _mm_packs_epi32(
+                _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(cap, _mm_cvtepi32_ps(vxLo)), vLo)),
+                _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(cap, _mm_cvtepi32_ps(vxHi)), vHi)));
+            __m128i cappedY = _mm_packs_epi32(
+                _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(cap, _mm_cvtepi32_ps(vyLo)), vLo)),
+                _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(cap, _mm_cvtepi32_ps(vyHi)), vHi)));
+            vx = _mm_or_si128(_mm_and_si128(over, cappedX), _mm_andnot_si128(over, vx));
+            vy = _mm_or_si128(_mm_and_si128(over, cappedY), _mm_andnot_si128(over, vy));
+        }
+
+        _mm_storeu_si128((__m128i*)&velX[i], vx);
+        _mm_storeu_si128((__m128i*)&velY[i], vy);
+#else
+        int16x8_t vx = vaddq_s16(vld1q_s16(&velX[i]), vld1q_s16(accX));
+        int16x8_t vy = vaddq_s16(vld1q_s16(&velY[i]), vld1q_s16(accY));
+
+        //Velocity squared as 32 bit values (particles 0-3 in lo, 4-7 in hi)
+        int32x4_t v2Lo = vmlal_s16(vmull_s16(vget_low_s16(vx), vget_low_s16(vx)), vget_low_s16(vy), vget_low_s16(vy));
+        int32x4_t v2Hi = vmlal_s16(vmull_s16(vget_high_s16(vx), vget_high_s16(vx)), vget_high_s16(vy), vget_high_s16(vy));
+        uint16x8_t over = vcombine_u16(vmovn_u32(vcgtq_s32(v2Lo, vdupq_n_s32(velCap2))),
+                                       vmovn_u32(vcgtq_s32(v2Hi, vdupq_n_s32(velCap2))));
+#if defined(__aarch64__)
+        if (vmaxvq_u16(over) != 0) {
+            //Scale velocity of particles over the cap back to magnitude of the cap, maintaining heading
+            float32x4_t cap = vdupq_n_f32(velCap);
+            float32x4_t vLo = vsqrtq_f32(vcvtq_f32_s32(v2Lo));
+            float32x4_t vHi = vsqrtq_f32(vcvtq_f32_s32(v2Hi));
+            int16x8_t cappedX = vcombine_s16(
+                vqmovn_s32(vcvtq_s32_f32(vdivq_f32(vmulq_f32(cap, vcvtq_f32_s32(vmovl_s16(vget_low_s16(vx)))), vLo))),
+                vqmovn_s32(vcvtq_s32_f32(vdivq_f32(vmulq_f32(cap, vcvtq_f32_s32(vmovl_s16(vget_high_s16(vx)))), vHi))));
+            int16x8_t cappedY = vcombine_s16(
+                vqmovn_s32(vcvtq_s32_f32(vdivq_f32(vmulq_f32(cap, vcvtq_f32_s32(vmovl_s16(vget_low_s16(vy)))), vLo))),
+                vqmovn_s32(vcvtq_s32_f32(vdivq_f32(vmulq_f32(cap, vcvtq_f32_s32(vmovl_s16(vget_high_s16(vy)))), vHi))));
+            vx = vbslq_s16(over, cappedX, vx);
+            vy = vbslq_s16(over, cappedY, vy);
+        }
+        vst1q_s16(&velX[i], vx);
+        vst1q_s16(&velY[i], vy);
+#else
+        //32 bit ARM has no vector divide or square root, so cap any fast particles one at a time
+        vst1q_s16(&velX[i], vx);
+        vst1q_s16(&velY[i], vy);
+        uint16x4_t anyOver = vorr_u16(vget_low_u16(over), vget_high_u16(over));
+        if (vget_lane_u64(vreinterpret_u64_u16(anyOver), 0) != 0) {
+            for(uint8_t k=0; k<8; k++) {
+                capVelocity(velX[i+k], velY[i+k], velCap);
+            }
+        }
+#endif
+#endif
+    }
+#endif
+
+    //Remaining particles (or all particles where SIMD is not available)
+    for(; i<numParticles; i++) {
+        uint8_t panel = cubeMode ? getPanel(posX[i], posY[i]) : 0;
+        int16_t axa = panelAccelX[panel] + jitter.range(-shakeFactor, shakeFactor + 1); // A little randomness makes
+        int16_t aya = panelAccelY[panel] + jitter.range(-shakeFactor, shakeFactor + 1); // tall stacks topple better!
+        velX[i] += axa;
+        velY[i] += aya;
+        capVelocity(velX[i], velY[i], velCap);
+    //REMEMBER these debug messages kill the speed of the animation if more than around 10 particles!
+    // char msg[80];
+    // sprintf(msg, "Particle %d Vel: %d,%d; a=%d,%d\n", i, int(velX[i]), int(velY[i]), axa, aya );
+    // renderer.outputMessage(msg);
+    }
+}
+
+// Cube panel a position in particle space is on
+inline uint8_t GravityParticles::getPanel(uint16_t x, uint16_t y)
+{
+    return (y >= panelSpan) * 3 + (x >= panelSpan) + (x >= 2 * panelSpan);
+}
+
+// In cube mode, moves a particle which is moving off the edge of the panel it is on over onto the
+// panel on the other side of the cube edge, turning its velocity to match the new panel. If the
+// particle stays on the same panel, nothing is changed and false is returned.
+bool GravityParticles::moveOffPanel(uint16_t i)
+{
+    const int velDiv = 256; //Amount that velocity is divided by when applied to position
+    int32_t x = posX[i] + (velX[i]/velDiv);
+    int32_t y = posY[i] + (velY[i]/velDiv);
+    uint8_t panelCol = (posX[i] >= panelSpan) + (posX[i] >= 2 * panelSpan);
+    uint8_t panelRow = (posY[i] >= panelSpan);
+    int32_t localX = x - panelCol * panelSpan;
+    int32_t localY = y - panelRow * panelSpan;
+    uint8_t edgeX = (localX >= 0) + (localX >= panelSpan);
+    uint8_t edgeY = (localY >= 0) + (localY >= panelSpan);
+    if ( (edgeX == 1) && (edgeY == 1) ) {
+        return false;
+    }
+
+    //Transform the position using the transition for the edge being crossed. The table works in
+    //whole pixels, so when the direction is reversed the position within the pixel has to be too.
+    const CubeTransition &t = renderer.getCubeTransition(panelRow * 3 + panelCol, edgeX, edgeY);
+    uint16_t newx = t.xx * x + t.xy * y + t.offsetX * spaceMultiplier + ((t.xx + t.xy < 0) ? spaceMultiplier - 1 : 0);
+    uint16_t newy = t.yx * x + t.yy * y + t.offsetY * spaceMultiplier + ((t.yx + t.yy < 0) ? spaceMultiplier - 1 : 0);
+
+    uint32_t oldidx = (uint32_t)(posY[i]/spaceMultiplier) * renderer.getGridWidth() + (posX[i]/spaceMultiplier);
+    uint32_t newidx = (uint32_t)(newy/spaceMultiplier) * renderer.getGridWidth() + (newx/spaceMultiplier);
+    if (renderer.isOccupied(newidx)) {
+        //Pixel on the other side of the edge is occupied, so bounce back off it
+        PROFILE_COUNT(renderer, PROFILE_COLLISIONS, 1);
+        if (edgeX != 1) {
+            velX[i] /= -loss;
+        }
+        if (edgeY != 1) {
+            velY[i] /= -loss;
+        }
+        return true;
+    }
+
+    uint16_t colcode = renderer.getPixelValue(oldidx);
+    renderer.setPixelValue(oldidx, 0);
+    renderer.setPixelValue(newidx, colcode);
+    if (drawMoves) {
+        renderer.setPixelInstant(posX[i]/spaceMultiplier,posY[i]/spaceMultiplier, renderer.getColour(0) );
+        renderer.setPixelInstant(newx/spaceMultiplier, newy/spaceMultiplier, renderer.getColour(colcode) );
+    }
+    posX[i] = newx;
+    posY[i] = newy;
+    int16_t vx = velX[i];
+    velX[i] = t.xx * vx + t.xy * velY[i];
+    velY[i] = t.yx * vx + t.yy * velY[i];
+
+    return true;
 }
 
 // Acceleration setter for simple 2D panel arrangements (for backwards compatibility with existing code)
@@ -278,6 +519,10 @@ void GravityParticles::setAcceleration(int16_t x, int16_t y)
     //e.g. +ve accelX will cause sand particles to move to greater X positions.
     accelX = x;
     accelY = y;
+    for (uint8_t p=0; p<6; p++) {
+        panelAccelX[p] = x;
+        panelAccelY[p] = y;
+    }
     
     //Limit maximum velocity based on strength of gravity
     uint16_t maxVel = sqrt( (int32_t)x*x+(int32_t)y*y ) * spaceMultiplier / 32;
@@ -304,6 +549,18 @@ void GravityParticles::setAcceleration(int16_t x, int16_t y, int16_t z)
     //Set per panel for 6 cube faces
     accelX = x;
     accelY = y;
+    if (cubeMode) {
+        //Project the acceleration onto each panel here, so every particle just looks up its panel
+        int16_t accel[3] = {x, y, z};
+        for (uint8_t p=0; p<6; p++) {
+            panelAccelX[p] = accel[panelAxes[p][0]] * panelAxes[p][1];
+            panelAccelY[p] = accel[panelAxes[p][2]] * panelAxes[p][3];
+        }
+    }
+    else {
+        panelAccelX[0] = x;
+        panelAccelY[0] = y;
+    }
     
     //Limit maximum velocity based on strength of gravity
     uint16_t xyAbs = sqrt( (int32_t)x*x+(int32_t)y*y );
@@ -320,7 +577,7 @@ void GravityParticles::setAcceleration(int16_t x, int16_t y, int16_t z)
         
 
     char msg[255];
-    sprintf(msg,"Acceleration set: %d,%d Vel min: %d, max: %d, cap: %d\n", accelX, accelY, minVelCap, maxVel, velCap );
+    sprintf(msg,"Acceleration set: %d,%d,%d Vel min: %d, max: %d, cap: %d\n", accelX, accelY, z, minVelCap, maxVel, velCap );
     renderer.outputMessage(msg);
 
 }
@@ -333,17 +590,17 @@ void GravityParticles::addParticle(RGB_colour colour, int16_t vx, int16_t vy)
     uint16_t x,y;
     uint16_t attempts = 0;
     do {
-        x = renderer.random_int16(0,renderer.getGridWidth() ); // Assign random position within
-        y = renderer.random_int16(0,renderer.getGridHeight() ); // the 'particle' coordinate space
+        x = renderer.randomRange(0,renderer.getGridWidth() ); // Assign random position within
+        y = renderer.randomRange(0,renderer.getGridHeight() ); // the 'particle' coordinate space
         attempts++;
         // Check if corresponding pixel position is already occupied...
         // char msg[50];
         // sprintf(msg, "Random place attempt %d\n", attempts);
         // renderer.outputMessage(msg);
-    } while ( (renderer.getPixelValue(y * renderer.getGridWidth() + x)) && (attempts < 2001) ); // Keep retrying until a clear spot is found
+    } while ( renderer.isOccupied((uint32_t)y * renderer.getGridWidth() + x) && (attempts < 2001) ); // Keep retrying until a clear spot is found
     
     //Add particle if free position was found
-    if ( (renderer.getPixelValue(y * renderer.getGridWidth() + x)) == false ) {
+    if ( renderer.isOccupied((uint32_t)y * renderer.getGridWidth() + x) == false ) {
         addParticle(x,y,colour,vx,vy);
     }
     else {
@@ -357,70 +614,171 @@ void GravityParticles::addParticle(RGB_colour colour, int16_t vx, int16_t vy)
 void GravityParticles::addParticle(uint16_t x, uint16_t y, RGB_colour colour, int16_t vx, int16_t vy)
 {
     //Place particle into array at specified position.
+    if (storeParticle(x,y,vx,vy)) {
+        renderer.setPixelValue( (uint32_t)y * renderer.getGridWidth() + x, renderer.getColourId(colour) ); // Mark it
+    }
+
+// char msg[100];
+// sprintf(msg, "Particle placed %d,%d vel: %d,%d colour:%d; Total:%d\n", x,y, vx,vy, renderer.getColourId(colour), numParticles );
+// renderer.outputMessage(msg);
+
+}
+
+// Add a particle to the store at a pixel position, without marking the pixel. Returns false if the
+// store is full and cannot be expanded.
+bool GravityParticles::storeParticle(uint16_t x, uint16_t y, int16_t vx, int16_t vy)
+{
     uint16_t i = numParticles;
 
     //Check for particles array overflow
+    if ( (i == maxParticles) && fixedStore ) {
+        return false;
+    }
     if (i == maxParticles) {
-        //Expand particles array
-        Particle* newArr = new Particle[maxParticles + 20];
-        for (uint16_t i = 0; i < maxParticles; i++) {
-            newArr[i] = particles[i];
+        //Expand particles store, doubling in size so adding many particles only copies the store a few times
+        if (maxParticles > 32767) {
+            reserve(65535);
+        }
+        else {
+            reserve(maxParticles * 2);
+        }
+        if (i == maxParticles) {
+            //Store cannot grow any further
+            return false;
         }
-        delete[] particles;
-        particles = newArr;
-        maxParticles += 20;
-        char msg[50];
-        sprintf(msg, "Particle store expanded to size %d\n", maxParticles);
-        renderer.outputMessage(msg);
     }
 
-    particles[i].x = (x * spaceMultiplier)+renderer.random_int16(0,spaceMultiplier); // Assign position in centre of
-    particles[i].y = (y * spaceMultiplier)+renderer.random_int16(0,spaceMultiplier); // the 'particle' coordinate space
+    posX[i] = (x * spaceMultiplier)+renderer.randomRange(0,spaceMultiplier); // Assign position in centre of
+    posY[i] = (y * spaceMultiplier)+renderer.randomRange(0,spaceMultiplier); // the 'particle' coordinate space
     numParticles++;
     //Set initial velocity
-    particles[i].vx = vx;
-    particles[i].vy = vy; 
-    renderer.setPixelValue( (particles[i].y / spaceMultiplier) * renderer.getGridWidth() + (particles[i].x / spaceMultiplier), renderer.getColourId(colour) ); // Mark it
-
-// char msg[100];
-// sprintf(msg, "Particle placed %d,%d (%d,%d) vel: %d,%d colour:%d; Total:%d\n", x,y, int(particles[i].x),int(particles[i].y), vx,vy, renderer.getColourId(colour), numParticles );
-// renderer.outputMessage(msg);
+    velX[i] = vx;
+    velY[i] = vy; 
 
+    return true;
 }
 
-GravityParticles::Particle GravityParticles::deleteParticle(uint16_t index)
+// Delete particle at index, returning its state. By default the order of remaining particles is
+// kept (so older particles stay at lower indices), which means moving all particles after it down
+// one place. Set keepOrder false to move the last particle into the gap instead, which is much faster.
+GravityParticles::Particle GravityParticles::deleteParticle(uint16_t index, bool keepOrder)
 {
     Particle particle;
-    particle.x = particles[index].x;
-    particle.y = particles[index].y;
-    particle.vx = particles[index].vx;
-    particle.vy = particles[index].vy;
-
-    //Move all particles from specified index to end of array down one position
-    for(uint16_t i=index; i<numParticles-1; i++) {
-        particles[i].x = particles[i+1].x;
-        particles[i].y = particles[i+1].y;
-        particles[i].vx = particles[i+1].vx;
-        particles[i].vy = particles[i+1].vy;
+    particle.x = posX[index];
+    particle.y = posY[index];
+    particle.vx = velX[index];
+    particle.vy = velY[index];
+
+    if (keepOrder) {
+        //Move all particles from specified index to end of array down one position
+        for(uint16_t i=index; i<numParticles-1; i++) {
+            posX[i] = posX[i+1];
+            posY[i] = posY[i+1];
+            velX[i] = velX[i+1];
+            velY[i] = velY[i+1];
+        }
+    }
+    else {
+        //Fill gap with last particle
+        posX[index] = posX[numParticles-1];
+        posY[index] = posY[numParticles-1];
+        velX[index] = velX[numParticles-1];
+        velY[index] = velY[numParticles-1];
     }
     numParticles--;
 
     //Delete pixel where old particle was
-    renderer.setPixelValue( (particle.y / spaceMultiplier) * renderer.getGridWidth() + (particle.x / spaceMultiplier), 0 ); // Mark it
+    renderer.setPixelValue( (uint32_t)(particle.y / spaceMultiplier) * renderer.getGridWidth() + (particle.x / spaceMultiplier), 0 ); // Mark it
     renderer.setPixelInstant(particle.x/spaceMultiplier,particle.y/spaceMultiplier, renderer.getColour(0) );
 
     return particle;
 }
 
+// Delete a batch of particles in a single pass over the store, keeping the order of the remaining
+// particles. Indices must be in ascending order. Returns the number of particles deleted.
+uint16_t GravityParticles::deleteParticles(const uint16_t* indices, uint16_t count)
+{
+    uint16_t deleted = 0;
+    uint16_t kept = 0;
+
+    for(uint16_t i=0; i<numParticles; i++) {
+        if ( (deleted < count) && (indices[deleted] == i) ) {
+            //Delete pixel where old particle was
+            renderer.setPixelValue( (uint32_t)(posY[i] / spaceMultiplier) * renderer.getGridWidth() + (posX[i] / spaceMultiplier), 0 );
+            renderer.setPixelInstant(posX[i]/spaceMultiplier,posY[i]/spaceMultiplier, renderer.getColour(0) );
+            deleted++;
+        }
+        else {
+            //Shuffle kept particles down over the gaps
+            if (kept != i) {
+                posX[kept] = posX[i];
+                posY[kept] = posY[i];
+                velX[kept] = velX[i];
+                velY[kept] = velY[i];
+            }
+            kept++;
+        }
+    }
+    numParticles = kept;
+
+    return deleted;
+}
+
+// Make room in the particle store for at least the number of particles given, so they can be
+// added without the store being expanded as they are added
+void GravityParticles::reserve(uint16_t capacity)
+{
+    if (capacity <= maxParticles) {
+        return;
+    }
+
+    uint16_t* newPosX = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * capacity);
+    uint16_t* newPosY = (uint16_t*)RGBMatrixRenderer::allocateAligned(sizeof(uint16_t) * capacity);
+    int16_t* newVelX = (int16_t*)RGBMatrixRenderer::allocateAligned(sizeof(int16_t) * capacity);
+    int16_t* newVelY = (int16_t*)RGBMatrixRenderer::allocateAligned(sizeof(int16_t) * capacity);
+    for (uint16_t i = 0; i < numParticles; i++) {
+        newPosX[i] = posX[i];
+        newPosY[i] = posY[i];
+        newVelX[i] = velX[i];
+        newVelY[i] = velY[i];
+    }
+    RGBMatrixRenderer::freeAligned(posX);
+    RGBMatrixRenderer::freeAligned(posY);
+    RGBMatrixRenderer::freeAligned(velX);
+    RGBMatrixRenderer::freeAligned(velY);
+    posX = newPosX;
+    posY = newPosY;
+    velX = newVelX;
+    velY = newVelY;
+    maxParticles = capacity;
+
+    char msg[50];
+    sprintf(msg, "Particle store expanded to size %d\n", maxParticles);
+    renderer.outputMessage(msg);
+}
+
+// Make room for a number of particles on top of those already in the store, up to the store limit
+void GravityParticles::reserveExtra(uint32_t count)
+{
+    if (fixedStore) {
+        return;
+    }
+    uint32_t capacity = numParticles + count;
+    if (capacity > 65535) {
+        capacity = 65535;
+    }
+    reserve(capacity);
+}
+
 GravityParticles::Particle GravityParticles::getParticle(uint16_t index)
 {
     Particle particle;
 
     //Convert position back into pixel coordinates
-    particle.x = particles[index].x/spaceMultiplier;
-    particle.y = particles[index].y/spaceMultiplier;
-    particle.vx = particles[index].vx;
-    particle.vy = particles[index].vy;
+    particle.x = posX[index]/spaceMultiplier;
+    particle.y = posY[index]/spaceMultiplier;
+    particle.vx = velX[index];
+    particle.vy = velY[index];
 
     return particle;
 }
@@ -436,16 +794,74 @@ void GravityParticles::clearParticles()
     numParticles = 0;
 }
 
+/* Convert all pixels in current image to particles. Lit pixels are counted from the occupancy
+ * bitmap first so the particle store is only expanded once. The pixels already hold the palette id
+ * of their colour, so they are left as they are rather than looking the colour up again.
+ */
 void GravityParticles::imgToParticles()
 {
-    //Convert all pixels in current image to particles
-    for(int y=0; y<renderer.getGridHeight(); y++) {
-        for(int x=0; x<renderer.getGridWidth(); x++) {
-            uint8_t colcode = renderer.getPixelValue(x,y);
-            if (colcode > 0) {
-                addParticle(x,y,renderer.getColour(colcode));
+    uint16_t width = renderer.getGridWidth();
+    uint32_t pixels = (uint32_t)width * renderer.getGridHeight();
+
+    uint32_t lit = 0;
+    for (uint32_t i=0; i<pixels; i+=8) {
+        uint8_t bits = renderer.getOccupiedBits(i);
+        while (bits) {
+            bits &= bits - 1;
+            lit++;
+        }
+    }
+    reserveExtra(lit);
+
+    for (uint32_t i=0; i<pixels; i+=8) {
+        uint8_t bits = renderer.getOccupiedBits(i);
+        while (bits) {
+            uint32_t index = i + __builtin_ctz(bits);
+            bits &= bits - 1;
+            if (!storeParticle(index % width, index / width, 0, 0)) {
+                return;
             }
         }
     }
+}
 
+/* Convert an image in an RGB buffer (such as a canvas text has been drawn on) to particles. The
+ * buffer must be the size of the grid, in rows from y = 0 or from the top row when flipY is set.
+ * Each colour is looked up in the palette once for each run of pixels of that colour, and pixels
+ * which already hold a particle are skipped.
+ */
+void GravityParticles::imgToParticles(const RGB_colour* buffer, bool flipY)
+{
+    uint16_t width = renderer.getGridWidth();
+    uint16_t height = renderer.getGridHeight();
+    uint32_t pixels = (uint32_t)width * height;
+
+    uint32_t lit = 0;
+    for (uint32_t i=0; i<pixels; i++) {
+        if (buffer[i].r | buffer[i].g | buffer[i].b) {
+            lit++;
+        }
+    }
+    reserveExtra(lit);
+
+    RGB_colour lastColour;
+    uint16_t lastId = 0;
+    for (uint16_t y=0; y<height; y++) {
+        const RGB_colour* row = buffer + (uint32_t)(flipY ? height - 1 - y : y) * width;
+        uint32_t index = (uint32_t)y * width;
+        for (uint16_t x=0; x<width; x++, index++) {
+            RGB_colour colour = row[x];
+            if ( ((colour.r | colour.g | colour.b) == 0) || renderer.isOccupied(index) ) {
+                continue;
+            }
+            if ( (lastId == 0) || (colour.r != lastColour.r) || (colour.g != lastColour.g) || (colour.b != lastColour.b) ) {
+                lastColour = colour;
+                lastId = renderer.getColourId(colour);
+            }
+            if (!storeParticle(x, y, 0, 0)) {
+                return;
+            }
+            renderer.setPixelValue(index, lastId);
+        }
+    }
 }
\ No newline at end of file
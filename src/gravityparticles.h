@@ -61,33 +61,56 @@ class GravityParticles
     private:
         int delayms;
         RGBMatrixRenderer &renderer;
-        Particle* particles;
+        // Particle store, laid out as separate arrays for each component so loops over
+        // all particles work through contiguous memory
+        uint16_t* posX;
+        uint16_t* posY;
+        int16_t* velX;
+        int16_t* velY;
         uint16_t spaceMultiplier;
-        uint16_t maxParticles;
+        uint16_t maxParticles; // Capacity of particle store
+        bool fixedStore; // Set when the store was sized by the constructor, so it is never expanded
         uint16_t numParticles;
         uint16_t maxX;
         uint16_t maxY;
         int16_t accelX;
         int16_t accelY;
+        // Acceleration along the x and y directions of each cube panel (only panel 0 is used when
+        // not in cube mode)
+        int16_t panelAccelX[6];
+        int16_t panelAccelY[6];
+        bool cubeMode;
+        uint16_t panelSpan; // Width and height of a cube panel in particle space
         int16_t accelAbs;
         uint16_t shake;
+        RandomStream jitter; // Random stream for shake jitter, which is needed twice for every particle on every frame
         uint16_t velCap;
         float_t loss;
         uint8_t bounce;
+        bool drawMoves; // Send each particle move straight to the display (only when running one step per frame)
     //functions
     public:
-        GravityParticles(RGBMatrixRenderer&,uint16_t,uint8_t=10);
+        GravityParticles(RGBMatrixRenderer&,uint16_t,uint8_t=10,uint16_t=0);
         ~GravityParticles();
-        void runCycle();
+        void runCycle(uint16_t=1);
         void setAcceleration(int16_t,int16_t);
         void setAcceleration(int16_t,int16_t,int16_t);
         void addParticle(RGB_colour,int16_t=0,int16_t=0);
         void addParticle(uint16_t,uint16_t,RGB_colour,int16_t=0,int16_t=0);
-        Particle deleteParticle(uint16_t);
+        Particle deleteParticle(uint16_t,bool=true);
+        uint16_t deleteParticles(const uint16_t*,uint16_t);
+        void reserve(uint16_t);
         Particle getParticle(uint16_t);
         void clearParticles();
         uint16_t getParticleCount();
         void imgToParticles();
+        void imgToParticles(const RGB_colour*,bool=false);
     protected:
     private:
+        bool storeParticle(uint16_t,uint16_t,int16_t,int16_t);
+        void reserveExtra(uint32_t);
+        void applyAcceleration();
+        void moveParticles();
+        uint8_t getPanel(uint16_t,uint16_t);
+        bool moveOffPanel(uint16_t);
 }; //GravityParticles
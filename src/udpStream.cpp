@@ -0,0 +1,187 @@
+/**************************************************************************************************
+ * UDP frame streaming
+ *
+ * Renderer which sends the pixels changed in each frame over the network, and a receiver which
+ * applies them to the renderer for a remote display.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "udpStream.h"
+
+#if !defined(ARDUINO)
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+//Largest payload of a UDP packet, so the receive buffer can hold any packet
+static const uint32_t MAX_DATAGRAM = 65507;
+
+// default constructor
+UDPStreamRenderer::UDPStreamRenderer(uint16_t width, uint16_t height, uint8_t brightnessLimit, bool inCubeMode)
+    : FrameStreamRenderer(width, height, brightnessLimit, inCubeMode), socketFd(-1)
+{
+} //UDPStreamRenderer
+
+// default destructor
+UDPStreamRenderer::~UDPStreamRenderer()
+{
+    closeStream();
+} //~UDPStreamRenderer
+
+//Send packets to a host name or address, which can be a broadcast or multicast address
+void UDPStreamRenderer::openStream(const char* host, uint16_t port)
+{
+    closeStream();
+
+    struct addrinfo hints;
+    struct addrinfo* found;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &found) != 0) {
+        throw std::invalid_argument("Could not find address of stream host.");
+    }
+    memcpy(&destination, found->ai_addr, sizeof(destination));
+    destination.sin_port = htons(port);
+    freeaddrinfo(found);
+
+    socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd < 0) {
+        throw std::runtime_error("Could not open socket for stream.");
+    }
+    int broadcast = 1;
+    setsockopt(socketFd, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+
+    //Receivers need a whole frame to pick up from
+    requestKeyframe();
+}
+
+void UDPStreamRenderer::closeStream()
+{
+    if (socketFd >= 0) {
+        close(socketFd);
+        socketFd = -1;
+    }
+}
+
+//Send a packet over the socket opened by openStream, returning whether it went
+bool UDPStreamRenderer::sendPacket(const uint8_t* data, uint16_t length)
+{
+    if (socketFd < 0) {
+        return false;
+    }
+    ssize_t sent = sendto(socketFd, data, length, 0, (struct sockaddr*)&destination, sizeof(destination));
+    if (sent == length) {
+        return true;
+    }
+    //Only report the first failure, as it is likely to keep happening
+    if (getFailedPackets() == 0) {
+        char msg[100];
+        sprintf(msg, "Stream packet could not be sent: %s\n", strerror(errno));
+        outputMessage(msg);
+    }
+    return false;
+}
+
+// default constructor
+UDPStreamReceiver::UDPStreamReceiver(RGBMatrixRenderer &renderer_, int16_t offsetX_, int16_t offsetY_)
+    : FrameStreamReceiver(renderer_, offsetX_, offsetY_), socketFd(-1), receiveBuffer(NULL)
+{
+} //UDPStreamReceiver
+
+// default destructor
+UDPStreamReceiver::~UDPStreamReceiver()
+{
+    closeStream();
+} //~UDPStreamReceiver
+
+//Listen for the stream on a port, joining a multicast group if one is given
+void UDPStreamReceiver::openStream(uint16_t port, const char* multicastGroup)
+{
+    closeStream();
+
+    socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd < 0) {
+        throw std::runtime_error("Could not open socket for stream.");
+    }
+    //Let several receivers listen on the same port, so they can share a broadcast stream
+    int reuse = 1;
+    setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(socketFd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+        closeStream();
+        throw std::runtime_error("Could not listen on stream port.");
+    }
+
+    if (multicastGroup != NULL) {
+        struct ip_mreq group;
+        memset(&group, 0, sizeof(group));
+        if (inet_pton(AF_INET, multicastGroup, &group.imr_multiaddr) != 1) {
+            closeStream();
+            throw std::invalid_argument("Multicast group must be an IPv4 address.");
+        }
+        group.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (setsockopt(socketFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &group, sizeof(group)) < 0) {
+            closeStream();
+            throw std::runtime_error("Could not join multicast group.");
+        }
+    }
+
+    receiveBuffer = new uint8_t[MAX_DATAGRAM];
+    restart();
+}
+
+void UDPStreamReceiver::closeStream()
+{
+    if (socketFd >= 0) {
+        close(socketFd);
+        socketFd = -1;
+    }
+    delete [] receiveBuffer;
+    receiveBuffer = NULL;
+}
+
+/* Wait up to the given number of milliseconds for a packet (-1 to wait for ever) and apply it.
+ * Returns true when the packet completed a frame.
+ */
+bool UDPStreamReceiver::receive(int timeoutMs)
+{
+    if (socketFd < 0) {
+        return false;
+    }
+    struct pollfd waitFor;
+    waitFor.fd = socketFd;
+    waitFor.events = POLLIN;
+    if (poll(&waitFor, 1, timeoutMs) <= 0) {
+        return false;
+    }
+    ssize_t length = recv(socketFd, receiveBuffer, MAX_DATAGRAM, 0);
+    if (length <= 0) {
+        return false;
+    }
+    return applyPacket(receiveBuffer, length);
+}
+#endif
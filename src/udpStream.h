@@ -0,0 +1,76 @@
+/**************************************************************************************************
+ * UDP frame streaming
+ *
+ * UDPStreamRenderer is a renderer which sends frames over the network to remote panels, instead of
+ * driving display hardware itself. Only the pixels which changed since the last frame are sent
+ * (see frameStream.h for the stream format), so bandwidth depends on how much of the display
+ * changes rather than on the size of the grid. Packets can be sent to a broadcast or multicast
+ * address, so several panels can each show part of one large stream.
+ *
+ * UDPStreamReceiver listens for the stream, and applies it to the renderer for the display
+ * hardware of a remote panel.
+ *
+ * Copyright (C) 2022 Paul Fretwell - aka 'Footleg'
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This code is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this software.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "frameStream.h"
+
+#if !defined(ARDUINO)
+#include <netinet/in.h>
+
+#define UDP_STREAM_DEFAULT_PORT 5570
+
+class UDPStreamRenderer : public FrameStreamRenderer
+{
+    //variables
+    public:
+    protected:
+    private:
+        int socketFd;
+        struct sockaddr_in destination;
+
+    //functions
+    public:
+        UDPStreamRenderer(uint16_t, uint16_t, uint8_t=255, bool=false);
+        virtual ~UDPStreamRenderer();
+        void openStream(const char*, uint16_t=UDP_STREAM_DEFAULT_PORT);
+        void closeStream();
+    protected:
+        bool sendPacket(const uint8_t*, uint16_t);
+
+}; //UDPStreamRenderer
+
+class UDPStreamReceiver : public FrameStreamReceiver
+{
+    //variables
+    public:
+    protected:
+    private:
+        int socketFd;
+        uint8_t* receiveBuffer;
+
+    //functions
+    public:
+        UDPStreamReceiver(RGBMatrixRenderer&, int16_t=0, int16_t=0);
+        ~UDPStreamReceiver();
+        void openStream(uint16_t=UDP_STREAM_DEFAULT_PORT, const char* =NULL);
+        void closeStream();
+        bool receive(int);
+
+}; //UDPStreamReceiver
+#endif